@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+/*
+ * Throughput of the copy kernels against memcpy for the copy sizes seen
+ * on the data path. Like the cvlt write-out copies, every copy reads
+ * and writes a buffer which has not been touched recently: the copies
+ * walk through an arena much larger than the last level cache. The
+ * cost of the non temporal stores to a reader of the destination is not
+ * measured, so this bench alone does not set bulk_copy_min.
+ *
+ * usage: bulk_copy_bench [arena MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <arch_copy.h>
+
+static double measure (openarchive::arch_copy::copy_kernel_t kernel,
+                       char *src, char *dst, size_t arena, size_t len)
+{
+    size_t copies = arena / len;
+    size_t total = 0;
+    std::chrono::steady_clock::time_point start;
+
+    start = std::chrono::steady_clock::now ();
+
+    /*
+     * At least 1GB per measurement, walking the whole arena each pass.
+     */
+    while (total < ((size_t) 1 << 30)) {
+        for (size_t count = 0; count < copies; count++) {
+            kernel (dst + count * len, src + count * len, len);
+        }
+        total += copies * len;
+    }
+
+    double secs = std::chrono::duration<double> (
+                       std::chrono::steady_clock::now () - start).count ();
+
+    return (total / secs) / (1 << 20);
+}
+
+int main (int argc, char **argv)
+{
+    size_t arena = (argc > 1? strtoull (argv[1], NULL, 0): 512) << 20;
+    const char * kernels[] = { "memcpy", "sse2", "avx2", "avx512" };
+    const size_t nkernels = sizeof (kernels) / sizeof (kernels[0]);
+
+    char *src = (char *) aligned_alloc (4096, arena);
+    char *dst = (char *) aligned_alloc (4096, arena);
+    if (!src || !dst) {
+        fprintf (stderr, "failed to allocate %zu bytes\n", 2 * arena);
+        return 1;
+    }
+
+    memset (src, 0x5a, arena);
+    memset (dst, 0xa5, arena);
+
+    printf ("%10s", "size");
+    for (size_t idx = 0; idx < nkernels; idx++) {
+        printf (" %10s", kernels[idx]);
+    }
+    printf ("   (MB/s)\n");
+
+    for (size_t len = 4096; len <= ((size_t) 16 << 20); len *= 2) {
+        printf ("%10zu", len);
+
+        for (size_t idx = 0; idx < nkernels; idx++) {
+            openarchive::arch_copy::copy_kernel_t kernel = 
+                         openarchive::arch_copy::find_copy_kernel (kernels[idx]);
+            if (!kernel) {
+                printf (" %10s", "-");
+                continue;
+            }
+
+            printf (" %10.0f", measure (kernel, src, dst, arena, len));
+        }
+
+        printf ("\n");
+        fflush (stdout);
+    }
+
+    free (src);
+    free (dst);
+    return 0;
+}
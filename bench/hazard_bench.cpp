@@ -0,0 +1,175 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+/*
+ * Scaling benchmark of the read-ahead hit path of the fd-cache. Readers
+ * protect the published snapshot with a hazard pointer and copy a small
+ * read out of its buffer, the way fastbuff does, while a writer keeps
+ * publishing new snapshots and retiring the old ones. The same reads
+ * done under the shared fdlock, the path the hits took before, are the
+ * baseline. A reader which sees a retired snapshot freed fails the run.
+ *
+ * usage: hazard_bench [reads per thread] [read size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arch_core.h>
+
+const uint64_t snap_magic = 0x736e617073686f74ULL;
+const uint32_t snap_size  = 64 * 1024;
+
+struct snapshot
+{
+    uint64_t magic;
+    uint64_t offset;
+    char data[snap_size];
+
+    snapshot (uint64_t off): magic (snap_magic), offset (off)
+    {
+        memset (data, (int) off, sizeof (data));
+    }
+
+    ~snapshot (void)
+    {
+        magic = 0;
+    }
+};
+
+static std::atomic<snapshot *> current;
+static openarchive::arch_core::rwlock fdlock;
+static snapshot * locked;
+static std::atomic<bool> stop;
+static std::atomic<uint64_t> errors;
+
+static void hazard_reader (uint64_t reads, uint32_t size)
+{
+    std::vector <char> buff (size);
+
+    for (uint64_t count = 0; count < reads; count++) {
+        openarchive::arch_core::hazard_ptr hp;
+        snapshot * snap = hp.protect (current);
+
+        if (snap->magic != snap_magic) {
+            errors++;
+        }
+
+        memcpy (&buff[0], snap->data + (count * size) % (snap_size - size),
+                size);
+    }
+}
+
+static void locked_reader (uint64_t reads, uint32_t size)
+{
+    std::vector <char> buff (size);
+
+    for (uint64_t count = 0; count < reads; count++) {
+        openarchive::rdlock_guard_t guard (&fdlock);
+
+        if (locked->magic != snap_magic) {
+            errors++;
+        }
+
+        memcpy (&buff[0], locked->data + (count * size) % (snap_size - size),
+                size);
+    }
+}
+
+/*
+ * Moves the reader on to a new snapshot every millisecond.
+ */
+static void writer (bool hazard)
+{
+    uint64_t offset = 0;
+
+    while (!stop.load ()) {
+        snapshot * snap = new snapshot (++offset);
+
+        if (hazard) {
+            openarchive::arch_core::hazard_retire (current.exchange (snap),
+                                                   true);
+        } else {
+            openarchive::wrlock_guard_t guard (&fdlock);
+            std::swap (locked, snap);
+            delete snap;
+        }
+
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    }
+}
+
+static double run (bool hazard, uint32_t threads, uint64_t reads,
+                   uint32_t size)
+{
+    std::vector <std::thread> readers;
+
+    stop.store (false);
+    std::thread wr (writer, hazard);
+
+    std::chrono::steady_clock::time_point start =
+                                            std::chrono::steady_clock::now ();
+
+    for (uint32_t count = 0; count < threads; count++) {
+        readers.push_back (std::thread (hazard? hazard_reader: locked_reader,
+                                        reads, size));
+    }
+
+    for (uint32_t count = 0; count < threads; count++) {
+        readers[count].join ();
+    }
+
+    double secs = std::chrono::duration<double> (
+                       std::chrono::steady_clock::now () - start).count ();
+
+    stop.store (true);
+    wr.join ();
+
+    return (double) reads * threads / secs;
+}
+
+int main (int argc, char **argv)
+{
+    uint64_t reads = (argc > 1? strtoull (argv[1], NULL, 0): 200000);
+    uint32_t size = (argc > 2? strtoul (argv[2], NULL, 0): 4096);
+    uint32_t threads[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+    if (!size || size >= snap_size) {
+        fprintf (stderr, "read size must be below %u\n", snap_size);
+        return 1;
+    }
+
+    current.store (new snapshot (0));
+    locked = new snapshot (0);
+
+    printf ("%8s %14s %14s %10s\n", "threads", "hazard/sec", "rdlock/sec",
+            "speedup");
+
+    for (uint32_t idx = 0; idx < sizeof (threads) / sizeof (threads[0]);
+         idx++) {
+
+        double hazard = run (true, threads[idx], reads, size);
+        double shared = run (false, threads[idx], reads, size);
+
+        printf ("%8u %14.0f %14.0f %10.2f\n", threads[idx], hazard, shared,
+                hazard / shared);
+    }
+
+    openarchive::arch_core::hazard_retire (current.exchange (NULL));
+    openarchive::arch_core::get_hazard_domain ().reclaim ();
+    delete locked;
+
+    if (errors.load ()) {
+        fprintf (stderr, "%lu reads of a freed snapshot\n", errors.load ());
+        return 1;
+    }
+
+    return 0;
+}
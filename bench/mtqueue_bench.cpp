@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+/*
+ * Contention benchmark of mtqueue. Every thread pops an element and
+ * pushes it back, the way the pools use the queue. The queue holds more
+ * elements than the ring so that the overflow path is exercised too.
+ * At the end every element must still be in the queue exactly once.
+ *
+ * usage: mtqueue_bench [ops per thread] [elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <arch_core.h>
+
+typedef openarchive::arch_core::mtqueue<uint64_t> queue_t;
+
+static void worker (queue_t *queue, uint64_t ops)
+{
+    uint64_t val;
+
+    for (uint64_t count = 0; count < ops; count++) {
+        if (queue->pop (val)) {
+            queue->push (val);
+        }
+    }
+}
+
+int main (int argc, char **argv)
+{
+    uint64_t ops = (argc > 1? strtoull (argv[1], NULL, 0): 1000000);
+    uint64_t elems = (argc > 2? strtoull (argv[2], NULL, 0): 2048);
+    uint32_t threads[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+    printf ("%8s %14s %10s\n", "threads", "ops/sec", "ns/op");
+
+    for (uint32_t idx = 0; idx < sizeof (threads) / sizeof (threads[0]);
+         idx++) {
+
+        queue_t queue;
+        for (uint64_t val = 0; val < elems; val++) {
+            queue.push (val);
+        }
+
+        std::vector <std::thread> workers;
+        std::chrono::steady_clock::time_point start = 
+                                            std::chrono::steady_clock::now ();
+
+        for (uint32_t count = 0; count < threads[idx]; count++) {
+            workers.push_back (std::thread (worker, &queue, ops));
+        }
+
+        for (uint32_t count = 0; count < threads[idx]; count++) {
+            workers[count].join ();
+        }
+
+        double secs = std::chrono::duration<double> (
+                           std::chrono::steady_clock::now () - start).count ();
+        double total = (double) ops * threads[idx];
+
+        /*
+         * Check that no element was lost or duplicated.
+         */
+        std::vector <bool> seen (elems, false);
+        uint64_t val, found = 0;
+        while (queue.pop (val)) {
+            if (val >= elems || seen[val]) {
+                fprintf (stderr, "element %lu duplicated or invalid\n", val);
+                return 1;
+            }
+            seen[val] = true;
+            found++;
+        }
+
+        if (found != elems) {
+            fprintf (stderr, "%lu of %lu elements lost\n", elems - found,
+                     elems);
+            return 1;
+        }
+
+        printf ("%8u %14.0f %10.1f\n", threads[idx], total / secs,
+                secs * 1e9 / total);
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __ARCH_COPY_H__
+#define __ARCH_COPY_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+namespace openarchive
+{
+    namespace arch_copy
+    {
+        /*
+         * File data moved through the data path is rarely looked at again
+         * by this process. Large copies of such data are done with non
+         * temporal stores so that they do not evict the rest of the
+         * working set from the caches. The copy kernel is picked by init,
+         * based on the features reported by cpuid, and can be forced
+         * through the copy_kernel parameter of the config file. Copies
+         * are done with memcpy until then.
+         */
+
+        /*
+         * Copies shorter than this are done with memcpy. bench/
+         * bulk_copy_bench only copies buffers which are not in the
+         * caches, and there the streaming kernels were 15-25% ahead of
+         * memcpy at every size from 4KB to 16MB, so the bench does not
+         * set this floor. It is kept well above a page because a short
+         * copy is more likely to be read back soon, and non temporal
+         * stores leave the reader to miss on every line. For the same
+         * reason the fd-cache copies of its blocks out to the caller use
+         * memcpy; bulk_copy is for data being written out.
+         */
+        const size_t bulk_copy_min = 64 * 1024;
+
+        typedef void (*copy_kernel_t) (void *, const void *, size_t);
+
+        /*
+         * Pick the kernel once the config file has been parsed: auto, or
+         * the name of the widest kernel to use.
+         */
+        void init (const std::string &);
+
+        copy_kernel_t get_copy_kernel (void);
+
+        /*
+         * Kernel of the given name, NULL if the CPU does not support it.
+         */
+        copy_kernel_t find_copy_kernel (const std::string &);
+
+        /*
+         * Name of the kernel in use: avx512, avx2, sse2 or memcpy.
+         */
+        const char *  get_copy_kernel_name (void);
+
+        inline void bulk_copy (void *dst, const void *src, size_t len)
+        {
+            if (len < bulk_copy_min) {
+                memcpy (dst, src, len);
+                return;
+            }
+
+            get_copy_kernel () (dst, src, len);
+        }
+
+    } /* namespace arch_copy */
+} /* namespace openarchive */
+
+#endif /* End of __ARCH_COPY_H__ */
@@ -22,9 +22,14 @@
 #include <queue>
 #include <iterator>
 #include <map>
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include <functional>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <boost/shared_ptr.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/algorithm/string/trim_all.hpp>
@@ -173,14 +178,132 @@ namespace openarchive
 
         };
 
+        /*
+         * Contention statistics shared by a family of locks, such as the
+         * locks of all the arch_file objects. Profiling is off unless a 
+         * sample rate has been set with set_lock_profiling. Contended 
+         * acquisitions are always counted, while acquisitions, the time 
+         * spent waiting for the lock and the time the lock is held are 
+         * only measured for one in every rate acquisitions of a thread,
+         * so that the counters stay cheap to maintain.
+         */
+        class lock_stats
+        {
+            const char * name;
+            lock_stats * next;
+
+            public:
+            std::atomic<uint64_t> acquired;  /* Sampled acquisitions       */
+            std::atomic<uint64_t> contended; /* Acquisitions which waited  */
+            std::atomic<uint64_t> wait_ns;   /* Sampled waiting time       */
+            std::atomic<uint64_t> hold_ns;   /* Sampled holding time       */
+
+            lock_stats (const char *);
+
+            const char * get_name (void) { return name; }
+            lock_stats * get_next (void) { return next; }
+        };
+
+        /*
+         * All the lock_stats objects ever created, most recent first.
+         */
+        inline std::atomic<lock_stats *> & get_lock_stats_list (void)
+        {
+            static std::atomic<lock_stats *> head (NULL);
+            return head;
+        }
+
+        inline lock_stats::lock_stats (const char *n): name (n), next (NULL)
+        {
+            acquired.store (0);
+            contended.store (0);
+            wait_ns.store (0);
+            hold_ns.store (0);
+
+            std::atomic<lock_stats *> & head = get_lock_stats_list ();
+            next = head.load ();
+            while (!head.compare_exchange_weak (next, this)) {
+            }
+        }
+
+        inline std::atomic<uint32_t> & get_lock_sample_rate (void)
+        {
+            static std::atomic<uint32_t> rate (0);
+            return rate;
+        }
+
+        /*
+         * Enable profiling of the named locks, one in every rate 
+         * acquisitions is measured. The rate is rounded up to a power 
+         * of 2, 0 disables the profiling.
+         */
+        inline void set_lock_profiling (uint32_t rate)
+        {
+            uint32_t val = (rate? 1: 0);
+
+            while (val && val < rate) {
+                val <<= 1;
+            }
+
+            get_lock_sample_rate ().store (val);
+        }
+
+        inline bool lock_sample (uint32_t rate)
+        {
+            static thread_local uint32_t tick = 0;
+            return !(++tick & (rate - 1));
+        }
+
+        inline uint64_t lock_clock_ns (void)
+        {
+            std::chrono::steady_clock::duration now = 
+                          std::chrono::steady_clock::now ().time_since_epoch ();
+
+            return std::chrono::duration_cast<std::chrono::nanoseconds> (
+                                                             now).count ();
+        }
+
         class spinlock
         {
             pthread_spinlock_t splock;
             bool ready;
             int last_errno;
+            lock_stats * stats;
+            uint64_t held_since;      /* Start of a sampled hold, or 0 */
+
+            std::error_code profiled_lock (uint32_t rate)
+            {
+                bool sample = lock_sample (rate);
+                int ret = pthread_spin_trylock (&splock);
+
+                if (ret == EBUSY) {
+                    uint64_t start = (sample? lock_clock_ns (): 0);
+
+                    stats->contended.fetch_add (1, std::memory_order_relaxed);
+                    ret = pthread_spin_lock (&splock);
+
+                    if (sample) {
+                        stats->wait_ns.fetch_add (lock_clock_ns () - start,
+                                                  std::memory_order_relaxed);
+                    }
+                }
+
+                if (ret) {
+                    last_errno = ret;
+                    return std::error_code (ret, std::generic_category ());
+                }
+
+                held_since = 0;
+                if (sample) {
+                    stats->acquired.fetch_add (1, std::memory_order_relaxed);
+                    held_since = lock_clock_ns ();
+                }
+
+                return (openarchive::success);
+            }
 
             public:
-            spinlock (void): ready (false)
+            spinlock (void): ready (false), stats (NULL), held_since (0)
             {
                 int ret = pthread_spin_init (&splock, PTHREAD_PROCESS_PRIVATE);
                 if (ret) {
@@ -204,6 +327,14 @@ namespace openarchive
                     return ec;
                 }
 
+                if (stats) {
+                    uint32_t rate = get_lock_sample_rate ().load (
+                                                   std::memory_order_relaxed);
+                    if (rate) {
+                        return profiled_lock (rate);
+                    }
+                }
+
                 if (pthread_spin_lock (&splock)) {
                     last_errno = errno;
                     std::error_code ec (errno, std::generic_category ());
@@ -221,6 +352,14 @@ namespace openarchive
                     return ec;
                 }
 
+                if (held_since) {
+                    uint64_t start = held_since;
+
+                    held_since = 0;
+                    stats->hold_ns.fetch_add (lock_clock_ns () - start,
+                                              std::memory_order_relaxed);
+                }
+
                 if (pthread_spin_unlock (&splock)) {
                     last_errno = errno;
                     std::error_code ec (errno, std::generic_category ());
@@ -230,6 +369,12 @@ namespace openarchive
                 return (openarchive::success);
             }
 
+            /*
+             * Account the lock in the given statistics when profiling is
+             * enabled. Must be called before the lock is used.
+             */
+            void set_stats (lock_stats *st) { stats = st; }
+
             std::error_code get_errcode (void) 
             {  
                 std::error_code ec (errno, std::generic_category ());
@@ -257,36 +402,172 @@ namespace openarchive
             } 
         };
 
+        const size_t cache_line_size = 64;
+        const size_t mtqueue_ring_size = 1024; /* must be a power of 2 */
+
+        /*
+         * mtqueue is a multi producer multi consumer queue. The fast path
+         * is a bounded lock free ring (Dmitry Vyukov's algorithm) where each
+         * cell carries a sequence number which tells producers and consumers
+         * whether the cell is free to be written or ready to be read. When
+         * the ring is full the elements spill over to a spinlock protected
+         * std::queue, so push never fails. Elements are handed out in FIFO
+         * order as long as the ring has not overflowed.
+         */
         template <class T> class mtqueue
         {
-            std::queue<T> que;
+            struct cell
+            {
+                std::atomic<size_t> seq;
+                T data;
+            };
+
+            cell *ring;
+            size_t mask;
+            char pad0[cache_line_size];
+            std::atomic<size_t> enq_pos;
+            char pad1[cache_line_size - sizeof (std::atomic<size_t>)];
+            std::atomic<size_t> deq_pos;
+            char pad2[cache_line_size - sizeof (std::atomic<size_t>)];
+
+            /*
+             * Overflow queue used once the ring is full. ovf_count lets
+             * the consumers skip the lock when there is nothing in it.
+             */
+            std::queue<T> ovf;
+            std::atomic<size_t> ovf_count;
             spinlock lock;
 
+            bool ring_push (T &t)
+            {
+                cell *c;
+                size_t pos = enq_pos.load (std::memory_order_relaxed);
+
+                for (;;) {
+                    c = &ring[pos & mask];
+                    size_t seq = c->seq.load (std::memory_order_acquire);
+                    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+                    if (diff == 0) {
+                        if (enq_pos.compare_exchange_weak (pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        /*
+                         * Ring is full
+                         */
+                        return false;
+                    } else {
+                        pos = enq_pos.load (std::memory_order_relaxed);
+                    }
+                }
+
+                c->data = t;
+                c->seq.store (pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool ring_pop (T &t)
+            {
+                cell *c;
+                size_t pos = deq_pos.load (std::memory_order_relaxed);
+
+                for (;;) {
+                    c = &ring[pos & mask];
+                    size_t seq = c->seq.load (std::memory_order_acquire);
+                    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+                    if (diff == 0) {
+                        if (deq_pos.compare_exchange_weak (pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        /*
+                         * Ring is empty
+                         */
+                        return false;
+                    } else {
+                        pos = deq_pos.load (std::memory_order_relaxed);
+                    }
+                }
+
+                t = c->data;
+                c->seq.store (pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+
             public:
+            mtqueue (void): mask (mtqueue_ring_size - 1)
+            {
+                ring = new cell[mtqueue_ring_size];
+                for (size_t count = 0; count < mtqueue_ring_size; count++) {
+                    ring[count].seq.store (count, std::memory_order_relaxed);
+                }
+
+                enq_pos.store (0, std::memory_order_relaxed);
+                deq_pos.store (0, std::memory_order_relaxed);
+                ovf_count.store (0, std::memory_order_relaxed);
+            }
+
+            ~mtqueue (void)
+            {
+                delete [] ring;
+            }
+
+            /*
+             * The ring is owned by the queue, it cannot be copied.
+             */
+            mtqueue (const mtqueue &) = delete;
+            mtqueue & operator= (const mtqueue &) = delete;
+
             bool push(T &t)
             {
+                if (ring_push (t)) {
+                    return true;
+                }
+
                 spinlock_handle handle (lock);
-                que.push (t);   
+                ovf.push (t);
+                ovf_count.fetch_add (1, std::memory_order_release);
                 return true;
             }
 
             bool pop (T &t)
             {
+                if (ring_pop (t)) {
+                    return true;
+                }
+
+                if (!ovf_count.load (std::memory_order_acquire)) {
+                    return false;
+                }
+
                 spinlock_handle handle (lock);
-                if (que.empty ()) {
+                if (ovf.empty ()) {
                     return false;
                 }
 
-                t = que.front ();
-                que.pop ();
-                return true;    
-            } 
+                t = ovf.front ();
+                ovf.pop ();
+                ovf_count.fetch_sub (1, std::memory_order_release);
+                return true;
+            }
+
+            /*
+             * Profile the lock of the overflow queue.
+             */
+            void set_stats (lock_stats *st) { lock.set_stats (st); }
 
             bool empty (void)
             {
-                spinlock_handle handle (lock);
-                return (que.empty ()); 
-            } 
+                size_t deq = deq_pos.load (std::memory_order_acquire);
+                size_t enq = enq_pos.load (std::memory_order_acquire);
+
+                return ((enq == deq) &&
+                        !ovf_count.load (std::memory_order_acquire));
+            }
 
         };
 
@@ -387,6 +668,234 @@ namespace openarchive
 
         };
 
+        /*
+         * mthashmap offers the interface of mtmap for maps shared by many
+         * threads. The keys are spread over a fixed number of shards, each
+         * with its own spinlock and its own open addressing table (linear
+         * probing, deletion by shifting back the following entries), so
+         * threads working on different keys rarely wait for each other.
+         * The shards are padded apart to keep their locks on different
+         * cache lines. The hash of the key is kept in the slot, the top 
+         * bits of it pick the shard and the low bits the slot.
+         */
+        template <class X, class Y, class H = std::hash<X>> class mthashmap
+        {
+            static const uint32_t shard_bits = 6;
+            static const uint32_t num_shards = (1 << shard_bits);
+            static const size_t   init_slots = 16; /* must be a power of 2 */
+
+            struct slot
+            {
+                bool used;
+                uint64_t hash;
+                X key;
+                Y val;
+
+                slot (void): used (false), hash (0), key (), val ()
+                {
+                }
+            };
+
+            struct shard
+            {
+                spinlock lock;
+                std::vector<slot> table;
+                size_t count;
+                char pad[cache_line_size];
+
+                shard (void): table (init_slots), count (0)
+                {
+                }
+            };
+
+            shard shards[num_shards];
+            H hasher;
+
+            uint64_t get_hash (const X &name)
+            {
+                /*
+                 * std::hash of an integer is the integer itself, mix the
+                 * bits so that sequence numbers spread over the shards.
+                 */
+                uint64_t h = (uint64_t) hasher (name);
+
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ULL;
+                h ^= h >> 33;
+
+                return h;
+            }
+
+            shard & get_shard (uint64_t h)
+            {
+                return shards[h >> (64 - shard_bits)];
+            }
+
+            /*
+             * Index of the slot holding the key, or of the free slot where
+             * the key would be added. The table is never more than three 
+             * quarters full, so the probe always ends.
+             */
+            static size_t probe (shard &sh, const X &name, uint64_t h)
+            {
+                size_t mask = sh.table.size () - 1;
+                size_t idx = h & mask;
+
+                while (sh.table[idx].used) {
+                    if (sh.table[idx].hash == h && sh.table[idx].key == name) {
+                        break;
+                    }
+                    idx = (idx + 1) & mask;
+                }
+
+                return idx;
+            }
+
+            static void grow (shard &sh)
+            {
+                std::vector<slot> old (sh.table.size () * 2);
+                old.swap (sh.table);
+
+                for (size_t count = 0; count < old.size (); count++) {
+                    if (old[count].used) {
+                        size_t idx = probe (sh, old[count].key, 
+                                            old[count].hash);
+                        sh.table[idx] = old[count];
+                    }
+                }
+            }
+
+            static void remove (shard &sh, size_t idx)
+            {
+                size_t mask = sh.table.size () - 1;
+                size_t next = idx;
+
+                for (;;) {
+                    next = (next + 1) & mask;
+                    if (!sh.table[next].used) {
+                        break;
+                    }
+
+                    /*
+                     * Entries whose home slot lies cyclically in 
+                     * (idx, next] are still reachable, leave them alone.
+                     */
+                    size_t home = sh.table[next].hash & mask;
+                    if ((idx <= next)? (idx < home && home <= next) : 
+                                       (idx < home || home <= next)) {
+                        continue;
+                    }
+
+                    sh.table[idx] = sh.table[next];
+                    idx = next;
+                }
+
+                sh.table[idx] = slot ();
+                sh.count--;
+            }
+
+            public:
+            bool insert (X name, Y val)
+            {
+                uint64_t h = get_hash (name);
+                shard &sh = get_shard (h);
+                spinlock_handle handle (sh.lock);
+
+                if ((sh.count + 1) * 4 > sh.table.size () * 3) {
+                    grow (sh);
+                }
+
+                size_t idx = probe (sh, name, h);
+                if (sh.table[idx].used) {
+                    return false;
+                }
+
+                sh.table[idx].used = true;
+                sh.table[idx].hash = h;
+                sh.table[idx].key = name;
+                sh.table[idx].val = val;
+                sh.count++;
+
+                return true;
+            }
+
+            bool extract (X name, Y &val)
+            {
+                uint64_t h = get_hash (name);
+                shard &sh = get_shard (h);
+                spinlock_handle handle (sh.lock);
+
+                size_t idx = probe (sh, name, h);
+                if (sh.table[idx].used) {
+                    val = sh.table[idx].val;
+                    return true;
+                }
+
+                return false;
+            }
+
+            void erase (X name)
+            {
+                uint64_t h = get_hash (name);
+                shard &sh = get_shard (h);
+                spinlock_handle handle (sh.lock);
+
+                size_t idx = probe (sh, name, h);
+                if (sh.table[idx].used) {
+                    remove (sh, idx);
+                }
+
+                return;
+            }
+
+            bool atomic_increment (X name, Y val)
+            {
+                uint64_t h = get_hash (name);
+                shard &sh = get_shard (h);
+                spinlock_handle handle (sh.lock);
+
+                size_t idx = probe (sh, name, h);
+                if (sh.table[idx].used) {
+                    sh.table[idx].val += val;
+                    return true;
+                }
+
+                return false;
+            }
+
+            bool atomic_decrement (X name, Y val)
+            {
+                uint64_t h = get_hash (name);
+                shard &sh = get_shard (h);
+                spinlock_handle handle (sh.lock);
+
+                size_t idx = probe (sh, name, h);
+                if (sh.table[idx].used) {
+                    sh.table[idx].val -= val;
+                    return true;
+                }
+
+                return false;
+            }
+
+            /*
+             * A shard may be resized by another thread at any time, so 
+             * unlike mtmap the plain variants take the shard lock too.
+             */
+            bool increment (X name, Y val)
+            {
+                return atomic_increment (name, val);
+            }
+
+            bool decrement (X name, Y val)
+            {
+                return atomic_decrement (name, val);
+            }
+
+        };
+
         class popen
         {
             std::string cmd;
@@ -500,8 +1009,391 @@ namespace openarchive
 
                 return sem_wait (&sem);
             }
+
+            /*
+             * Wait at most until the given point in time. Returns -1 with 
+             * errno set to ETIMEDOUT if the semaphore was not posted.
+             */
+            int32_t timed_wait (std::chrono::steady_clock::time_point until)
+            {
+                if (!valid) {
+                    return -1; 
+                } 
+
+                std::chrono::steady_clock::duration left = 
+                                     until - std::chrono::steady_clock::now ();
+                if (left < std::chrono::steady_clock::duration::zero ()) {
+                    left = std::chrono::steady_clock::duration::zero ();
+                }
+
+                /*
+                 * sem_timedwait takes an absolute CLOCK_REALTIME time.
+                 */
+                struct timespec ts;
+                clock_gettime (CLOCK_REALTIME, &ts);
+
+                uint64_t nsec = ts.tv_nsec + 
+                                std::chrono::duration_cast<
+                                    std::chrono::nanoseconds> (left).count ();
+                ts.tv_sec += nsec / 1000000000;
+                ts.tv_nsec = nsec % 1000000000;
+
+                int32_t ret;
+                while ((ret = sem_timedwait (&sem, &ts)) && errno == EINTR) {
+                }
+
+                return ret;
+            }
+
+            int32_t try_wait (void)
+            {
+                if (!valid) {
+                    return -1; 
+                } 
+
+                return sem_trywait (&sem);
+            }
+        };
+
+        /*
+         * Flag shared between a job and the requests it has in flight, 
+         * set when the job is cancelled.
+         */
+        typedef boost::shared_ptr<std::atomic<bool>> cancel_flag_t;
+
+        /*
+         * Cancel flag of the job whose work item the calling thread is 
+         * running, requests allocated by the thread inherit it.
+         */
+        inline cancel_flag_t & current_cancel_flag (void)
+        {
+            static thread_local cancel_flag_t flag;
+            return flag;
+        }
+
+        /*
+         * quiesce counts the work in flight in a component, a drain waits
+         * until the count drops to zero. The thread finishing the last 
+         * piece of work wakes up the drain, so a drain takes as long as 
+         * the outstanding work and no longer. Once a drain has started 
+         * enter reports that the component is going away, callers should
+         * not start new work then.
+         */
+        class quiesce
+        {
+            std::atomic<uint64_t> count;
+            std::atomic<bool> draining;
+            std::mutex mtx;
+            std::condition_variable cv;
+
+            public:
+            quiesce (void)
+            {
+                count.store (0);
+                draining.store (false);
+            }
+
+            bool enter (void)
+            {
+                count.fetch_add (1);
+                return !draining.load ();
+            }
+
+            void exit (void)
+            {
+                if (count.fetch_sub (1) == 1 && draining.load ()) {
+                    std::lock_guard<std::mutex> guard (mtx);
+                    cv.notify_all ();
+                }
+            }
+
+            /*
+             * Wait for the work in flight to finish, at most for the 
+             * given time. Returns false if work was still in flight when
+             * the time ran out.
+             */
+            bool drain (std::chrono::milliseconds timeout)
+            {
+                draining.store (true);
+
+                std::unique_lock<std::mutex> guard (mtx);
+                return cv.wait_for (guard, timeout, 
+                                    [this] { return !count.load (); });
+            }
+
+            /*
+             * Accept work again after a drain.
+             */
+            void resume (void)
+            {
+                draining.store (false);
+            }
+
+            uint64_t get_count (void) { return count.load (); }
+        };
+
+        /*
+         * Hazard pointers let readers use an object published through an
+         * atomic pointer without taking a lock. A reader announces the
+         * object it is about to use in a hazard slot of its own thread. A
+         * writer which unpublishes an object retires it instead of
+         * deleting it, and retired objects are deleted once no hazard
+         * slot points to them. A thread can protect hazards_per_thread
+         * objects at a time. The record holding the slots of a thread is
+         * freed when the thread exits.
+         */
+        const uint32_t hazards_per_thread = 4;
+
+        struct hazard_rec
+        {
+            std::atomic<void *> ptr[hazards_per_thread];
+            uint32_t depth;               /* Slots in use by the owner   */
+            hazard_rec * next;
+            char pad[cache_line_size];    /* Records do not share lines  */
         };
 
+        class hazard_domain
+        {
+            typedef void (*deleter_t) (void *);
+            typedef std::vector <std::pair <void *, deleter_t>> retired_t;
+
+            spinlock lock;                /* Protects the records and the */
+            hazard_rec * head;            /* retired objects              */
+            uint32_t records;
+            retired_t retired;
+
+            /*
+             * Retire as many objects as there are hazard slots, times
+             * two, before looking for the ones which can be deleted. At
+             * least half of them can be deleted by then, so the cost of
+             * the scan is amortized while the number of objects waiting
+             * stays bound by the number of threads.
+             */
+            static const size_t scan_min = 16;
+
+            size_t scan_threshold (void)
+            {
+                size_t threshold = (size_t) 2 * hazards_per_thread * records;
+
+                return ((threshold > scan_min)? threshold: scan_min);
+            }
+
+            /*
+             * Move the retired objects no hazard slot points to into
+             * the given list. Called with the lock held.
+             */
+            void scan (retired_t & freed)
+            {
+                std::vector <void *> hazards;
+
+                for (hazard_rec * rec = head; rec; rec = rec->next) {
+                    for (uint32_t idx = 0; idx < hazards_per_thread; idx++) {
+                        void * ptr = rec->ptr[idx].load ();
+                        if (ptr) {
+                            hazards.push_back (ptr);
+                        }
+                    }
+                }
+
+                std::sort (hazards.begin (), hazards.end ());
+
+                retired_t keep;
+                retired_t::iterator iter;
+                for (iter = retired.begin (); iter != retired.end (); iter++) {
+                    if (std::binary_search (hazards.begin (), hazards.end (),
+                                            iter->first)) {
+                        keep.push_back (*iter);
+                    } else {
+                        freed.push_back (*iter);
+                    }
+                }
+
+                retired.swap (keep);
+            }
+
+            static void free_all (retired_t & freed)
+            {
+                retired_t::iterator iter;
+                for (iter = freed.begin (); iter != freed.end (); iter++) {
+                    iter->second (iter->first);
+                }
+            }
+
+            public:
+            hazard_domain (void): head (NULL), records (0)
+            {
+            }
+
+            /*
+             * Records are only added and removed when threads start and
+             * exit, under the lock taken by the scans.
+             */
+            hazard_rec * acquire (void)
+            {
+                hazard_rec * rec = new hazard_rec;
+                for (uint32_t idx = 0; idx < hazards_per_thread; idx++) {
+                    rec->ptr[idx].store (NULL);
+                }
+                rec->depth = 0;
+
+                spinlock_handle handle (lock);
+
+                rec->next = head;
+                head = rec;
+                records++;
+
+                return rec;
+            }
+
+            void release (hazard_rec * rec)
+            {
+                {
+                    spinlock_handle handle (lock);
+
+                    hazard_rec ** link = &head;
+                    while (*link != rec) {
+                        link = &(*link)->next;
+                    }
+
+                    *link = rec->next;
+                    records--;
+                }
+
+                delete rec;
+            }
+
+            /*
+             * Retire an object. Objects which hold on to a lot of memory
+             * can ask for a scan right away, only the ones being read are
+             * then kept.
+             */
+            void retire (void * ptr, deleter_t deleter, bool scan_now)
+            {
+                retired_t freed;
+
+                {
+                    spinlock_handle handle (lock);
+
+                    retired.push_back (std::make_pair (ptr, deleter));
+                    if (scan_now || retired.size () >= scan_threshold ()) {
+                        scan (freed);
+                    }
+                }
+
+                free_all (freed);
+            }
+
+            /*
+             * Delete all the retired objects which are not in use.
+             */
+            void reclaim (void)
+            {
+                retired_t freed;
+
+                {
+                    spinlock_handle handle (lock);
+                    scan (freed);
+                }
+
+                free_all (freed);
+            }
+        };
+
+        inline hazard_domain & get_hazard_domain (void)
+        {
+            static hazard_domain domain;
+            return domain;
+        }
+
+        /*
+         * Hazard record of the calling thread, handed back to the domain
+         * when the thread exits.
+         */
+        class hazard_thread
+        {
+            hazard_rec * rec;
+
+            public:
+            hazard_thread (void): rec (get_hazard_domain ().acquire ())
+            {
+            }
+
+            ~hazard_thread (void)
+            {
+                get_hazard_domain ().release (rec);
+            }
+
+            hazard_rec * get (void) { return rec; }
+        };
+
+        inline hazard_rec * get_hazard_rec (void)
+        {
+            static thread_local hazard_thread thr;
+            return thr.get ();
+        }
+
+        /*
+         * Protects one object for the lifetime of the guard.
+         */
+        class hazard_ptr
+        {
+            hazard_rec * rec;
+            std::atomic<void *> & slot;
+
+            /*
+             * Next free slot of the thread, checked before it is indexed.
+             */
+            static std::atomic<void *> & claim (hazard_rec * rec)
+            {
+                assert (rec->depth < hazards_per_thread);
+                return rec->ptr[rec->depth++];
+            }
+
+            public:
+            hazard_ptr (void): rec (get_hazard_rec ()), slot (claim (rec))
+            {
+            }
+
+            ~hazard_ptr (void)
+            {
+                slot.store (NULL, std::memory_order_release);
+                rec->depth--;
+            }
+
+            /*
+             * Load the pointer and announce it. The pointer is read again
+             * after the announcement, a writer which unpublished the
+             * object in between may already have scanned the slots.
+             */
+            template <class T> T * protect (const std::atomic<T *> & src)
+            {
+                T * ptr = src.load ();
+
+                while (true) {
+                    slot.store (ptr);
+
+                    T * again = src.load ();
+                    if (again == ptr) {
+                        return ptr;
+                    }
+
+                    ptr = again;
+                }
+            }
+        };
+
+        template <class T> void hazard_delete (void * ptr)
+        {
+            delete (T *) ptr;
+        }
+
+        template <class T> void hazard_retire (T * ptr, bool scan_now = false)
+        {
+            if (ptr) {
+                get_hazard_domain ().retire (ptr, hazard_delete<T>, scan_now);
+            }
+        }
+
         class sem_lock_guard
         {
             semaphore &ref;
@@ -551,12 +1443,18 @@ namespace openarchive
             bool good (void) { return outpstream.good(); }
         };
 
+        /*
+         * With profiling enabled the hold time is only measured for the
+         * writers, readers may hold the lock concurrently.
+         */
         class rwlock
         {
             pthread_rwlock_t lock;
+            lock_stats * stats;
+            uint64_t held_since;      /* Start of a sampled write hold   */
 
             public:
-            rwlock (void)
+            rwlock (void): stats (NULL), held_since (0)
             {
                 pthread_rwlock_init (&lock, NULL);
             }
@@ -566,18 +1464,86 @@ namespace openarchive
                 pthread_rwlock_destroy (&lock);
             }
 
+            void set_stats (lock_stats *st) { stats = st; }
+
             int rdlock (void)
             {
-                return pthread_rwlock_rdlock (&lock);
+                uint32_t rate = (stats? get_lock_sample_rate ().load (
+                                        std::memory_order_relaxed): 0);
+                if (!rate) {
+                    return pthread_rwlock_rdlock (&lock);
+                }
+
+                bool sample = lock_sample (rate);
+                int ret = pthread_rwlock_tryrdlock (&lock);
+
+                if (ret == EBUSY) {
+                    uint64_t start = (sample? lock_clock_ns (): 0);
+
+                    stats->contended.fetch_add (1, std::memory_order_relaxed);
+                    ret = pthread_rwlock_rdlock (&lock);
+
+                    if (sample) {
+                        stats->wait_ns.fetch_add (lock_clock_ns () - start,
+                                                  std::memory_order_relaxed);
+                    }
+                }
+
+                if (!ret && sample) {
+                    stats->acquired.fetch_add (1, std::memory_order_relaxed);
+                }
+
+                return ret;
             }
- 
+
             int wrlock (void)
             {
-                return pthread_rwlock_wrlock (&lock);
+                uint32_t rate = (stats? get_lock_sample_rate ().load (
+                                        std::memory_order_relaxed): 0);
+                if (!rate) {
+                    return pthread_rwlock_wrlock (&lock);
+                }
+
+                bool sample = lock_sample (rate);
+                int ret = pthread_rwlock_trywrlock (&lock);
+
+                if (ret == EBUSY) {
+                    uint64_t start = (sample? lock_clock_ns (): 0);
+
+                    stats->contended.fetch_add (1, std::memory_order_relaxed);
+                    ret = pthread_rwlock_wrlock (&lock);
+
+                    if (sample) {
+                        stats->wait_ns.fetch_add (lock_clock_ns () - start,
+                                                  std::memory_order_relaxed);
+                    }
+                }
+
+                if (!ret) {
+                    held_since = 0;
+                    if (sample) {
+                        stats->acquired.fetch_add (1, 
+                                                   std::memory_order_relaxed);
+                        held_since = lock_clock_ns ();
+                    }
+                }
+
+                return ret;
             }
 
             int unlock (void)
             {
+                /*
+                 * held_since is only set while a writer holds the lock.
+                 */
+                if (held_since) {
+                    uint64_t start = held_since;
+
+                    held_since = 0;
+                    stats->hold_ns.fetch_add (lock_clock_ns () - start,
+                                              std::memory_order_relaxed);
+                }
+
                 return pthread_rwlock_unlock (&lock);
             } 
         };   
@@ -13,6 +13,9 @@
 
 #include <pthread.h>
 #include <arch_iopx.h>
+#include <arch_sched.h>
+#include <arch_numa.h>
+#include <arch_mem.hpp>
 #include <logger.h>
 
 namespace openarchive
@@ -29,6 +32,10 @@ namespace openarchive
             uint32_t meta_cache_ttl;
             bool enable_fd_cache;
             uint32_t fd_cache_size;
+            uint32_t fd_cache_ra_window; /* Max buffers prefetched ahead */
+            bool fd_cache_ra_direct;     /* Random reads bypass the cache */
+            uint64_t wb_cache_size;      /* Write-back dirty limit, 0 off */
+            bool fd_cache_private;       /* Blocks not shared with others */
         };
  
         class arch_engine
@@ -43,11 +50,13 @@ namespace openarchive
             work_ptr_t fast_worker;       /* High priority worker             */
             boost::thread_group fast_threads; /* High prioty threads          */
             uint32_t nfastthreads;        /* Number of high priority threads  */
+            arch_sched_ptr_t fast_sched;  /* Job scheduler for fast ioservice */
 
             io_service_ptr_t slow_iosvc;  /* Low priority ioservice           */
             work_ptr_t slow_worker;       /* Low priority worker              */
             boost::thread_group slow_threads; /* Low prioty threads           */
             uint32_t nslowthreads;        /* Number of low priority threads   */
+            arch_sched_ptr_t slow_sched;  /* Job scheduler for slow ioservice */
 
             private:
             std::error_code alloc_engine_resources (void);
@@ -55,7 +64,8 @@ namespace openarchive
             io_service_ptr_t alloc_ioservice (std::string);
             work_ptr_t alloc_worker (io_service_ptr_t, std::string);
             uint32_t create_threads (io_service_ptr_t, boost::thread_group &,
-                                     uint32_t);
+                                     uint32_t, 
+                                     openarchive::arch_mem::arena_type);
             iopx_ptr_t mkgltree (struct iopx_tree_cfg &);
             iopx_ptr_t mkcvlttree (struct iopx_tree_cfg &);
             void map_cvlt_store_id (std::string &, std::string &);
@@ -76,6 +86,15 @@ namespace openarchive
                 return (fast? fast_iosvc:slow_iosvc);
             }
 
+            /*
+             * Data management jobs submit their work items through the
+             * scheduler so that the threads are shared fairly between them.
+             */
+            arch_sched_ptr_t get_scheduler (bool fast)
+            {
+                return (fast? fast_sched:slow_sched);
+            }
+
             uint32_t get_num_fast_threads (void) { return nfastthreads; }
             uint32_t get_num_slow_threads (void) { return nslowthreads; }
             void map_store_id (std::string &, std::string &, std::string &);
@@ -83,7 +102,8 @@ namespace openarchive
 
         };
 
-        void worker_thread(io_service_ptr_t, uint32_t);
+        void worker_thread(io_service_ptr_t, uint32_t, uint32_t,
+                           openarchive::arch_mem::arena_type);
         boost::shared_ptr<arch_engine> alloc_engine (void); 
 
     } /* namespace arch_engine */
@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <map>
+#include <atomic>
 #include <glfs.h>
 #include <glfs-handles.h>
 #include <boost/make_shared.hpp>
@@ -54,7 +55,8 @@ namespace openarchive
             FILE_ATTR_DATA = 3,
             CACHE_SLOT_NUM = 4,
             CVLT_STREAM    = 5,
-            DMSTATS_DATA   = 6       
+            DMSTATS_DATA   = 6,
+            DISK_VERSION   = 7
         };
 
         class file_info
@@ -64,7 +66,7 @@ namespace openarchive
                             arch_store_cbk_info_ptr_t,
                             file_attr_ptr_t, uint32_t,
                             cvlt_stream_t *,
-                            dmstats_ptr_t> val;
+                            dmstats_ptr_t, uint64_t> val;
             
             public:
             void set_glfd (glfs_fd_t *fd)       
@@ -103,6 +105,12 @@ namespace openarchive
                 val = ptr; 
             }
 
+            void set_disk_version (uint64_t version)
+            {
+                type = DISK_VERSION;
+                val = version;
+            }
+
             glfs_fd_t * get_glfd (void) 
             {
                 assert (type == GLFS_FD_DATA);
@@ -139,23 +147,68 @@ namespace openarchive
                 return boost::get<dmstats_ptr_t> (val);
             }
 
+            uint64_t get_disk_version (void)
+            {
+                assert (type == DISK_VERSION);
+                return boost::get<uint64_t> (val);
+            }
+
+        };
+
+        /*
+         * Maximum number of iopx layers in a tree. Each layer is given an
+         * id below this limit when the tree is built and uses it to index
+         * its context in the requests and files passing through it.
+         */
+        const uint32_t max_layers = 8;
+
+        /*
+         * Slot used by the data management code to keep the archive store
+         * callback info of a file. It follows the slots of the iopx layers.
+         */
+        const uint32_t store_slot = max_layers;
+        const uint32_t max_slots  = max_layers + 1;
+
+        /*
+         * Per layer state of a file. The slot is filled once, usually when
+         * the layer opens the file, and is not modified until it is erased
+         * when the layer closes the file. Readers only check the valid flag
+         * and do not take any lock.
+         */
+        struct file_slot
+        {
+            std::atomic<bool> valid;
+            file_info         info;
         };
 
-        class arch_file
+        /*
+         * Lock statistics shared by all the files.
+         */
+        inline openarchive::arch_core::lock_stats * get_file_lock_stats (void)
+        {
+            static openarchive::arch_core::lock_stats stats ("arch_file");
+            return &stats;
+        }
+
+        class arch_file: public openarchive::arch_mem::pool_object
         {
             arch_loc_t loc;
             volatile bool failed;
             std::atomic<bool> cbk_invoked; 
             time_t ref_time;
             openarchive::arch_core::spinlock lock;
-            std::map<std::string, file_info> nvstore;
+            struct file_slot slots[max_slots];
             boost::shared_ptr <openarchive::arch_iopx::arch_iopx> iopx;
             size_t file_size; 
 
             public:
             arch_file (void): failed (false), cbk_invoked(false)
             {
-                nvstore.clear ();
+                lock.set_stats (get_file_lock_stats ());
+
+                for (uint32_t slot = 0; slot < max_slots; slot++) {
+                    slots[slot].valid.store (false, std::memory_order_relaxed);
+                }
             }
 
             arch_file (openarchive::arch_loc::arch_loc &);  
@@ -190,9 +243,23 @@ namespace openarchive
 
             size_t get_file_size (void)                   { return file_size;  }
 
-            void set_file_info   (std::string, file_info &);
-            void erase_file_info (std::string);
-            bool get_file_info   (std::string, file_info &);
+            bool set_file_info   (uint32_t, file_info &);
+            void erase_file_info (uint32_t);
+            bool get_file_info   (uint32_t, file_info &);
+
+            /*
+             * Returns the state kept in the slot or NULL if the slot is
+             * empty. The pointer stays valid until the slot is erased.
+             */
+            file_info * get_file_info (uint32_t slot)
+            {
+                if (slot < max_slots && 
+                    slots[slot].valid.load (std::memory_order_acquire)) {
+                    return &slots[slot].info;
+                }
+
+                return NULL;
+            }
         }; 
 
     } /* Namespace arch_file */
@@ -202,7 +269,7 @@ namespace openarchive
     typedef boost::shared_ptr<file_info_t>           file_info_ptr_t;
 
     typedef openarchive::arch_file::arch_file        file_t;
-    typedef boost::shared_ptr<file_t>                file_ptr_t;
+    typedef boost::intrusive_ptr<file_t>             file_ptr_t;
 
 } /* Namespace open_archive */
 
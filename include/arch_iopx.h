@@ -24,23 +24,55 @@ namespace openarchive
 {
     namespace arch_iopx
     {
+        /*
+         * Shutdown timeouts a layer waits for its references before it
+         * cancels the requests it issued.
+         */
+        const uint32_t drain_retries = 3;
+
         class arch_iopx
         {
             std::string name; 
             io_service_ptr_t iosvc;
+            uint32_t layer_id;
             boost::shared_ptr<arch_iopx> parent;
             std::list<boost::shared_ptr<arch_iopx>> children;
-            atomic_vol_uint64_t refcount; 
+            openarchive::arch_core::quiesce refs; /* Active references */
+            openarchive::arch_core::cancel_flag_t cancelled;
 
             protected:
-            std::error_code fop_default (file_ptr_t, req_ptr_t);
+            std::error_code fop_default (const file_ptr_t &, const req_ptr_t &);
             std::error_code close_default (file_t &);
-            std::error_code dup_default (file_ptr_t, file_ptr_t);
-            std::error_code fop_cbk_default (file_ptr_t, req_ptr_t, 
+            std::error_code dup_default (const file_ptr_t &,
+                                         const file_ptr_t &);
+            std::error_code fop_cbk_default (const file_ptr_t &,
+                                             const req_ptr_t &, 
                                              std::error_code);
-            std::error_code run_fop (file_ptr_t, req_ptr_t);
-            bool schedule_fop (req_ptr_t);
-            std::error_code parent_cbk (file_ptr_t, req_ptr_t, std::error_code);
+            std::error_code run_fop (const file_ptr_t &, const req_ptr_t &);
+            bool schedule_fop (const req_ptr_t &);
+            std::error_code parent_cbk (const file_ptr_t &, const req_ptr_t &,
+                                        std::error_code);
+
+            /*
+             * Wait until the active references have been dropped. After
+             * drain_retries shutdown timeouts the requests carrying the
+             * cancel flag of the layer are cancelled and given one more
+             * timeout, then ETIMEDOUT is returned. Posted handlers use
+             * the iopx without holding it, the caller must not free the
+             * layer's resources under handlers which are still running.
+             */
+            std::error_code drain (void);
+
+            /*
+             * Cancel flag for the requests the layer issues on its own,
+             * set when a drain gives up waiting for them.
+             */
+            const openarchive::arch_core::cancel_flag_t & get_cancel_flag (void)
+            {
+                return cancelled;
+            }
+
+            io_service_ptr_t get_iosvc (void) { return iosvc; }
             boost::shared_ptr<arch_iopx> get_first_child (void)  
             { 
                 return children.front ();
@@ -55,6 +87,15 @@ namespace openarchive
             void reset_links (void);
 
             std::string get_name (void) { return name; }
+            uint32_t get_layer_id (void) { return layer_id; }
+
+            /*
+             * Number the iopx in the subtree rooted at this iopx in depth
+             * first order starting with the given id. The layer id is used
+             * to index the per layer context kept in the requests.
+             * Returns the next unused id.
+             */
+            uint32_t set_layer_ids (uint32_t);
 
             void add_child (boost::shared_ptr <arch_iopx> child) 
             {
@@ -106,53 +147,74 @@ namespace openarchive
              * File operations
              */
 
-            virtual std::error_code open              (file_ptr_t, req_ptr_t);
+            virtual std::error_code open              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code close             (file_ptr_t, req_ptr_t);
+            virtual std::error_code close             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             virtual std::error_code close             (file_t &);
 
-            virtual std::error_code pread             (file_ptr_t, req_ptr_t);
+            virtual std::error_code pread             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pwrite            (file_ptr_t, req_ptr_t);
+            virtual std::error_code pwrite            (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fstat             (file_ptr_t, req_ptr_t);
+            virtual std::error_code fstat             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code stat              (file_ptr_t, req_ptr_t);
+            virtual std::error_code stat              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code ftruncate         (file_ptr_t, req_ptr_t);
+            virtual std::error_code ftruncate         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code truncate          (file_ptr_t, req_ptr_t);
+            virtual std::error_code truncate          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fsetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fsetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code setxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code setxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fgetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fgetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code getxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fremovexattr      (file_ptr_t, req_ptr_t);
+            virtual std::error_code fremovexattr      (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code removexattr       (file_ptr_t, req_ptr_t);
+            virtual std::error_code removexattr       (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code lseek             (file_ptr_t, req_ptr_t);
+            virtual std::error_code lseek             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getuuid           (file_ptr_t, req_ptr_t);
+            virtual std::error_code getuuid           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code gethosts          (file_ptr_t, req_ptr_t);
+            virtual std::error_code gethosts          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             /*
              * File system operations
              */
 
-            virtual std::error_code mkdir             (file_ptr_t, req_ptr_t);
+            virtual std::error_code mkdir             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code resolve           (file_ptr_t, req_ptr_t);
+            virtual std::error_code resolve           (const file_ptr_t &,
+                                                       const req_ptr_t &);
             
-            virtual std::error_code dup               (file_ptr_t, file_ptr_t);
+            virtual std::error_code dup               (const file_ptr_t &,
+                                                       const file_ptr_t &);
 
-            virtual std::error_code scan              (file_ptr_t, req_ptr_t);
+            virtual std::error_code scan              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             /*
              * Profiling operations
@@ -164,67 +226,87 @@ namespace openarchive
              * File operation callbacks
              */
 
-            virtual std::error_code open_cbk          (file_ptr_t, req_ptr_t,
+            virtual std::error_code open_cbk          (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code close_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code close_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code pread_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code pread_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code pwrite_cbk        (file_ptr_t, req_ptr_t,
+            virtual std::error_code pwrite_cbk        (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code fstat_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code fstat_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code stat_cbk          (file_ptr_t, req_ptr_t,
+            virtual std::error_code stat_cbk          (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code ftruncate_cbk     (file_ptr_t, req_ptr_t,
+            virtual std::error_code ftruncate_cbk     (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code truncate_cbk      (file_ptr_t, req_ptr_t,
+            virtual std::error_code truncate_cbk      (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code); 
 
-            virtual std::error_code fsetxattr_cbk     (file_ptr_t, req_ptr_t,
+            virtual std::error_code fsetxattr_cbk     (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code setxattr_cbk      (file_ptr_t, req_ptr_t,
+            virtual std::error_code setxattr_cbk      (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code fgetxattr_cbk     (file_ptr_t, req_ptr_t,
+            virtual std::error_code fgetxattr_cbk     (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code getxattr_cbk      (file_ptr_t, req_ptr_t,
+            virtual std::error_code getxattr_cbk      (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code fremovexattr_cbk  (file_ptr_t, req_ptr_t,
+            virtual std::error_code fremovexattr_cbk  (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code removexattr_cbk   (file_ptr_t, req_ptr_t,
+            virtual std::error_code removexattr_cbk   (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code lseek_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code lseek_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code getuuid_cbk       (file_ptr_t, req_ptr_t,
+            virtual std::error_code getuuid_cbk       (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code gethosts_cbk      (file_ptr_t, req_ptr_t,
+            virtual std::error_code gethosts_cbk      (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
             /*
              * File system operation callbacks
              */
 
-            virtual std::error_code mkdir_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code mkdir_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
-            virtual std::error_code resolve_cbk       (file_ptr_t, req_ptr_t,
+            virtual std::error_code resolve_cbk       (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code); 
 
-            virtual std::error_code scan_cbk          (file_ptr_t, req_ptr_t,
+            virtual std::error_code scan_cbk          (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
 
         }; 
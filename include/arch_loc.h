@@ -11,6 +11,7 @@
 #ifndef __ARCH_LOC_H__
 #define __ARCH_LOC_H__
 
+#include <cstring>
 #include <uuid/uuid.h>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -22,33 +23,49 @@ namespace openarchive
 {
     namespace arch_loc
     {
+        /*
+         * Files are identified by their 16 byte uuid (gfid). The binary form
+         * is used as the key in the caches and maps, the string form is only
+         * generated for logging and at the API boundaries.
+         */
+        typedef boost::uuids::uuid uuid_key_t;
+
+        struct uuid_hash
+        {
+            size_t operator() (const uuid_key_t &key) const
+            {
+                uint64_t hi, lo;
+
+                memcpy (&hi, key.data, sizeof (hi));
+                memcpy (&lo, key.data + sizeof (hi), sizeof (lo));
+
+                /*
+                 * The uuids are mostly random, folding the two halves
+                 * together with a multiplicative mix is good enough.
+                 */
+                return (size_t) ((hi ^ (lo * 0x9E3779B97F4A7C15ULL)) *
+                                 0xBF58476D1CE4E5B9ULL);
+            }
+        };
+
         class arch_loc
         {
             std::string product_id;
             std::string store_id;
             boost::filesystem::path path;
-            boost::uuids::uuid uuid;
-            std::string uuid_str;
-
-            private:
-            std::string uuid_to_str (void)
-            {
-                return (boost::uuids::to_string(uuid));
-            }
+            uuid_key_t uuid;
 
             public:
             arch_loc(void): product_id(""),store_id(""),path("")
             {
                 boost::uuids::nil_generator nil_gen;
                 uuid = nil_gen();
-                uuid_str = uuid_to_str ();
             }
 
             arch_loc(std::string &prod, std::string &stor,std::string &pth, 
                      uuid_t &uid): product_id(prod),store_id(stor), path(pth)
             {
                 memcpy (&uuid, uid, uuid.size());
-                uuid_str = uuid_to_str ();
             }
 
             arch_loc(std::string &prod, std::string &stor,std::string &pth):
@@ -56,14 +73,12 @@ namespace openarchive
             {
                 boost::uuids::nil_generator nil_gen;
                 uuid = nil_gen();
-                uuid_str = uuid_to_str ();
             }
 
             arch_loc(std::string &pth, uuid_t &uid): product_id(""),store_id(""),
                                                    path(pth)
             {
                 memcpy (&uuid, uid, uuid.size());
-                uuid_str = uuid_to_str ();
             }
 
             void set_product (std::string &pr)
@@ -89,7 +104,6 @@ namespace openarchive
             void set_uuid (uuid_t uid)
             {
                 memcpy (&uuid, uid, uuid.size());
-                uuid_str = uuid_to_str ();
             }
 
             std::string& get_product (void)
@@ -117,9 +131,14 @@ namespace openarchive
                 return (uuid_t *) uuid.data;
             }
 
-            std::string& get_uuidstr (void)
+            const uuid_key_t & get_uuidkey (void)
             {
-                return uuid_str;
+                return uuid;
+            }
+
+            std::string get_uuidstr (void)
+            {
+                return (boost::uuids::to_string(uuid));
             } 
              
         };
@@ -127,6 +146,8 @@ namespace openarchive
 
     typedef openarchive::arch_loc::arch_loc arch_loc_t;
     typedef boost::shared_ptr <arch_loc_t>  arch_loc_ptr_t;
+    typedef openarchive::arch_loc::uuid_key_t uuid_key_t;
+    typedef openarchive::arch_loc::uuid_hash  uuid_hash_t;
 }
 
 #endif /* End of __ARCH_LOC_H__ */
@@ -12,18 +12,85 @@
 #define __ARCH_MEM_H__
 
 #include <dlfcn.h>
+#include <sys/mman.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
 #include <jemalloc/jemalloc.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/pool/object_pool.hpp>
 #include <logger.h>
 #include <arch_core.h>
+#include <arch_numa.h>
 #include <cfgparams.h>
 
 namespace openarchive
 {
     namespace arch_mem
     {
+        /*
+         * Base class for objects which are handed out through intrusive
+         * handles (boost::intrusive_ptr). The reference count lives in the
+         * object and the object remembers the pool it has to be returned
+         * to, so a handle is a single pointer and no separate control block
+         * is allocated. Objects which were not allocated from a pool (e.g.
+         * on the stack) are never reclaimed through a handle.
+         */
+        class pool_object
+        {
+            typedef void (*recycle_t) (void *, pool_object *);
+
+            std::atomic<uint32_t> refs;
+            recycle_t recycle;
+            void * owner;
+
+            public:
+            pool_object (void): refs (0), recycle (NULL), owner (NULL)
+            {
+            }
+
+            /*
+             * Copying an object neither copies its references nor its
+             * ownership.
+             */
+            pool_object (const pool_object &): refs (0), recycle (NULL),
+                                               owner (NULL)
+            {
+            }
+
+            pool_object & operator= (const pool_object &)
+            {
+                return *this;
+            }
+
+            void set_owner (void * pool, recycle_t fn)
+            {
+                owner = pool;
+                recycle = fn;
+            }
+
+            friend void intrusive_ptr_add_ref (pool_object *obj)
+            {
+                obj->refs.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            friend void intrusive_ptr_release (pool_object *obj)
+            {
+                if (obj->refs.fetch_sub (1, std::memory_order_acq_rel) == 1) {
+                    if (obj->recycle) {
+                        obj->recycle (obj->owner, obj);
+                    }
+                }
+            }
+        };
+
         /*
          * mempool is assumed to allocated once per thread in the thread 
          * local storage. Hence we do not use any kind of synchronization
@@ -55,6 +122,27 @@ namespace openarchive
                 objpool.destroy (ptr);
             }
 
+            /*
+             * Allocate an object handed out through an intrusive handle.
+             * T has to derive from pool_object.
+             */
+            boost::intrusive_ptr<T> make_intrusive (void)
+            {
+                T * obj = objpool.construct ();
+
+                if (obj) {
+                    alloced++;
+                    obj->set_owner (this, &mempool<T>::recycle);
+                }
+
+                return boost::intrusive_ptr<T> (obj);
+            }
+
+            static void recycle (void *pool, pool_object *obj)
+            {
+                ((mempool<T> *) pool)->destroy (static_cast<T *> (obj));
+            }
+
             uint64_t get_alloced       (void) { return alloced;                }
             uint64_t get_freed         (void) { return freed;                  }
             uint64_t get_next_req_size (void) { return objpool.get_next_size();}
@@ -71,6 +159,11 @@ namespace openarchive
         typedef void   (*libmalloc_free_t)               (void *);
         typedef void   (*libmalloc_malloc_stats_print_t) (write_cb_t, 
                                                           void *, const char *);
+        typedef int    (*libmalloc_mallctl_t)            (const char *, void *,
+                                                          size_t *, void *,
+                                                          size_t);
+        typedef int    (*libmalloc_numeric_property_t)   (const char *, 
+                                                          size_t *);
         struct libmalloc_fops
         {
             libmalloc_malloc_t              malloc;
@@ -80,6 +173,33 @@ namespace openarchive
             libmalloc_realloc_t             realloc;
             libmalloc_free_t                free;
             libmalloc_malloc_stats_print_t  malloc_stats_print;
+            libmalloc_mallctl_t             mallctl;        /* jemalloc only */
+            libmalloc_numeric_property_t    numeric_property;/* tcmalloc only*/
+        };
+
+        /*
+         * Memory managers which can back the memory pools. The backend is
+         * picked in the config file, the system malloc is used if the 
+         * library of the configured backend cannot be loaded.
+         */
+        enum malloc_backend
+        {
+            MALLOC_SYSTEM   = 0,
+            MALLOC_JEMALLOC = 1,
+            MALLOC_TCMALLOC = 2
+        };
+
+        /*
+         * Threads which allocate heavily are given arenas of their own so 
+         * that they neither contend with nor fragment the arenas of the 
+         * other threads. Arenas are only supported with jemalloc.
+         */
+        enum arena_type
+        {
+            ARENA_DEFAULT  = 0,
+            ARENA_FAST_IO  = 1,   /* fast ioservice worker threads   */
+            ARENA_CVLT_CBK = 2,   /* commvault library callbacks     */
+            ARENA_MAX      = 3
         };
 
         class malloc_fops
@@ -87,20 +207,23 @@ namespace openarchive
             bool ready;
             void *handle;
             std::string lib;
+            enum malloc_backend backend;
             struct libmalloc_fops fops;
             src::severity_logger<int> log; 
             int32_t log_level;
         
             private:
             void   init_fops (void);
+            void   init_system_fops (void);
             void * extract_symbol (std::string);   
             void   extract_all_symbols (void);
             void   dump_all_symbols (void);
 
             public: 
-            malloc_fops (std::string);
+            malloc_fops (enum malloc_backend);
             ~malloc_fops (void);
             struct libmalloc_fops & get_fops (void); 
+            enum malloc_backend get_backend (void) { return backend; }
         };
 
         class buff;
@@ -111,12 +234,25 @@ namespace openarchive
             src::severity_logger<int> log; 
             atomic_uint64_t alloced;
             atomic_uint64_t released;
+            openarchive::arch_core::spinlock arena_lock;
+            int64_t arenas[ARENA_MAX];    /* jemalloc arena ids, -1 if none */
+
+            private:
+            int64_t create_arena (void);
+            bool    read_stat (std::string, size_t &);
 
             public:
-            malloc_intfx  (std::string);
+            malloc_intfx  (enum malloc_backend);
             void getstats (std::string &);
+            void get_arena_stats (std::string &);
             malloc_fops & get_fops (void)        { return fops;     } 
 
+            /*
+             * Make the calling thread allocate from the arena of the given
+             * type. Returns false if arenas are not supported.
+             */
+            bool bind_arena (enum arena_type);
+
             boost::shared_ptr<buff> malloc             (size_t);
             boost::shared_ptr<buff> calloc             (size_t, size_t);
             boost::shared_ptr<buff> posix_memalign     (size_t, size_t);
@@ -135,6 +271,134 @@ namespace openarchive
         };
 
         boost::shared_ptr<malloc_intfx> get_malloc_intfx (void);
+
+        /*
+         * Bind the calling thread to an arena. Cheap to call repeatedly,
+         * the thread is only bound once.
+         */
+        void bind_thread_arena (enum arena_type);
+
+        /*
+         * Allocator for the containers on the hot paths so that their
+         * nodes come from the configured memory manager too.
+         */
+        template <class T> class intfx_allocator
+        {
+            public:
+            typedef T value_type;
+
+            intfx_allocator (void) {}
+            template <class U> intfx_allocator (const intfx_allocator<U> &) {}
+
+            T * allocate (size_t num)
+            {
+                static libmalloc_fops & fops = 
+                                 get_malloc_intfx ()->get_fops ().get_fops ();
+
+                void * ptr = fops.malloc (num * sizeof (T));
+                if (!ptr) {
+                    throw std::bad_alloc ();
+                }
+
+                return (T *) ptr;
+            }
+
+            void deallocate (T * ptr, size_t)
+            {
+                static libmalloc_fops & fops = 
+                                 get_malloc_intfx ()->get_fops ().get_fops ();
+
+                fops.free (ptr);
+            }
+
+            template <class U> struct rebind 
+            { 
+                typedef intfx_allocator<U> other; 
+            };
+
+            bool operator== (const intfx_allocator &) const { return true;  }
+            bool operator!= (const intfx_allocator &) const { return false; }
+        };
+
+        /*
+         * Memory pools register with the memory governor as clients. The
+         * governor asks its clients to give back memory held in their
+         * free lists when they have been idle for a while, or when an
+         * allocation would exceed the memory budget.
+         */
+        class mem_client
+        {
+            public:
+            virtual ~mem_client (void) {}
+
+            /*
+             * Release free memory down to the low watermark of the client.
+             * Unless forced, a client which has been active since the last
+             * call keeps its memory. Returns the number of bytes released.
+             * May be called from any thread, concurrently with the use of
+             * the client.
+             */
+            virtual uint64_t trim (bool) = 0;
+
+            /*
+             * Bytes of free memory out of the reach of trim, cached by
+             * the threads.
+             */
+            virtual uint64_t get_cached (void) { return 0; }
+        };
+
+        /*
+         * Process wide budget for the memory held by the memory pools.
+         * Small objects are charged against the budget but are never 
+         * refused, large buffers have to reserve their memory and wait
+         * for memory to be released when the budget has been used up.
+         */
+        class mem_governor
+        {
+            uint64_t budget;              /* Budget in bytes, 0 for none    */
+            uint32_t wait_ms;             /* Max wait for a reservation     */
+            std::atomic<uint64_t> used;   /* Bytes held by the pools        */
+            std::atomic<uint64_t> peak;   /* Highest value of used          */
+            std::atomic<uint64_t> waits;  /* Reservations which had to wait */
+            std::atomic<uint64_t> denied; /* Reservations which failed      */
+            std::atomic<uint64_t> trimmed;/* Bytes released by trimming     */
+            std::mutex client_lock;       /* Protects clients, serializes   */
+            std::list<mem_client *> clients; /* trimming                    */
+            std::mutex wait_lock;
+            std::condition_variable wait_cv;
+
+            private:
+            bool try_reserve (uint64_t);
+            void update_peak (uint64_t);
+
+            public:
+            mem_governor (uint64_t, uint32_t);
+
+            void register_client   (mem_client *);
+            void unregister_client (mem_client *);
+
+            void charge  (uint64_t);
+
+            /*
+             * Reserve memory for the given client, which is left out of the
+             * forced trim done when over budget: it is the one growing.
+             */
+            bool reserve (uint64_t, bool, mem_client * = NULL);
+            void release (uint64_t);
+
+            /*
+             * Ask the clients, but the given one, to trim their free lists.
+             * Only idle clients are trimmed unless forced.
+             */
+            uint64_t trim (bool, mem_client * = NULL);
+
+            uint64_t get_budget (void)   { return budget;       }
+            uint64_t get_used   (void)   { return used.load (); }
+            void     getstats   (std::string &);
+        };
+
+        typedef boost::shared_ptr<mem_governor> mem_governor_ptr_t;
+        mem_governor_ptr_t get_mem_governor (void);
  
         class buff
         {
@@ -152,41 +416,516 @@ namespace openarchive
             int    get_size (void) { return size;   }
         };
 
-        template <class T, uint32_t COUNT> class objpool
+        /*
+         * Number of objects moved between a per thread magazine and the
+         * shared free list of a pool in one batch. A magazine holds at
+         * most twice the batch. Plain buffers are large, so very few of
+         * them are parked per thread.
+         */
+        const uint32_t obj_magazine_batch = 32;
+        const uint32_t plb_magazine_batch = 1;
+
+        /*
+         * Huge page sizes used for backing the plain buffers.
+         */
+        const size_t huge_page_2mb = 0x200000;
+        const size_t huge_page_1gb = 0x40000000;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+        template <class T> class magazine;
+
+        /*
+         * Depot is the state shared between a pool and the magazines of
+         * all the threads which have used the pool. It is reference counted
+         * so that a thread exiting after the pool has been destroyed can
+         * still return its magazine. A pool keeps one depot per NUMA node,
+         * threads draw from the depot of the node they run on.
+         */
+        inline openarchive::arch_core::lock_stats * get_depot_lock_stats (void)
+        {
+            static openarchive::arch_core::lock_stats stats ("pool depot");
+            return &stats;
+        }
+
+        inline openarchive::arch_core::lock_stats * get_depot_queue_stats (void)
+        {
+            static openarchive::arch_core::lock_stats stats ("pool free queue");
+            return &stats;
+        }
+
+        template <class T> class magazine_depot
+        {
+            public:
+            uint32_t batch;
+            openarchive::arch_core::mtqueue<T *> free_pool;
+            boost::function<void (T *)> release; /* Frees unused objects   */
+            openarchive::arch_core::spinlock lock;
+            std::list <magazine<T> *> mags;      /* Magazines in use       */
+            std::atomic<uint64_t> hits;          /* Counters of the retired*/
+            std::atomic<uint64_t> allocs;        /* magazines and of the   */
+            std::atomic<uint64_t> frees;         /* unmagazined operations */
+
+            magazine_depot (uint32_t num, boost::function<void (T *)> fn):
+                            batch (num? num: 1), release (fn)
+            {
+                lock.set_stats (get_depot_lock_stats ());
+                free_pool.set_stats (get_depot_queue_stats ());
+                hits.store (0);
+                allocs.store (0);
+                frees.store (0);
+            }
+
+            ~magazine_depot (void)
+            {
+                T * obj;
+
+                while (free_pool.pop (obj)) {
+                    release (obj);
+                }
+            }
+        };
+
+        /*
+         * Magazine is a small LIFO stack of free objects owned by a single
+         * thread. The counters are only written by the owner thread; they
+         * are atomics so that getstats can read them from other threads,
+         * but are updated through relaxed loads and stores, not through
+         * read-modify-write operations.
+         */
+        template <class T> class magazine
+        {
+            public:
+            std::vector <T *> slots;
+            uint32_t count;
+            uint32_t node;                /* NUMA node of the depot        */
+            uint32_t epoch;               /* Flush epoch last seen         */
+            std::atomic<uint32_t> held;   /* count, for other threads      */
+            std::atomic<uint64_t> hits;   /* Allocations served locally    */
+            std::atomic<uint64_t> allocs; /* Total allocations             */
+            std::atomic<uint64_t> frees;  /* Total frees                   */
+            boost::shared_ptr <magazine_depot<T> > depot;
+
+            magazine (boost::shared_ptr <magazine_depot<T> > dp, uint32_t nd): 
+                      slots (2 * dp->batch), count (0), node (nd), epoch (0),
+                      depot (dp)
+            {
+                held.store (0);
+                hits.store (0);
+                allocs.store (0);
+                frees.store (0);
+            }
+
+            static void bump (std::atomic<uint64_t> &ctr)
+            {
+                ctr.store (ctr.load (std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+            }
+        };
+
+        template <class T> class magazine_cache
+        {
+            std::vector <boost::shared_ptr <magazine_depot<T> > > depots;
+            boost::thread_specific_ptr <magazine<T> > tls;
+            std::atomic<uint32_t> epoch;  /* Bumped to flush the magazines */
+
+            private:
+            static void retire (magazine<T> *mag)
+            {
+                /*
+                 * Invoked when a thread exits. Hand the cached objects and
+                 * the counters over to the depot.
+                 */
+                boost::shared_ptr <magazine_depot<T> > dp = mag->depot;
+
+                while (mag->count) {
+                    dp->free_pool.push (mag->slots[--mag->count]);
+                }
+
+                {
+                    openarchive::arch_core::spinlock_handle handle (dp->lock);
+                    dp->mags.remove (mag);
+                    dp->hits.fetch_add (mag->hits.load ());
+                    dp->allocs.fetch_add (mag->allocs.load ());
+                    dp->frees.fetch_add (mag->frees.load ());
+                }
+
+                delete mag;
+            }
+
+            magazine<T> * get_magazine (void)
+            {
+                magazine<T> * mag = tls.get ();
+
+                /*
+                 * A magazine left behind by an earlier pool which lived at
+                 * the same address is retired when it is replaced. Threads
+                 * which are not pinned keep the magazine of the node they
+                 * first ran on.
+                 */
+                if (mag && mag->node < depots.size () && 
+                    mag->depot == depots[mag->node]) {
+                    return mag;
+                }
+
+                uint32_t node = get_local_node ();
+
+                mag = new (std::nothrow) magazine<T> (depots[node], node);
+                if (!mag) {
+                    return NULL;
+                }
+
+                {
+                    openarchive::arch_core::spinlock_handle handle (
+                                                      depots[node]->lock);
+                    depots[node]->mags.push_back (mag);
+                }
+
+                mag->epoch = epoch.load ();
+                tls.reset (mag);
+                return mag;
+            }
+
+            /*
+             * Hand the objects of the magazine over to the depot if a
+             * flush has been asked for since the owner last looked.
+             */
+            void check_flush (magazine<T> * mag)
+            {
+                uint32_t now = epoch.load (std::memory_order_relaxed);
+
+                if (mag->epoch == now) {
+                    return;
+                }
+
+                mag->epoch = now;
+                while (mag->count) {
+                    mag->depot->free_pool.push (mag->slots[--mag->count]);
+                }
+                mag->held.store (0, std::memory_order_relaxed);
+            }
+
+            uint32_t get_local_node (void)
+            {
+                uint32_t node = openarchive::arch_numa::get_current_node ();
+
+                return (node < depots.size ()? node: 0);
+            }
+
+            public:
+            magazine_cache (uint32_t batch, boost::function<void (T *)> fn):
+                            tls (&magazine_cache<T>::retire)
+            {
+                epoch.store (0);
+
+                uint32_t nodes = openarchive::arch_numa::get_num_nodes ();
+
+                for (uint32_t node = 0; node < nodes; node++) {
+                    depots.push_back (boost::make_shared <magazine_depot<T> > (
+                                                                  batch, fn));
+                }
+            }
+
+            /*
+             * Node whose free list the calling thread allocates from. 
+             * Newly allocated objects are added to this node.
+             */
+            uint32_t get_node (void)
+            {
+                magazine<T> * mag = get_magazine ();
+
+                return (mag? mag->node: get_local_node ());
+            }
+
+            /*
+             * Add a newly allocated object to the shared free list of the 
+             * node of the calling thread.
+             */
+            bool add (T *obj)
+            {
+                return depots[get_node ()]->free_pool.push (obj);
+            }
+
+            bool alloc (T *&obj)
+            {
+                magazine<T> * mag = get_magazine ();
+
+                if (!mag) {
+                    boost::shared_ptr <magazine_depot<T> > & depot = 
+                                                   depots[get_local_node ()];
+
+                    if (!depot->free_pool.pop (obj)) {
+                        return false;
+                    }
+
+                    depot->allocs.fetch_add (1);
+                    return true;
+                }
+
+                boost::shared_ptr <magazine_depot<T> > & depot = mag->depot;
+
+                check_flush (mag);
+
+                if (mag->count) {
+                    magazine<T>::bump (mag->hits);
+                } else {
+                    /*
+                     * Magazine is empty, refill a batch from the shared 
+                     * free list.
+                     */
+                    while (mag->count < depot->batch &&
+                           depot->free_pool.pop (mag->slots[mag->count])) {
+                        mag->count++;
+                    }
+
+                    if (!mag->count) {
+                        return false;
+                    }
+                }
+
+                obj = mag->slots[--mag->count];
+                mag->held.store (mag->count, std::memory_order_relaxed);
+                magazine<T>::bump (mag->allocs);
+                return true;
+            }
+
+            void release (T *obj)
+            {
+                magazine<T> * mag = get_magazine ();
+
+                if (!mag) {
+                    boost::shared_ptr <magazine_depot<T> > & depot = 
+                                                   depots[get_local_node ()];
+
+                    depot->free_pool.push (obj);
+                    depot->frees.fetch_add (1);
+                    return;
+                }
+
+                boost::shared_ptr <magazine_depot<T> > & depot = mag->depot;
+
+                check_flush (mag);
+
+                if (mag->count == mag->slots.size ()) {
+                    /*
+                     * Magazine is full. Return the oldest batch of objects
+                     * to the shared free list and keep the recently freed
+                     * ones which are more likely to be cache hot.
+                     */
+                    for (uint32_t count = 0; count < depot->batch; count++) {
+                        depot->free_pool.push (mag->slots[count]);
+                    }
+
+                    std::copy (mag->slots.begin () + depot->batch,
+                               mag->slots.end (), mag->slots.begin ());
+                    mag->count -= depot->batch;
+                }
+
+                mag->slots[mag->count++] = obj;
+                mag->held.store (mag->count, std::memory_order_relaxed);
+                magazine<T>::bump (mag->frees);
+                return;
+            }
+
+            /*
+             * Release an object whose memory lives on the given node. An 
+             * object freed by a thread of another node goes straight back
+             * to the free list of its own node.
+             */
+            void release (T *obj, uint32_t node)
+            {
+                if (node >= depots.size () || node == get_node ()) {
+                    release (obj);
+                    return;
+                }
+
+                depots[node]->free_pool.push (obj);
+                depots[node]->frees.fetch_add (1);
+                return;
+            }
+
+            /*
+             * Take an object off the shared free lists so that its memory
+             * can be given back. Objects cached in the magazines of the
+             * threads are not reclaimed, see flush.
+             */
+            bool reclaim (T *&obj)
+            {
+                for (uint32_t node = 0; node < depots.size (); node++) {
+                    if (depots[node]->free_pool.pop (obj)) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /*
+             * Ask the threads to hand the objects of their magazines over
+             * to the shared free lists. Each thread does so on its next
+             * allocation or release, where a later reclaim finds them.
+             */
+            void flush (void)
+            {
+                epoch.fetch_add (1);
+            }
+
+            /*
+             * Number of free objects held in the magazines of the threads.
+             */
+            uint64_t get_cached (void)
+            {
+                uint64_t cached = 0;
+
+                for (uint32_t node = 0; node < depots.size (); node++) {
+                    boost::shared_ptr <magazine_depot<T> > & depot = 
+                                                              depots[node];
+
+                    openarchive::arch_core::spinlock_handle handle (
+                                                              depot->lock);
+
+                    typename std::list <magazine<T> *>::iterator iter;
+                    for (iter = depot->mags.begin ();
+                         iter != depot->mags.end (); iter++) {
+                        cached += (*iter)->held.load (
+                                                 std::memory_order_relaxed);
+                    }
+                }
+
+                return cached;
+            }
+
+            uint64_t get_allocs (void)
+            {
+                uint64_t hits, allocs, frees;
+
+                getstats (hits, allocs, frees);
+                return allocs;
+            }
+
+            void getstats (uint32_t node, uint64_t &hits, uint64_t &allocs,
+                           uint64_t &frees)
+            {
+                boost::shared_ptr <magazine_depot<T> > & depot = depots[node];
+
+                openarchive::arch_core::spinlock_handle handle (depot->lock);
+
+                hits   = depot->hits.load ();
+                allocs = depot->allocs.load ();
+                frees  = depot->frees.load ();
+
+                typename std::list <magazine<T> *>::iterator iter;
+                for (iter = depot->mags.begin (); iter != depot->mags.end ();
+                     iter++) {
+                    hits   += (*iter)->hits.load (std::memory_order_relaxed);
+                    allocs += (*iter)->allocs.load (std::memory_order_relaxed);
+                    frees  += (*iter)->frees.load (std::memory_order_relaxed);
+                }
+
+                return;
+            }
+
+            void getstats (uint64_t &hits, uint64_t &allocs, uint64_t &frees)
+            {
+                hits = allocs = frees = 0;
+
+                for (uint32_t node = 0; node < depots.size (); node++) {
+                    uint64_t h, a, f;
+
+                    getstats (node, h, a, f);
+                    hits   += h;
+                    allocs += a;
+                    frees  += f;
+                }
+
+                return;
+            }
+
+            /*
+             * Format the magazine statistics for the pool statistics
+             */
+            std::string getstats (void)
+            {
+                uint64_t hits, allocs, frees;
+                getstats (hits, allocs, frees);
+
+                uint64_t rate = (allocs? (hits * 100)/allocs: 0);
+
+                std::string stat = " active: " + 
+                        boost::lexical_cast <std::string> (allocs - frees) +
+                        " allocs: " +
+                        boost::lexical_cast <std::string> (allocs) +
+                        " magazine hits: " +
+                        boost::lexical_cast <std::string> (hits) +
+                        " magazine hit rate: " +
+                        boost::lexical_cast <std::string> (rate) + "%" +
+                        " cached: " +
+                        boost::lexical_cast <std::string> (get_cached ());
+
+                if (depots.size () > 1) {
+                    /*
+                     * Break down the activity per NUMA node.
+                     */
+                    for (uint32_t node = 0; node < depots.size (); node++) {
+                        getstats (node, hits, allocs, frees);
+
+                        stat += " node" + 
+                                boost::lexical_cast <std::string> (node) +
+                                " active: " +
+                                boost::lexical_cast <std::string> (allocs - 
+                                                                   frees) +
+                                " allocs: " +
+                                boost::lexical_cast <std::string> (allocs);
+                    }
+                }
+
+                return stat;
+            }
+        };
+
+        template <class T, uint32_t COUNT> class objpool: public mem_client
         {
             std::string name;             /* Name of the object pool          */
-            uint32_t next_alloc_size;     /* Number of buffers to be allocated*/
-                                          /* in the next new request          */
-            std::atomic<uint32_t> active; /* Number of current active objects */
+            std::atomic<uint32_t> next_alloc_size; /* Number of buffers to be */
+                                          /* allocated in the next expansion  */
             std::atomic<uint32_t> total;  /* Total objects allocated          */
             boost::shared_ptr<malloc_intfx> mem_intfx;
-            openarchive::arch_core::mtqueue<T*> free_pool;
             struct libmalloc_fops & fops;  
+            magazine_cache<T> free_pool;  /* Per thread magazines and the     */
+                                          /* shared free list                 */
+            boost::shared_ptr<mem_governor> governor;
+            std::atomic<uint64_t> last_allocs; /* Allocations seen by last trim*/
 
             private:
             uint32_t expand (void)
             {
                 int new_slots = 0;
+                uint32_t batch = next_alloc_size.load ();
 
-                for(uint32_t count = 0; count < next_alloc_size; count++) {
+                for(uint32_t count = 0; count < batch; count++) {
 
                     T * obj = (T *) fops.malloc (sizeof (T));
 
                     if (obj) {
-                        if (free_pool.push (obj)) {
+                        if (free_pool.add (obj)) {
                             new_slots++;
+                        } else {
+                            fops.free (obj);
                         }
                     }
 
                 }
 
                 total.fetch_add (new_slots);
+                governor->charge (new_slots * sizeof (T));
 
                 /* 
                  * Double the number of buffers that will be allocated in the
                  * next malloc request.
                  */  
-                next_alloc_size = next_alloc_size<<1;
+                next_alloc_size.store (batch<<1);
 
                 return (new_slots);
             }
@@ -195,48 +934,80 @@ namespace openarchive
             objpool(std::string sn): name(sn),
                                      next_alloc_size (COUNT),
                                      mem_intfx (openarchive::arch_mem::get_malloc_intfx ()),
-                                     fops (mem_intfx->get_fops ().get_fops ()) 
+                                     fops (mem_intfx->get_fops ().get_fops ()),
+                                     free_pool (obj_magazine_batch,
+                                                boost::bind (fops.free, _1)),
+                                     governor (openarchive::arch_mem::get_mem_governor ()),
+                                     last_allocs (0)
             {
-                active.store(0);
                 total.store(0);
 
-                /*
-                 * Get an instance of the malloc_intfx object
-                 */ 
-                mem_intfx = openarchive::arch_mem::get_malloc_intfx ();
-
                 /*
                  * Allocate queue of buffers.
                  */
                 expand ();
+
+                governor->register_client (this);
             } 
 
             ~objpool (void)
             {
-                T * obj;
-              
-                while(free_pool.pop (obj)) {
-                    
+                governor->unregister_client (this);
+                governor->release (total.load () * sizeof (T));
+            }
+
+            virtual uint64_t get_cached (void)
+            {
+                return (free_pool.get_cached () * sizeof (T));
+            }
+
+            virtual uint64_t trim (bool force)
+            {
+                uint64_t allocs = free_pool.get_allocs ();
+
+                if (last_allocs.exchange (allocs) != allocs && !force) {
+                    /*
+                     * The pool has been used since the last check.
+                     */
+                    return 0;
+                }
+
+                /*
+                 * What the magazines hold is reclaimed by the next trim.
+                 */
+                free_pool.flush ();
+
+                uint32_t freed = 0;
+                T * obj = NULL;
+
+                while (total.load () > COUNT && free_pool.reclaim (obj)) {
                     fops.free (obj);
+                    total.fetch_sub (1);
+                    freed++;
                 }
-  
+
+                if (freed) {
+                    next_alloc_size.store (COUNT);
+                    governor->release (freed * sizeof (T));
+                }
+
+                return (freed * sizeof (T));
             }
 
             T * alloc_obj (void)
             {
                 T * obj = NULL;
 
-                if (!free_pool.pop (obj)) {
+                if (!free_pool.alloc (obj)) {
 
                     expand();
-                    free_pool.pop (obj);
+                    free_pool.alloc (obj);
                     
                 }
 
                 if (obj) {
                   
                    new (obj) T ();
-                   active.fetch_add (1);
 
                 }
 
@@ -251,16 +1022,7 @@ namespace openarchive
    
                 obj->~T ();
  
-                if (!free_pool.push (obj)) {
-                    /*
-                     * Failed to add back to queue. Better discard it.
-                     */
-                    fops.free (obj);
-                    total.fetch_sub (1);
-                    return;
-                }
-
-                active.fetch_sub (1);
+                free_pool.release (obj);
                 return; 
             }
 
@@ -279,6 +1041,26 @@ namespace openarchive
                 release_obj (obj);   
             }
 
+            /*
+             * Allocate an object handed out through an intrusive handle.
+             * T has to derive from pool_object.
+             */
+            boost::intrusive_ptr <T> make_intrusive (void)
+            {
+                T * obj = alloc_obj ();
+
+                if (obj) {
+                    obj->set_owner (this, &objpool<T, COUNT>::recycle);
+                }
+
+                return boost::intrusive_ptr <T> (obj);
+            }
+
+            static void recycle (void *pool, pool_object *obj)
+            {
+                ((objpool<T, COUNT> *) pool)->release_obj (static_cast<T *> (obj));
+            }
+
 
             void getstats (std::string &stat)
             {
@@ -290,9 +1072,8 @@ namespace openarchive
                 stat = " name: " + 
                        name +
                        " next_alloc_size: " + 
-                       boost::lexical_cast <std::string> (next_alloc_size) +
-                       " active: " +
-                       boost::lexical_cast <std::string> (active.load ()) +  
+                       boost::lexical_cast <std::string> (next_alloc_size.load ()) +
+                       free_pool.getstats () +
                        " total: " +
                        boost::lexical_cast <std::string> (total.load ());
                 return;
@@ -300,41 +1081,47 @@ namespace openarchive
             
         }; 
 
-        template <class T, uint32_t COUNT> class structpool
+        template <class T, uint32_t COUNT> class structpool: public mem_client
         {
             std::string name;             /* Name of the struct pool          */
-            uint32_t next_alloc_size;     /* Number of buffers to be allocated*/
-                                          /* in the next new request          */
-            std::atomic<uint32_t> active; /* Number of current active objects */
+            std::atomic<uint32_t> next_alloc_size; /* Number of buffers to be */
+                                          /* allocated in the next expansion  */
             std::atomic<uint32_t> total;  /* Total objects allocated          */
             boost::shared_ptr<malloc_intfx> mem_intfx;
-            openarchive::arch_core::mtqueue<T*> free_pool;
             struct libmalloc_fops & fops;  
+            magazine_cache<T> free_pool;  /* Per thread magazines and the     */
+                                          /* shared free list                 */
+            boost::shared_ptr<mem_governor> governor;
+            std::atomic<uint64_t> last_allocs; /* Allocations seen by last trim*/
 
             private:
             uint32_t expand (void)
             {
                 int new_slots = 0;
+                uint32_t batch = next_alloc_size.load ();
 
-                for(uint32_t count = 0; count < next_alloc_size; count++) {
+                for(uint32_t count = 0; count < batch; count++) {
 
                     T * obj = (T *) fops.malloc (sizeof (T));
 
                     if (obj) {
-                        if (free_pool.push (obj)) {
+                        if (free_pool.add (obj)) {
                             new_slots++;
+                        } else {
+                            fops.free (obj);
                         }
                     }
 
                 }
 
                 total.fetch_add (new_slots);
+                governor->charge (new_slots * sizeof (T));
 
                 /* 
                  * Double the number of buffers that will be allocated in the
                  * next malloc request.
                  */  
-                next_alloc_size = next_alloc_size<<1;
+                next_alloc_size.store (batch<<1);
 
                 return (new_slots);
             }
@@ -343,50 +1130,77 @@ namespace openarchive
             structpool(std::string sn): name (sn),
                                      next_alloc_size (COUNT),
                                      mem_intfx (openarchive::arch_mem::get_malloc_intfx ()),
-                                     fops (mem_intfx->get_fops ().get_fops ()) 
+                                     fops (mem_intfx->get_fops ().get_fops ()),
+                                     free_pool (obj_magazine_batch,
+                                                boost::bind (fops.free, _1)),
+                                     governor (openarchive::arch_mem::get_mem_governor ()),
+                                     last_allocs (0)
             {
-                active.store(0);
                 total.store(0);
 
-                /*
-                 * Get an instance of the malloc_intfx object
-                 */ 
-                mem_intfx = openarchive::arch_mem::get_malloc_intfx ();
-
                 /*
                  * Allocate queue of buffers.
                  */
                 expand ();
+
+                governor->register_client (this);
             } 
 
             ~structpool (void)
             {
-                T * obj;
-              
-                while(free_pool.pop (obj)) {
-                    
+                governor->unregister_client (this);
+                governor->release (total.load () * sizeof (T));
+            }
+
+            virtual uint64_t get_cached (void)
+            {
+                return (free_pool.get_cached () * sizeof (T));
+            }
+
+            virtual uint64_t trim (bool force)
+            {
+                uint64_t allocs = free_pool.get_allocs ();
+
+                if (last_allocs.exchange (allocs) != allocs && !force) {
+                    /*
+                     * The pool has been used since the last check.
+                     */
+                    return 0;
+                }
+
+                /*
+                 * What the magazines hold is reclaimed by the next trim.
+                 */
+                free_pool.flush ();
+
+                uint32_t freed = 0;
+                T * obj = NULL;
+
+                while (total.load () > COUNT && free_pool.reclaim (obj)) {
                     fops.free (obj);
+                    total.fetch_sub (1);
+                    freed++;
                 }
-  
+
+                if (freed) {
+                    next_alloc_size.store (COUNT);
+                    governor->release (freed * sizeof (T));
+                }
+
+                return (freed * sizeof (T));
             }
 
             T * alloc (void)
             {
-                T * obj;
+                T * obj = NULL;
 
-                if (!free_pool.pop (obj)) {
+                if (!free_pool.alloc (obj)) {
 
                     expand();
-                    free_pool.pop (obj);
+                    free_pool.alloc (obj);
                     
                 }
 
-                if (obj) {
-                  
-                    active.fetch_add (1);
-
-                }
-
                 return obj;
             }
 
@@ -397,16 +1211,7 @@ namespace openarchive
                     return;   
                 } 
    
-                if (!free_pool.push (obj)) {
-                    /*
-                     * Failed to add back to queue. Better discard it.
-                     */
-                    fops.free (obj);
-                    total.fetch_sub (1);
-                    return;
-                }
-
-                active.fetch_sub (1);
+                free_pool.release (obj);
                 return; 
             }
 
@@ -420,9 +1225,8 @@ namespace openarchive
                 stat = " name: " + 
                        name +
                        " next_alloc_size: " + 
-                       boost::lexical_cast <std::string> (next_alloc_size) +
-                       " active: " +
-                       boost::lexical_cast <std::string> (active.load ()) +  
+                       boost::lexical_cast <std::string> (next_alloc_size.load ()) +
+                       free_pool.getstats () +
                        " total: " +
                        boost::lexical_cast <std::string> (total.load ());
                 return;
@@ -436,9 +1240,13 @@ namespace openarchive
             size_t size;
             off_t f_offset;
             size_t f_bytes; 
+            uint32_t node;        /* NUMA node holding the buffer memory */
+            bool mapped;          /* Memory is a private huge page mapping*/
+            bool locked;          /* Memory is locked with mlock          */
 
             public:
-            plbuff  (void *p , size_t z): ptr(p), size(z)
+            plbuff  (void *p , size_t z): ptr(p), size(z), node(0),
+                                          mapped(false), locked(false)
             {
             }
 
@@ -446,47 +1254,204 @@ namespace openarchive
             void   set_size (size_t z)   { size = z;        }
             void   set_offset (off_t of) { f_offset = of;   }
             void   set_bytes (size_t sz) { f_bytes = sz;    }
+            void   set_node (uint32_t n) { node = n;        }
+            void   set_mapped (bool b)   { mapped = b;      }
+            void   set_locked (bool b)   { locked = b;      }
             void * get_base (void)       { return ptr;      }
             size_t get_size (void)       { return size;     }
             off_t  get_offset (void)     { return f_offset; }
             size_t get_bytes (void)      { return f_bytes;  }
+            uint32_t get_node (void)     { return node;     }
+            bool   get_mapped (void)     { return mapped;   }
+            bool   get_locked (void)     { return locked;   }
             void   clear (void)          { ptr = NULL;      }
         };
 
-        template <size_t SIZE, uint32_t COUNT> class plbpool
+        /*
+         * Reference to a byte range of a plain buffer. A slice keeps the 
+         * buffer alive, so data filled once into a pooled buffer can be 
+         * handed from one iopx layer to another instead of being copied. 
+         * The contents of a buffer must not change once slices of it have
+         * been handed out.
+         */
+        class buff_slice
+        {
+            boost::shared_ptr<plbuff> owner;
+            uint64_t offset;
+            uint64_t len;
+
+            public:
+            buff_slice (void): offset(0), len(0) 
+            {
+            }
+
+            buff_slice (boost::shared_ptr<plbuff> p, uint64_t of, uint64_t l):
+                        owner(p), offset(of), len(l)
+            {
+                assert (!owner || offset + len <= owner->get_size ());
+            }
+
+            void reset (void)
+            {
+                owner.reset ();
+                offset = 0;
+                len = 0;
+            }
+
+            /*
+             * Slice of this slice, the range is relative to the slice.
+             */
+            buff_slice sub (uint64_t of, uint64_t l) const
+            {
+                assert (of + l <= len);
+                return buff_slice (owner, offset + of, l);
+            }
+
+            bool     empty     (void) const { return !owner || !len;  }
+            uint64_t get_len   (void) const { return len;              }
+            uint64_t get_offset(void) const { return offset;           }
+            boost::shared_ptr<plbuff> get_owner (void) const { return owner; }
+
+            char *   get_base  (void) const 
+            { 
+                return (owner? (char *) owner->get_base () + offset: NULL);
+            }
+        };
+
+        template <size_t SIZE, uint32_t COUNT> class plbpool: public mem_client
         {
             std::string name;             /* Name of the plain buff pool      */
-            uint32_t next_alloc_size;     /* Number of buffers to be allocated*/
-                                          /* in the next new request          */
-            std::atomic<uint32_t> active; /* Number of current active objects */
+            std::atomic<uint32_t> next_alloc_size; /* Number of buffers to be */
+                                          /* allocated in the next expansion  */
             std::atomic<uint32_t> total;  /* Total objects allocated          */
+            std::atomic<uint32_t> huge;   /* Buffers mapped on huge pages     */
+            std::atomic<uint32_t> locked; /* Buffers locked in memory         */
             boost::shared_ptr<malloc_intfx> mem_intfx;
-            openarchive::arch_core::mtqueue<plbuff *> free_pool;
             struct libmalloc_fops & fops;  
+            magazine_cache<plbuff> free_pool; /* Per thread magazines and the */
+                                              /* shared free list             */
+            boost::shared_ptr<mem_governor> governor;
+            std::atomic<uint64_t> last_allocs; /* Allocations seen by last trim*/
 
             private:
+            /*
+             * Largest huge page size which evenly divides the buffer size,
+             * 0 if the buffers are too small for huge pages.
+             */
+            static size_t huge_page_size (void)
+            {
+                if (SIZE % huge_page_1gb == 0) {
+                    return huge_page_1gb;
+                }
+
+                if (SIZE % huge_page_2mb == 0) {
+                    return huge_page_2mb;
+                }
+
+                return 0;
+            }
+
+            /*
+             * Allocate the memory of a buffer. Explicit huge pages are 
+             * tried first, they are only available if the administrator
+             * has reserved them. Otherwise the buffer is allocated from the
+             * heap aligned to the huge page size and transparent huge pages
+             * are requested for it.
+             */
+            void * alloc_region (size_t page_size, bool &mapped)
+            {
+                size_t hpsz = huge_page_size ();
+                void * ptr = NULL;
+
+                mapped = false;
+
+                if (hpsz && openarchive::cfgparams::plbuff_huge_pages ()) {
+
+                    int shift = (hpsz == huge_page_1gb)? 30: 21;
+                    ptr = mmap (NULL, SIZE, PROT_READ | PROT_WRITE, 
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                                (shift << MAP_HUGE_SHIFT), -1, 0);
+
+                    if (ptr != MAP_FAILED) {
+                        mapped = true;
+                        return ptr;
+                    }
+
+                    ptr = NULL;
+                    if (!fops.posix_memalign (&ptr, hpsz, SIZE)) {
+                        madvise (ptr, SIZE, MADV_HUGEPAGE);
+                        return ptr;
+                    }
+
+                    ptr = NULL;
+                }
+
+                if (fops.posix_memalign (&ptr, page_size, SIZE)) {
+                    return NULL;
+                }
+
+                return ptr;
+            }
+
             uint32_t expand (void)
             {
                 int new_slots = 0;
                 size_t page_size = mem_intfx->get_page_size ();
+                uint32_t node = free_pool.get_node ();
+                bool numa = (openarchive::arch_numa::get_num_nodes () > 1);
+                bool lock = openarchive::cfgparams::plbuff_mlock ();
+                uint32_t batch = next_alloc_size.load ();
                
-                for(uint32_t count = 0; count < next_alloc_size; count++) {
+                for(uint32_t count = 0; count < batch; count++) {
+
+                    /*
+                     * Only the first buffer waits for memory to be 
+                     * released, the expansion stops at the budget.
+                     */
+                    if (!governor->reserve (SIZE, (new_slots == 0), this)) {
+                        break;
+                    }
                     
                     plbuff * pb = (plbuff *) fops.calloc (1, sizeof (plbuff));
-                    if (pb) { 
-                        void * ptr = NULL;
-                        int32_t ret = fops.posix_memalign (&ptr, page_size, 
-                                                           SIZE);
-                        if (!ret) {
+                    if (!pb) {
+                        governor->release (SIZE);
+                    } else { 
+                        bool mapped = false;
+                        void * ptr = alloc_region (page_size, mapped);
+                        if (ptr) {
+                            if (lock && !mlock (ptr, SIZE)) {
+                                /*
+                                 * mlock faults in all the pages, on the 
+                                 * node of this thread.
+                                 */
+                                pb->set_locked (true);
+                                locked.fetch_add (1);
+                            } else if (numa) {
+                                /*
+                                 * Touch the pages so that they are placed
+                                 * on the node of this thread rather than
+                                 * on the node of the first reader.
+                                 */
+                                memset (ptr, 0, SIZE);
+                            }
+
+                            if (mapped) {
+                                huge.fetch_add (1);
+                            }
+
                             pb->set_size (SIZE);
                             pb->set_base (ptr);
-                            if (free_pool.push (pb)) {
+                            pb->set_node (node);
+                            pb->set_mapped (mapped);
+                            if (free_pool.add (pb)) {
                                 new_slots++;
                             } else {
-                                free (pb);    
+                                free (fops.free, pb);    
+                                governor->release (SIZE);
                             }
                         } else {
-                            free (pb);
+                            free (fops.free, pb);
+                            governor->release (SIZE);
                         }
                     } 
 
@@ -498,7 +1463,7 @@ namespace openarchive
                  * Double the number of buffers that will be allocated in the
                  * next posix_memalign request.
                  */  
-                next_alloc_size = next_alloc_size<<1;
+                next_alloc_size.store (batch<<1);
 
                 return (new_slots);
             }
@@ -507,42 +1472,95 @@ namespace openarchive
             plbpool(std::string sn): name(sn),
                                      next_alloc_size (COUNT),
                                      mem_intfx (openarchive::arch_mem::get_malloc_intfx ()),
-                                     fops (mem_intfx->get_fops ().get_fops ()) 
+                                     fops (mem_intfx->get_fops ().get_fops ()),
+                                     free_pool (plb_magazine_batch,
+                                                boost::bind (&plbpool<SIZE,
+                                                             COUNT>::free,
+                                                             fops.free, _1)),
+                                     governor (openarchive::arch_mem::get_mem_governor ()),
+                                     last_allocs (0)
             {
-                active.store(0);
                 total.store(0);
+                huge.store(0);
+                locked.store(0);
 
                 /*
-                 * Get an instance of the malloc_intfx object
-                 */ 
-                mem_intfx = openarchive::arch_mem::get_malloc_intfx ();
-
-                /*
-                 * Allocate queue of buffers.
+                 * Allocate queue of buffers. A larger number of buffers may
+                 * be preallocated through the config file, later expansions
+                 * grow from the default size.
                  */
+                uint32_t prealloc = openarchive::cfgparams::plbuff_prealloc ();
+                if (prealloc > COUNT) {
+                    next_alloc_size = prealloc;
+                }
+
                 expand ();
+
+                if (prealloc > COUNT) {
+                    next_alloc_size = COUNT<<1;
+                }
+
+                governor->register_client (this);
             } 
 
             ~plbpool (void)
             {
-                plbuff * pb;
-              
-                while(free_pool.pop (pb)) {
-                    free (pb);
+                governor->unregister_client (this);
+                governor->release (total.load () * SIZE);
+            }
+
+            virtual uint64_t get_cached (void)
+            {
+                return (free_pool.get_cached () * SIZE);
+            }
+
+            virtual uint64_t trim (bool force)
+            {
+                uint64_t allocs = free_pool.get_allocs ();
+
+                if (last_allocs.exchange (allocs) != allocs && !force) {
+                    /*
+                     * The pool has been used since the last check.
+                     */
+                    return 0;
+                }
+
+                /*
+                 * What the magazines hold is reclaimed by the next trim.
+                 */
+                free_pool.flush ();
+
+                uint32_t freed = 0;
+                plbuff * pb = NULL;
+
+                while (total.load () > COUNT && free_pool.reclaim (pb)) {
+                    if (pb->get_mapped ()) {
+                        huge.fetch_sub (1);
+                    }
+                    if (pb->get_locked ()) {
+                        locked.fetch_sub (1);
+                    }
+
+                    free (fops.free, pb);
+                    total.fetch_sub (1);
+                    freed++;
                 }
+
+                if (freed) {
+                    next_alloc_size.store (COUNT);
+                    governor->release ((uint64_t) freed * SIZE);
+                }
+
+                return ((uint64_t) freed * SIZE);
             }
 
             boost::shared_ptr <plbuff> make_shared (void)
             {
-                plbuff * pb;
+                plbuff * pb = NULL;
 
-                if (!free_pool.pop (pb)) {
+                if (!free_pool.alloc (pb)) {
                     expand();
-                    free_pool.pop (pb);
-                }
-
-                if (pb) {
-                   active.fetch_add (1);
+                    free_pool.alloc (pb);
                 }
 
                 return boost::shared_ptr <plbuff> (pb, 
@@ -558,27 +1576,30 @@ namespace openarchive
                     return;   
                 } 
    
-                if (!free_pool.push (pb)) {
-                    /*
-                     * Failed to add back to queue. Better discard it.
-                     */
-                    free (pb);
-                    total.fetch_sub (1);
-                    return;
-                }
-
-                active.fetch_sub (1);
+                free_pool.release (pb, pb->get_node ());
                 return; 
             }
 
-            void free (plbuff *pb)
+            /*
+             * Free a buffer along with its backing memory. This is static
+             * since buffers cached in per thread magazines may be freed 
+             * after the pool itself has been destroyed.
+             */
+            static void free (libmalloc_free_t fn, plbuff *pb)
             {
                 if (pb) {
                     void * ptr = pb->get_base();   
                     if (ptr) {
-                        fops.free (ptr);
+                        if (pb->get_mapped ()) {
+                            munmap (ptr, pb->get_size ());
+                        } else {
+                            if (pb->get_locked ()) {
+                                munlock (ptr, pb->get_size ());
+                            }
+                            fn (ptr);
+                        }
                     }
-                    fops.free (pb);
+                    fn (pb);
                 } 
 
                 return; 
@@ -594,11 +1615,14 @@ namespace openarchive
                 stat = " name: " + 
                        name +
                        " next_alloc_size: " + 
-                       boost::lexical_cast <std::string> (next_alloc_size) +
-                       " active: " +
-                       boost::lexical_cast <std::string> (active.load ()) +  
+                       boost::lexical_cast <std::string> (next_alloc_size.load ()) +
+                       free_pool.getstats () +
                        " total: " +
-                       boost::lexical_cast <std::string> (total.load ());
+                       boost::lexical_cast <std::string> (total.load ()) +
+                       " huge page: " +
+                       boost::lexical_cast <std::string> (huge.load ()) +
+                       " locked: " +
+                       boost::lexical_cast <std::string> (locked.load ());
                 return;
             }
             
@@ -612,6 +1636,7 @@ namespace openarchive
     typedef boost::shared_ptr<buff_t>           buff_ptr_t; 
     typedef openarchive::arch_mem::plbuff       plbuff_t;
     typedef boost::shared_ptr <plbuff_t>        plbuff_ptr_t; 
+    typedef openarchive::arch_mem::buff_slice   buff_slice_t;
 
 } /*namespace openarchive */
 
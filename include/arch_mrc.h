@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __ARCH_MRC_H__
+#define __ARCH_MRC_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/lockfree/queue.hpp>
+
+namespace openarchive
+{
+    namespace arch_mrc
+    {
+        /*
+         * Miss ratio curve of an LRU cache, estimated from a sample of
+         * the access stream as done by SHARDS. A key is sampled if its
+         * hash falls below a threshold, so that all the accesses to a
+         * sampled key are seen. The reuse distances measured among the
+         * sampled keys are scaled up by the sampling rate.
+         *
+         * The number of sampled keys is bounded. When the bound is hit
+         * the threshold is lowered to drop the keys with the largest
+         * hashes, which lowers the sampling rate of the rest of the
+         * stream.
+         *
+         * Keys outside the sample cost a hash and a compare. Sampled keys
+         * are queued without a lock, the queue is drained by whoever gets
+         * the lock of the sampler without waiting for it, and by getstats
+         * from the profiler thread. Keys which find the queue full are
+         * dropped and counted.
+         */
+        const uint32_t mrc_modulus  = 1 << 24;
+        const uint32_t mrc_max_keys = 8192;
+        const uint32_t mrc_buckets  = 40;   /* Distances up to 2^39 */
+        const uint32_t mrc_queue_len = 4096;
+
+        class mrc_sampler
+        {
+            std::atomic<uint32_t> threshold;
+            std::atomic<uint64_t> dropped;
+            boost::lockfree::queue <uint64_t,
+                   boost::lockfree::capacity <mrc_queue_len>> pending;
+            std::mutex lock;
+
+            /*
+             * Time of the last access of each sampled key, and the keys
+             * ordered by their sampling value.
+             */
+            std::unordered_map <uint64_t, uint32_t> last;
+            std::set <std::pair <uint32_t, uint64_t>> order;
+
+            /*
+             * Fenwick tree with a mark at the time of the last access of
+             * each key, the reuse distance of a key is the number of marks
+             * after its own. Times are renumbered when the tree is full.
+             */
+            std::vector <uint32_t> tree;
+            uint32_t now;
+
+            uint64_t refs;                  /* Accesses sampled          */
+            uint64_t hist[mrc_buckets];     /* Reuse distances, log2     */
+
+            private:
+            void mark (uint32_t, int32_t);
+            uint32_t count (uint32_t);
+            void compact (void);
+            void shrink (void);
+            void record (uint64_t);
+            void drain (void);
+
+            public:
+            /*
+             * Sample one in rate keys, 0 disables the sampler.
+             */
+            mrc_sampler (uint32_t);
+
+            void access (uint64_t);
+
+            /*
+             * Miss ratio of LRU caches of 1, 2, 4, ... entries, up to the
+             * largest reuse distance seen.
+             */
+            void get_curve (std::vector <std::pair <uint64_t, double>> &);
+
+            void getstats (std::string &);
+        };
+    } /* namespace arch_mrc */
+} /* namespace openarchive */
+
+#endif /* End of __ARCH_MRC_H__ */
@@ -0,0 +1,61 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __ARCH_NUMA_H__
+#define __ARCH_NUMA_H__
+
+#include <vector>
+#include <string>
+#include <cfgparams.h>
+
+namespace openarchive
+{
+    namespace arch_numa
+    {
+        /*
+         * NUMA topology of the machine as seen through sysfs. When NUMA
+         * awareness is disabled in the config file, or the machine has a
+         * single node, all the CPUs are reported as belonging to node 0
+         * and the rest of the code behaves exactly as on a UMA machine.
+         *
+         * Worker threads are pinned to the CPUs of a node and remember
+         * their node, the memory pools use the node of the calling thread
+         * to pick the free list to allocate from. Pages are placed by the
+         * kernel on first touch, so memory filled by a pinned thread ends
+         * up on the node of that thread.
+         */
+
+        /*
+         * Read the topology according to the config file. Called once the
+         * config file has been parsed and before the worker threads are
+         * created. Pools created earlier keep everything on node 0.
+         */
+        void init (void);
+
+        uint32_t get_num_nodes (void);
+
+        /*
+         * Node of the calling thread. Threads which were not pinned are
+         * mapped through the CPU they are currently running on.
+         */
+        uint32_t get_current_node (void);
+
+        const std::vector<uint32_t> & get_node_cpus (uint32_t);
+
+        /*
+         * Pin the calling thread to the CPUs of the given node. Returns
+         * false if the thread could not be pinned.
+         */
+        bool bind_thread (uint32_t);
+
+    } /* namespace arch_numa */
+} /* namespace openarchive */
+
+#endif /* End of __ARCH_NUMA_H__ */
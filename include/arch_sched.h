@@ -0,0 +1,166 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __ARCH_SCHED_H__
+#define __ARCH_SCHED_H__
+
+#include <list>
+#include <queue>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+#include <arch_core.h>
+#include <iopx_reqpx.h>
+#include <cfgparams.h>
+#include <logger.h>
+
+namespace openarchive
+{
+    namespace arch_sched
+    {
+        typedef boost::function<void (void)> sched_task_t;
+
+        /*
+         * A work item and the handler run in its place if the job is 
+         * cancelled before the work item gets to run.
+         */
+        struct sched_item
+        {
+            sched_task_t task;
+            sched_task_t on_cancel;
+        };
+
+        /*
+         * A job is the unit of fairness. Every data management operation
+         * (backup, archive, restore) registers a job with the scheduler and
+         * submits its work items through it instead of posting them
+         * directly to the ioservice.
+         */
+        class sched_job
+        {
+            friend class arch_sched;
+
+            std::string name;
+            uint32_t weight;          /* Work items granted per round       */
+            uint32_t max_inflight;    /* Max work items running at a time   */
+            uint32_t deficit;         /* Unused quantum of the current round*/
+            uint32_t inflight;        /* Work items currently running       */
+            bool active;              /* Job is part of the active list     */
+            uint64_t dispatched;      /* Total work items dispatched        */
+            std::queue <sched_item> tasks;
+
+            /*
+             * Set when the job is cancelled. The requests allocated by the
+             * work items of the job share the flag, so that the requests 
+             * in flight give up as well.
+             */
+            openarchive::arch_core::cancel_flag_t cancelled;
+
+            public:
+            sched_job (std::string jname, uint32_t jweight, uint32_t jmax):
+                       name (jname), weight (jweight? jweight: 1),
+                       max_inflight (jmax), deficit (0), inflight (0),
+                       active (false), dispatched (0),
+                       cancelled (boost::make_shared<std::atomic<bool>> (false))
+            {
+            }
+
+            std::string get_name (void) { return name; }
+            bool get_cancelled (void)   { return cancelled->load (); }
+        };
+
+        typedef boost::shared_ptr <sched_job> sched_job_ptr_t;
+
+        /*
+         * arch_sched sits in front of an ioservice and hands out the
+         * worker threads to the registered jobs using deficit round robin.
+         * At most "window" work items are outstanding on the ioservice at
+         * any point of time, so a job which has queued a large number of
+         * work items cannot starve the jobs which were submitted later.
+         * Every job receives a quantum proportional to its weight in each
+         * round and can never have more than its max_inflight work items
+         * running at a time.
+         */
+        class arch_sched
+        {
+            std::string name;
+            io_service_ptr_t iosvc;
+            uint32_t window;          /* Max work items on the ioservice    */
+            uint32_t inflight;        /* Work items currently running       */
+            std::list <sched_job_ptr_t> active;
+            std::list <boost::weak_ptr <sched_job>> jobs; /* All the jobs  */
+            openarchive::arch_core::quiesce pending; /* Queued and running */
+            src::severity_logger<int> log;
+            int32_t log_level;
+
+            /*
+             * Spinlock for safegaurding the active list and job queues
+             */
+            openarchive::arch_core::spinlock lock;
+
+            private:
+            void dispatch (void);
+            void run (sched_job_ptr_t, sched_item);
+            void complete (sched_job_ptr_t);
+            void drop (sched_job_ptr_t, std::queue <sched_item> &);
+
+            public:
+            arch_sched (std::string, io_service_ptr_t, uint32_t);
+            ~arch_sched (void);
+
+            /*
+             * Register a new job with the scheduler
+             * arg1  name of the job used while logging
+             * arg2  weight of the job
+             * arg3  max work items of the job that can run concurrently,
+             *       0 implies no limit other than the scheduler window
+             */
+            sched_job_ptr_t add_job (std::string, uint32_t, uint32_t);
+
+            /*
+             * Queue a work item for a job. The work item is posted to the
+             * ioservice once the job gets its turn. The optional second 
+             * handler is run instead of the work item if the work item is
+             * dropped by a cancel.
+             */
+            std::error_code submit (sched_job_ptr_t, sched_task_t,
+                                    sched_task_t = sched_task_t ());
+
+            /*
+             * Cancel a job. The queued work items of the job are dropped 
+             * and the requests of its running work items fail with
+             * ECANCELED. Returns the number of jobs cancelled.
+             */
+            void cancel_job (sched_job_ptr_t);
+            uint32_t cancel_job (const std::string &);
+
+            /*
+             * Wait until all the work items submitted so far have run, at
+             * most for the given time. Returns false on a timeout.
+             */
+            bool drain (std::chrono::milliseconds);
+
+            /*
+             * Drop the work items which have not been posted to the 
+             * ioservice yet.
+             */
+            void cancel (void);
+
+            void profile (void);
+        };
+    } /* namespace arch_sched */
+
+    typedef openarchive::arch_sched::arch_sched      arch_sched_t;
+    typedef boost::shared_ptr <arch_sched_t>         arch_sched_ptr_t;
+    typedef openarchive::arch_sched::sched_job_ptr_t sched_job_ptr_t;
+
+} /* namespace openarchive */
+#endif
@@ -16,6 +16,7 @@
 #include <arch_mem.hpp>
 #include <logger.h>
 #include <arch_core.h>
+#include <cfgparams.h>
 #include <mem_cache.h>
 #include <cvlt_iopx.h>
 
@@ -38,15 +39,27 @@ namespace openarchive
             cvlt_stream_ptr_t cvstream;
 
             public:
-            boost::shared_ptr <file_t> alloc_arch_file (void)
+            file_ptr_t alloc_arch_file (void)
             {
-                boost::shared_ptr <file_t> fp = file_pool.make_shared ();
+                file_ptr_t fp = file_pool.make_intrusive ();
                 return fp;
             }
   
-            boost::shared_ptr <req_t>  alloc_iopx_req  (void)
+            req_ptr_t  alloc_iopx_req  (void)
             {
-                boost::shared_ptr <req_t> req = req_pool.make_shared ();
+                req_ptr_t req = req_pool.make_intrusive ();
+
+                if (req) {
+                    /*
+                     * Requests inherit the deadline and the cancel flag of 
+                     * the job work item the thread is running.
+                     */
+                    req->set_timeout (
+                            openarchive::cfgparams::get_request_timeout ());
+                    req->set_cancel_flag (
+                            openarchive::arch_core::current_cancel_flag ());
+                }
+
                 return req;
             }
 
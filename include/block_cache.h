@@ -0,0 +1,154 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+#include <arch_core.h>
+#include <arch_loc.h>
+#include <arch_mem.hpp>
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        const uint32_t block_size      = 0x400000; /* Block size of 4MB    */
+        const uint32_t num_block_alloc = 32;
+        const uint32_t num_block_shards = 16;
+
+        /*
+         * The version of the file changes when it is rewritten under the
+         * same uuid, the blocks of an older version are no longer found
+         * and age out of the cache.
+         */
+        struct block_key
+        {
+            uuid_key_t uid;
+            uint64_t version;
+            uint64_t offset;
+
+            bool operator== (const block_key &key) const
+            {
+                return (offset == key.offset && version == key.version &&
+                        uid == key.uid);
+            }
+        };
+
+        struct block_hash
+        {
+            size_t operator() (const block_key &key) const
+            {
+                return (uuid_hash_t () (key.uid) ^ key.version ^
+                        ((key.offset / block_size) * 0x9E3779B97F4A7C15ULL));
+            }
+        };
+
+        /*
+         * Process wide cache of the file blocks read by the fd-caches of
+         * all the trees, keyed by the uuid and version of the file and the
+         * offset of the block. The blocks are charged at their full buffer size
+         * against a byte budget and recycled with a clock once the budget
+         * has been used up. The cache is split in shards, each with its
+         * own lock and an even share of the budget.
+         *
+         * The cache owns the pool the read buffers of the fd-caches are
+         * allocated from, so that cached blocks outlive the fd-cache which
+         * read them. The offset and bytes of a buffer are set before it is
+         * inserted and the fd-caches never modify a cached buffer, a lookup
+         * hands out a reference which stays valid after the block is
+         * evicted.
+         */
+        class block_cache: public openarchive::arch_mem::mem_client
+        {
+            struct entry
+            {
+                plbuff_ptr_t plbuff;
+                bool ref;                 /* Used since the hand passed  */
+            };
+
+            typedef std::unordered_map <block_key, entry, block_hash> index_t;
+
+            struct shard
+            {
+                std::mutex lock;
+                index_t index;
+                std::deque <block_key> ring; /* Clock, hand at the front */
+                uint64_t used;            /* Bytes charged to the shard  */
+            };
+
+            uint64_t budget;              /* Bytes, 0 disables the cache */
+            uint64_t shard_budget;
+            std::unique_ptr <shard []> shards;
+            openarchive::arch_mem::plbpool <block_size, num_block_alloc> pool;
+            boost::shared_ptr<openarchive::arch_mem::mem_governor> governor;
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+            std::atomic<uint64_t> inserts;
+            std::atomic<uint64_t> evictions;
+
+            private:
+            shard & get_shard (const block_key &key)
+            {
+                return shards[block_hash () (key) % num_block_shards];
+            }
+
+            /*
+             * Evict blocks until the shard uses no more than the given
+             * number of bytes. Called with the shard lock held, returns
+             * the number of bytes evicted.
+             */
+            uint64_t evict (shard &, uint64_t);
+
+            public:
+            block_cache (uint64_t);
+            ~block_cache (void);
+
+            /*
+             * Buffer for reading a block, from the pool of the cache.
+             */
+            plbuff_ptr_t alloc (void)       { return pool.make_shared (); }
+
+            /*
+             * Cached block of the given version of the file at the given
+             * block offset, with its offset and bytes set. Empty on a miss.
+             */
+            plbuff_ptr_t lookup (const uuid_key_t &, uint64_t, uint64_t);
+            bool contains (const uuid_key_t &, uint64_t, uint64_t);
+
+            /*
+             * Cache a block of the given version of the file, just read
+             * into a buffer from alloc. The offset and bytes of the buffer
+             * must be set.
+             */
+            void insert (const uuid_key_t &, uint64_t, plbuff_ptr_t);
+
+            /*
+             * Under memory pressure the governor gets half of the budget
+             * back. The evicted buffers go back to the pool, which frees
+             * them when it is trimmed in turn.
+             */
+            virtual uint64_t trim (bool);
+
+            void getstats (std::string &);
+        };
+
+        typedef boost::shared_ptr <block_cache> block_cache_ptr_t;
+        block_cache_ptr_t get_block_cache (void);
+    }
+}
+
+#endif /* End of __BLOCK_CACHE_H__ */
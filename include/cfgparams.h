@@ -29,7 +29,32 @@ namespace openarchive
         int32_t     get_log_level       (void);
         bool        create_fast_threads (void);
         bool        create_slow_threads (void);
+        bool        numa_aware          (void);
+        bool        plbuff_huge_pages   (void);
+        bool        plbuff_mlock        (void);
+        uint32_t    plbuff_prealloc     (void);
+        uint64_t    get_mem_budget      (void);
+        uint32_t    get_mem_budget_wait (void);
+        std::string get_allocator       (void);
+        bool        malloc_arenas       (void);
+        std::string get_copy_kernel     (void);
+        uint32_t    get_lock_profiling  (void);
+        std::string get_fdcache_policy  (void);
+        uint32_t    get_fdcache_ra_window (void);
+        bool        fdcache_ra_direct   (void);
+        uint64_t    get_block_cache_size (void);
+        std::string get_l2_cache_dir    (void);
+        uint64_t    get_l2_cache_size   (void);
+        uint32_t    get_mrc_sampling    (void);
+        uint64_t    get_wb_cache_size   (void);
+        uint32_t    get_meta_l1_entries (void);
+        std::chrono::milliseconds get_shutdown_timeout (void);
+        std::chrono::milliseconds get_request_timeout  (void);
+        std::chrono::milliseconds get_wb_flush_interval (void);
+        std::chrono::milliseconds get_meta_l1_ttl       (void);
         uint64_t    get_num_work_items  (arch_op_type);
+        uint32_t    get_job_weight      (arch_op_type);
+        uint32_t    get_job_max_inflight (arch_op_type, uint32_t);
         bool        extent_based_backups (arch_loc_t &); 
     } /* namespace cfgparams */  
 } /* namespace openarchive */
@@ -16,6 +16,7 @@
 #endif
 #include <endian.h>
 #include <climits>
+#include <mutex>
 #include <arch_core.h>
 #include <arch_mem.hpp>
 #include <arch_iopx.h>
@@ -50,6 +51,14 @@ namespace openarchive
             cvlt_stream * stream;
             bool async_io;      
             openarchive::arch_core::semaphore sem;
+
+            /*
+             * A synchronous reader which runs past the deadline of its
+             * request marks the context abandoned and returns. The
+             * callbacks then drop the data and release the context.
+             */
+            std::mutex mtx;
+            bool abandoned;
         };
 
         const int num_cvlt_ctx_alloc = 32;
@@ -82,7 +91,7 @@ namespace openarchive
             std::atomic<uint64_t> seq;
             openarchive::arch_mem::objpool <cvlt_cbk_context,
                                             num_cvlt_ctx_alloc> ctx_pool;
-            openarchive::arch_core::mtmap<uint64_t, req_ptr_t> request_map;
+            openarchive::arch_core::mthashmap<uint64_t, req_ptr_t> request_map;
             uint32_t num_worker_threads;
 
             public:
@@ -93,52 +102,73 @@ namespace openarchive
             /*
              * File operations
              */
-            virtual std::error_code open              (file_ptr_t, req_ptr_t);
+            virtual std::error_code open              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code close             (file_ptr_t, req_ptr_t);
+            virtual std::error_code close             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             virtual std::error_code close             (file_t &);
 
-            virtual std::error_code pread             (file_ptr_t, req_ptr_t);
+            virtual std::error_code pread             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pwrite            (file_ptr_t, req_ptr_t);
+            virtual std::error_code pwrite            (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fstat             (file_ptr_t, req_ptr_t);
+            virtual std::error_code fstat             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code stat              (file_ptr_t, req_ptr_t);
+            virtual std::error_code stat              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code ftruncate         (file_ptr_t, req_ptr_t);
+            virtual std::error_code ftruncate         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code truncate          (file_ptr_t, req_ptr_t);
+            virtual std::error_code truncate          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fsetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fsetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code setxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code setxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fgetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fgetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code getxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fremovexattr      (file_ptr_t, req_ptr_t);
+            virtual std::error_code fremovexattr      (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code removexattr       (file_ptr_t, req_ptr_t);
+            virtual std::error_code removexattr       (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code lseek             (file_ptr_t, req_ptr_t);
+            virtual std::error_code lseek             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getuuid           (file_ptr_t, req_ptr_t);
+            virtual std::error_code getuuid           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code gethosts          (file_ptr_t, req_ptr_t);
+            virtual std::error_code gethosts          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             /*
              * File system operations
              */
-            virtual std::error_code mkdir             (file_ptr_t, req_ptr_t);
+            virtual std::error_code mkdir             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code resolve           (file_ptr_t, req_ptr_t);
+            virtual std::error_code resolve           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code dup               (file_ptr_t, file_ptr_t);
+            virtual std::error_code dup               (const file_ptr_t &,
+                                                       const file_ptr_t &);
 
-            virtual std::error_code scan              (file_ptr_t, req_ptr_t);
+            virtual std::error_code scan              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             virtual void profile (void);
 
@@ -160,7 +190,9 @@ namespace openarchive
                                           bool, cvlt_stream *);
             void release_ctx (cvlt_cbk_context *); 
             std::error_code receive_data (uint64_t, std::string &, char *,
-                                          size_t, off_t, bool, int64_t &);
+                                          size_t, off_t, const req_ptr_t &,
+                                          int64_t &);
+            std::error_code wait_data (cvlt_cbk_context *, const req_ptr_t &);
         };
 
         ssize_t cvmdserialize (struct cvmd &, char *, size_t);
@@ -126,12 +126,19 @@ namespace openarchive
              */
             volatile std::atomic<bool> done;
 
+            /*
+             * Wakes up the memory profiler thread when done is set.
+             */
+            std::mutex prof_mtx;
+            std::condition_variable prof_cv;
+
             private:
             void mem_prof (void);
             std::error_code run_cbk (file_ptr_t, int64_t, int32_t);
             void work_done_cbk (arch_store_cbk_info_ptr_t, dmstats_ptr_t,
                                 int32_t, int32_t);
             void log_tls_stats (void);
+            void log_lock_stats (void);
             void log_tls_info (void);
             void map_store_id (std::string &, std::string &, std::string &);
 
@@ -291,6 +298,15 @@ namespace openarchive
             std::error_code set_extent_size (uint64_t);  
             void log_memory_stats (void);
 
+            /*
+             * Cancel a running operation. The operation is identified by
+             * its collect file for backup and archive and by its source
+             * path for restore. The work items which have not started yet
+             * complete with ECANCELED and the requests of the running 
+             * ones fail with ECANCELED at their next check point.
+             */
+            std::error_code cancel_job (const std::string &);
+
             /*
              * Allocate a callback info object from the object pool. 
              * The object can be used for maintaining context in which 
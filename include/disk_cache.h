@@ -0,0 +1,216 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __DISK_CACHE_H__
+#define __DISK_CACHE_H__
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+#include <arch_core.h>
+#include <arch_loc.h>
+#include <arch_mem.hpp>
+#include <logger.h>
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        const uint32_t disk_block_magic  = 0x4f41424b; /* "OABK"           */
+        const uint32_t disk_block_format = 1;
+        const uint32_t disk_data_offset  = 4096;  /* Data follows header   */
+        const uint32_t disk_max_pending  = 16;    /* Blocks queued to write*/
+        const uint32_t disk_admit_misses = 2;     /* Misses before caching */
+
+        /*
+         * A block of a given version of an archived file. The version
+         * changes whenever the file changes on the store.
+         */
+        struct disk_key
+        {
+            uuid_key_t uid;
+            uint64_t offset;
+            uint64_t version;
+
+            bool operator== (const disk_key &key) const
+            {
+                return (offset == key.offset && version == key.version &&
+                        uid == key.uid);
+            }
+        };
+
+        struct disk_key_hash
+        {
+            size_t operator() (const disk_key &key) const
+            {
+                return (uuid_hash_t () (key.uid) ^
+                        (key.offset * 0x9E3779B97F4A7C15ULL) ^ key.version);
+            }
+        };
+
+        /*
+         * Header at the start of each block file.
+         */
+        struct disk_block_hdr
+        {
+            uint32_t magic;
+            uint32_t format;
+            uint8_t  uid[16];
+            uint64_t offset;
+            uint64_t version;
+            uint32_t bytes;
+            uint32_t crc;             /* crc32c of the data                */
+        };
+
+        /*
+         * Approximate count of the recent misses of each block, in 4 bit
+         * counters which are halved as the sketch fills up so that old
+         * misses fade away.
+         */
+        class freq_sketch
+        {
+            static const uint32_t rows  = 4;
+            static const uint32_t width = 8192;
+
+            std::vector <uint8_t> counters;
+            uint32_t additions;
+
+            uint32_t index (size_t, uint32_t);
+
+            public:
+            freq_sketch (void): counters (rows * width, 0), additions (0)
+            {
+            }
+
+            /*
+             * Count one more miss, returns the estimated number of misses
+             * including this one.
+             */
+            uint32_t add (size_t);
+        };
+
+        /*
+         * Second level cache of the fd-cache blocks on a local directory,
+         * meant to be on an SSD. Each block is a file of its own, holding
+         * a header with the key and a checksum followed by the data. The
+         * index is kept in memory and rebuilt from the headers of the
+         * files at startup.
+         *
+         * Blocks are written by a thread of the cache to a temporary file
+         * which is renamed once complete, a crash leaves either no file
+         * or a complete one. Data which did not make it to the disk
+         * before a crash fails its checksum when read and is dropped.
+         *
+         * Only blocks which have missed disk_admit_misses times recently
+         * are admitted, a single scan of cold data does not wipe the
+         * cache. Blocks are recycled with a clock once the byte cap has
+         * been reached.
+         */
+        class disk_cache
+        {
+            typedef std::list <disk_key> ring_t;
+
+            struct entry
+            {
+                uint32_t bytes;
+                bool ref;                 /* Used since the hand passed  */
+                ring_t::iterator pos;     /* Place of the block in ring  */
+            };
+
+            struct pending
+            {
+                disk_key key;
+                plbuff_ptr_t plbuff;
+            };
+
+            typedef std::unordered_map <disk_key, entry, disk_key_hash> index_t;
+
+            std::string dir;
+            uint64_t budget;
+            src::severity_logger<int> log;
+            int32_t log_level;
+
+            std::mutex lock;              /* Protects the index and sketch */
+            index_t index;
+            ring_t ring;                  /* Clock, hand at the front      */
+            uint64_t used;                /* Bytes of the block files      */
+            freq_sketch sketch;
+
+            std::mutex wr_lock;
+            std::condition_variable wr_cv;
+            std::deque <pending> queue;
+            bool stop;
+            std::thread writer;
+
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+            std::atomic<uint64_t> admits;
+            std::atomic<uint64_t> rejects;
+            std::atomic<uint64_t> evictions;
+            std::atomic<uint64_t> corrupt;
+
+            private:
+            std::string get_path (const disk_key &);
+            void recover (void);
+            void write_loop (void);
+            bool write_block (const pending &);
+            void drop (const disk_key &);
+
+            /*
+             * Add a block to the index and the ring, called with the lock
+             * held. Returns false if the block is already there.
+             */
+            bool insert (const disk_key &, uint32_t);
+
+            /*
+             * Evict blocks until the files fit in the cap, called with the
+             * lock held. The files to unlink are added to the list.
+             */
+            void evict (std::vector <disk_key> &);
+
+            public:
+            disk_cache (std::string, uint64_t);
+            ~disk_cache (void);
+
+            /*
+             * Read a cached block into the buffer. Returns false on a miss
+             * or if the block file fails the checks.
+             */
+            bool read (const disk_key &, plbuff_ptr_t, uint32_t &);
+
+            /*
+             * Offer a block just read from the store. It is written in the
+             * background if it passes the admission filter.
+             */
+            void admit (const disk_key &, plbuff_ptr_t);
+
+            void getstats (std::string &);
+        };
+
+        typedef boost::shared_ptr <disk_cache> disk_cache_ptr_t;
+
+        /*
+         * The cache configured through l2_cache_dir, empty if there is
+         * none.
+         */
+        disk_cache_ptr_t get_disk_cache (void);
+
+        uint32_t crc32c (const void *, size_t);
+    }
+}
+
+#endif /* End of __DISK_CACHE_H__ */
@@ -12,14 +12,20 @@
 #define __FDCACHE_IOPX_H__
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <arch_core.h>
 #include <arch_iopx.h>
 #include <arch_engine.h>
 #include <arch_mem.hpp>
 #include <data_mgmt.h>
 #include <cfgparams.h>
+#include <fdcache_policy.h>
+#include <block_cache.h>
+#include <disk_cache.h>
+#include <arch_mrc.h>
 
 namespace openarchive
 {
@@ -27,10 +33,12 @@ namespace openarchive
     {
         const uint32_t num_file_alloc = 32;
         const uint32_t num_req_alloc  = 32;
-        const uint32_t num_plain_buff = 32;
-        const uint32_t ra_buff_size   = 0x400000; /* Buffer size of 4MB     */
+        const uint32_t ra_buff_size   = block_size; /* Buffer size of 4MB   */
         const uint64_t ra_bit_mask    = ~(0x3FFFFFUL);
         const uint32_t ra_bit_width   = 22;       /* 4MB == 22bits width    */
+        const uint32_t ra_seq_trigger = 2;        /* Reads before prefetch  */
+        const uint32_t ra_rand_trigger = 2;       /* Reads before direct io */
+        const uint32_t ra_min_window  = 2;        /* Initial prefetch window*/
 
         struct map_entry
         {
@@ -51,6 +59,46 @@ namespace openarchive
             plbuff_ptr_t plbuff;
         };
 
+        /*
+         * Buffer filled ahead of a sequential reader.
+         */
+        struct pf_buf
+        {
+            bool valid;
+            bool in_flight;
+            uint64_t offset;
+            uint32_t bytes;
+            plbuff_ptr_t plbuff;
+        };
+
+        /*
+         * Access pattern of the readers of a slot and the buffers read
+         * ahead of them. Protected by ra_mtx, which nests inside fdlock.
+         */
+        struct ra_state
+        {
+            uint64_t gen;           /* Bumped when the slot is recycled  */
+            uint64_t next_offset;   /* Next offset of a sequential reader */
+            uint32_t seq_run;       /* Sequential reads in a row         */
+            uint32_t rand_run;      /* Random reads in a row             */
+            uint32_t window;        /* Buffers to keep ahead, 0 for none */
+            uint32_t inflight;      /* Prefetch reads in progress        */
+            std::vector <pf_buf> pf;
+        };
+
+        /*
+         * Read-ahead buffer of a slot as seen by the lock free hit path.
+         * A snapshot is never modified once published, a change of the
+         * buffer publishes a new one and retires the old one.
+         */
+        struct ra_snapshot
+        {
+            uuid_key_t uid;
+            uint64_t offset;
+            uint32_t bytes;
+            plbuff_ptr_t plbuff;
+        };
+
         struct vec_entry
         {
             bool valid;
@@ -59,6 +107,10 @@ namespace openarchive
             boost::shared_ptr <std::mutex> op_mtx; 
             file_ptr_t fp;
             struct ra_buf rabuff;
+            boost::shared_ptr <std::mutex> ra_mtx;
+            boost::shared_ptr <std::condition_variable> ra_cv;
+            struct ra_state ra;
+            boost::shared_ptr <std::atomic<ra_snapshot *>> snap;
         };
 
         struct rqmap_entry
@@ -79,7 +131,16 @@ namespace openarchive
             * handled this way.
             */     
 
-            std::map <std::string, map_entry> uuid_map;
+            /*
+             * The map nodes are allocated through the configured memory 
+             * manager like the rest of the buffers of the iopx.
+             */
+            typedef std::unordered_map <uuid_key_t, map_entry, uuid_hash_t,
+                                std::equal_to<uuid_key_t>,
+                                openarchive::arch_mem::intfx_allocator<
+                                std::pair<const uuid_key_t, map_entry>>> 
+                                uuid_map_t;
+            uuid_map_t uuid_map;
             std::vector <vec_entry> fd_queue;
             src::severity_logger<int> log; 
             int32_t log_level;
@@ -89,7 +150,10 @@ namespace openarchive
              */
             rwlock_t fdlock;
 
-            std::map <std::string, rqmap_entry> request_map;
+            typedef std::map <uuid_key_t, rqmap_entry, std::less<uuid_key_t>,
+                      openarchive::arch_mem::intfx_allocator<
+                      std::pair<const uuid_key_t, rqmap_entry>>> request_map_t;
+            request_map_t request_map;
 
             /*
              * Spinlock for safegaurding access to request map
@@ -101,22 +165,49 @@ namespace openarchive
              */
             uint32_t capacity; 
 
-            /* 
-             * Slot where the next element will be added   
+            /*
+             * Slots which have never been used. Once they are all in use
+             * the replacement policy picks the slot to be recycled.
+             */
+            std::vector <uint32_t> free_slots;
+            repl_policy_ptr_t policy;
+
+            /*
+             * Read-ahead tuning of the tree: the max number of buffers
+             * prefetched ahead of a sequential reader, 0 to disable the
+             * prefetch, and whether random readers bypass the buffers.
              */
-            uint32_t front; 
-
-            /* 
-             * Slot from which the next element will be removed.
-             * This will come in to play once all the slots are 
-             * filled in the circular buffer.
-             */ 
-            uint32_t rear; 
+            uint32_t ra_max_window;
+            bool ra_direct;
+
+            /*
+             * Blocks read by a private fd-cache stay in its read-ahead
+             * buffers, they are neither looked up in nor added to the
+             * block and disk caches.
+             */
+            bool shared;
             
             openarchive::arch_mem::objpool <file_t, num_file_alloc> file_pool; 
             openarchive::arch_mem::objpool <req_t,  num_req_alloc>  req_pool; 
-            openarchive::arch_mem::plbpool <ra_buff_size, 
-                                            num_plain_buff> buff_pool;
+
+            /*
+             * Blocks read by the fd-caches of all the trees. The read-ahead
+             * buffers are allocated from its pool.
+             */
+            block_cache_ptr_t blocks;
+
+            /*
+             * Blocks kept on local disk across restarts, if configured.
+             */
+            disk_cache_ptr_t disk;
+
+            /*
+             * Miss ratio curves of the open files, against fd_cache_size,
+             * and of the 4MB blocks read, against the memory given to the
+             * read-ahead and block caches.
+             */
+            openarchive::arch_mrc::mrc_sampler file_mrc;
+            openarchive::arch_mrc::mrc_sampler block_mrc;
 
             private:
             std::error_code get_fd (file_ptr_t);
@@ -127,15 +218,33 @@ namespace openarchive
                                        uint32_t,bool);
             plbuff_ptr_t getbuff (file_ptr_t, req_ptr_t, int32_t &);
             plbuff_ptr_t checkbuff (file_ptr_t, req_ptr_t, bool&);
-            std::error_code readdata_async (std::string &, file_ptr_t, 
+            bool fastbuff (file_ptr_t, req_ptr_t);
+            void publish (struct vec_entry &);
+            std::error_code readdata_async (const uuid_key_t &, file_ptr_t, 
                                             req_ptr_t, req_ptr_t, int32_t, 
                                             bool &);
-            std::error_code readdata_sync (std::string &, file_ptr_t, 
+            std::error_code readdata_sync (const uuid_key_t &, file_ptr_t, 
                                            req_ptr_t, req_ptr_t, int32_t,
                                            bool &);
             std::error_code readdata (file_ptr_t, req_ptr_t, int32_t, bool&);
             std::error_code processbuff (plbuff_ptr_t, file_ptr_t,
                                          req_ptr_t);
+            std::error_code readthrough (file_ptr_t, req_ptr_t);
+            bool observe (file_ptr_t, req_ptr_t);
+            plbuff_ptr_t takebuff (file_ptr_t, req_ptr_t);
+            plbuff_ptr_t sharedbuff (file_ptr_t, req_ptr_t);
+            void install (struct vec_entry &, const uuid_key_t &,
+                          plbuff_ptr_t);
+            void set_file_version (file_ptr_t, req_ptr_t);
+            bool get_version (file_ptr_t, uint64_t &);
+            bool get_disk_key (file_ptr_t, uint64_t, disk_key &);
+            bool read_disk (file_ptr_t, req_ptr_t, plbuff_ptr_t);
+            void read_disk_done (file_ptr_t, req_ptr_t);
+            void admit_disk (file_ptr_t, req_ptr_t, plbuff_ptr_t);
+            std::error_code fetch (file_ptr_t, req_ptr_t, plbuff_ptr_t);
+            void prefetch (file_ptr_t, req_ptr_t);
+            void prefetch_read (file_ptr_t, uint32_t, uint32_t, uint64_t);
+            void reset_ra_state (struct vec_entry &);
 
             inline void init_ra_buf (struct ra_buf &);
             inline void init_vec_entry (struct vec_entry &);
@@ -144,17 +253,23 @@ namespace openarchive
             inline void reserve_ra_buf (struct ra_buf &);
             inline void mark_ra_buf_ready (struct ra_buf &);
             inline bool is_validslot (req_ptr_t, uint32_t);
-            std::error_code add_gen_req (std::string &, uint32_t slot,req_ptr_t,
+            bool is_evictable (uint32_t);
+            std::error_code add_gen_req (const uuid_key_t &, uint32_t slot,
+                                         req_ptr_t,
                                          plbuff_ptr_t, req_ptr_t); 
-            std::error_code add_parent_req (std::string &, req_ptr_t);
-            std::error_code del_req (std::string &);
+            std::error_code add_parent_req (const uuid_key_t &, req_ptr_t);
+            std::error_code del_req (const uuid_key_t &);
 
             public:
-            fdcache_iopx (std::string, io_service_ptr_t, uint32_t);
+            fdcache_iopx (std::string, io_service_ptr_t, uint32_t,
+                          uint32_t, bool, bool);
             ~fdcache_iopx (void);
-            virtual std::error_code open (file_ptr_t, req_ptr_t);
-            virtual std::error_code pread (file_ptr_t, req_ptr_t);
-            virtual std::error_code pread_cbk (file_ptr_t, req_ptr_t,
+            virtual std::error_code open (const file_ptr_t &,
+                                          const req_ptr_t &);
+            virtual std::error_code pread (const file_ptr_t &,
+                                           const req_ptr_t &);
+            virtual std::error_code pread_cbk (const file_ptr_t &,
+                                               const req_ptr_t &,
                                                std::error_code);
             virtual void profile (void);
             
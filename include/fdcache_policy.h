@@ -0,0 +1,239 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __FDCACHE_POLICY_H__
+#define __FDCACHE_POLICY_H__
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <arch_loc.h>
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        /*
+         * Keys of the files recently evicted from the cache, oldest first.
+         * A miss on a key found here tells the policy that the file was
+         * evicted too early.
+         */
+        class ghost_list
+        {
+            typedef std::list <uuid_key_t> order_t;
+
+            typedef std::unordered_map <uuid_key_t, order_t::iterator,
+                                        uuid_hash_t> index_t;
+
+            order_t order;
+            index_t index;
+
+            public:
+            size_t size (void)                 { return order.size ();     }
+
+            void push (const uuid_key_t &key)
+            {
+                order.push_back (key);
+                index[key] = --order.end ();
+            }
+
+            bool remove (const uuid_key_t &key)
+            {
+                index_t::iterator it = index.find (key);
+                if (it == index.end ()) {
+                    return false;
+                }
+
+                order.erase (it->second);
+                index.erase (it);
+                return true;
+            }
+
+            void pop_oldest (void)
+            {
+                if (!order.empty ()) {
+                    index.erase (order.front ());
+                    order.pop_front ();
+                }
+            }
+        };
+
+        /*
+         * Slots in a circular list with the clock hand at the front.
+         */
+        class slot_clock
+        {
+            std::deque <uint32_t> ring;
+
+            public:
+            size_t size (void)                 { return ring.size ();      }
+            bool empty (void)                  { return ring.empty ();     }
+            uint32_t hand (void)               { return ring.front ();     }
+            void push (uint32_t slot)          { ring.push_back (slot);    }
+            void pop (void)                    { ring.pop_front ();        }
+
+            /*
+             * Move the slot under the hand behind the others.
+             */
+            void advance (void)
+            {
+                ring.push_back (ring.front ());
+                ring.pop_front ();
+            }
+        };
+
+        /*
+         * Replacement policy of the fd-cache. The policy decides which of
+         * the cache slots is recycled when a file is opened and all the
+         * slots are in use.
+         *
+         * A lookup hit only sets the reference bit of the slot, so that
+         * hits can be recorded with the fd-cache lock held shared. The
+         * bits are consumed by the clock sweeps in victim. getstats only
+         * needs the fd-cache lock held shared, the other methods must be
+         * called with it held exclusive.
+         */
+        class repl_policy
+        {
+            protected:
+            uint32_t capacity;
+            std::unique_ptr <std::atomic<bool> []> ref;
+            std::vector <uuid_key_t> keys;    /* File held by each slot     */
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+            std::atomic<uint64_t> ghost_hits; /* Misses found in the ghosts */
+            std::atomic<uint64_t> evictions;
+
+            bool test_and_clear (uint32_t slot)
+            {
+                return ref[slot].exchange (false, std::memory_order_relaxed);
+            }
+
+            public:
+            typedef boost::function<bool (uint32_t)> evictable_t;
+
+            repl_policy (uint32_t);
+            virtual ~repl_policy (void) {}
+
+            void hit (uint32_t slot)
+            {
+                touch (slot);
+                hits.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            /*
+             * Record a use of the slot which is not a lookup, such as a
+             * read served from its read-ahead buffer. The bit is tested
+             * first so that readers of a hot slot do not keep stealing
+             * its cache line from each other.
+             */
+            void touch (uint32_t slot)
+            {
+                if (!ref[slot].load (std::memory_order_relaxed)) {
+                    ref[slot].store (true, std::memory_order_relaxed);
+                }
+            }
+
+            /*
+             * Pick a slot to recycle among the slots for which the
+             * predicate returns true. The slot is dropped from the policy.
+             * Returns -1 if every candidate is in use.
+             */
+            virtual int32_t victim (evictable_t) = 0;
+
+            /*
+             * Start tracking a slot which now holds the given file after a
+             * lookup miss.
+             */
+            virtual void insert (uint32_t, const uuid_key_t &) = 0;
+
+            virtual std::string get_name (void) = 0;
+            virtual void getstats (std::string &);
+        };
+
+        typedef boost::shared_ptr <repl_policy> repl_policy_ptr_t;
+
+        /*
+         * Strict insertion order, the behaviour of the original circular
+         * buffer.
+         */
+        class fifo_policy: public repl_policy
+        {
+            slot_clock queue;
+
+            public:
+            fifo_policy (uint32_t);
+            virtual int32_t victim (evictable_t);
+            virtual void insert (uint32_t, const uuid_key_t &);
+            virtual std::string get_name (void)   { return "fifo";    }
+        };
+
+        /*
+         * 2Q: new files go through a FIFO probation queue. Files that come
+         * back after being evicted from it are admitted to the main queue,
+         * which is managed by a clock. A scan only churns the probation
+         * queue.
+         */
+        class twoq_policy: public repl_policy
+        {
+            slot_clock a1in;         /* Probation queue                   */
+            slot_clock am;           /* Main queue                        */
+            ghost_list a1out;        /* Evicted from the probation queue  */
+            uint32_t kin;            /* Target size of a1in               */
+            uint32_t kout;           /* Max size of a1out                 */
+
+            int32_t evict_a1in (evictable_t &);
+            int32_t evict_am (evictable_t &);
+
+            public:
+            twoq_policy (uint32_t);
+            virtual int32_t victim (evictable_t);
+            virtual void insert (uint32_t, const uuid_key_t &);
+            virtual std::string get_name (void)   { return "2q";      }
+        };
+
+        /*
+         * ARC, in its clock based form (CAR). t1 holds the files seen once
+         * recently and t2 the files seen at least twice. The ghost lists
+         * b1 and b2 remember the files evicted from each, and a miss on a
+         * ghost moves the target size p of t1 towards the list which
+         * would have kept the file. A scan fills t1 only and cannot push
+         * the frequently used files out of t2.
+         */
+        class arc_policy: public repl_policy
+        {
+            slot_clock t1;
+            slot_clock t2;
+            ghost_list b1;
+            ghost_list b2;
+            uint32_t p;              /* Target size of t1                 */
+
+            public:
+            arc_policy (uint32_t);
+            virtual int32_t victim (evictable_t);
+            virtual void insert (uint32_t, const uuid_key_t &);
+            virtual std::string get_name (void)   { return "arc";     }
+            virtual void getstats (std::string &);
+        };
+
+        /*
+         * Create the policy of the given name, arc for unknown names.
+         */
+        repl_policy_ptr_t make_repl_policy (std::string, uint32_t);
+    }
+}
+
+#endif /* End of __FDCACHE_POLICY_H__ */
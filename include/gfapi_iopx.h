@@ -72,52 +72,73 @@ namespace openarchive
             /*
              * File operations
              */
-            virtual std::error_code open              (file_ptr_t, req_ptr_t);
+            virtual std::error_code open              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code close             (file_ptr_t, req_ptr_t);
+            virtual std::error_code close             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             virtual std::error_code close             (file_t &);
 
-            virtual std::error_code pread             (file_ptr_t, req_ptr_t);
+            virtual std::error_code pread             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pwrite            (file_ptr_t, req_ptr_t);
+            virtual std::error_code pwrite            (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fstat             (file_ptr_t, req_ptr_t);
+            virtual std::error_code fstat             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code stat              (file_ptr_t, req_ptr_t);
+            virtual std::error_code stat              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code ftruncate         (file_ptr_t, req_ptr_t);
+            virtual std::error_code ftruncate         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code truncate          (file_ptr_t, req_ptr_t);
+            virtual std::error_code truncate          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fsetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fsetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code setxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code setxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fgetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fgetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code getxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fremovexattr      (file_ptr_t, req_ptr_t);
+            virtual std::error_code fremovexattr      (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code removexattr       (file_ptr_t, req_ptr_t);
+            virtual std::error_code removexattr       (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code lseek             (file_ptr_t, req_ptr_t);
+            virtual std::error_code lseek             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getuuid           (file_ptr_t, req_ptr_t);
+            virtual std::error_code getuuid           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code gethosts          (file_ptr_t, req_ptr_t);
+            virtual std::error_code gethosts          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             /*
              * File system operations
              */
-            virtual std::error_code mkdir             (file_ptr_t, req_ptr_t);
+            virtual std::error_code mkdir             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code resolve           (file_ptr_t, req_ptr_t);
+            virtual std::error_code resolve           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code dup               (file_ptr_t, file_ptr_t);
+            virtual std::error_code dup               (const file_ptr_t &,
+                                                       const file_ptr_t &);
 
-            virtual std::error_code scan              (file_ptr_t, req_ptr_t);
+            virtual std::error_code scan              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
         };
     }
@@ -9,6 +9,10 @@
 */
 
 #include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,7 +37,7 @@ namespace openarchive
     namespace iopx_req
     {
 
-        enum fop_type
+        enum fop_type: uint8_t
         {
             OPEN_FOP       =  1,
             CLOSE_FOP      =  2,
@@ -58,7 +62,7 @@ namespace openarchive
             UNDEF_FOP      =  127   
         };
 
-        enum data_type
+        enum data_type: uint8_t
         {
             POI_DATA      =  1,
             BUFF_DATA     =  2,
@@ -74,7 +78,10 @@ namespace openarchive
 
         class fop_data
         {
-            data_type     type;
+            /*
+             * The request keeps the type of the data, a mismatched get
+             * throws boost::bad_get.
+             */
             boost::variant<struct iovec *, buff_ptr_t, void *, 
                            struct stat *, stat_ptr_t,
                            std::list <arch_loc_t> *, 
@@ -85,383 +92,548 @@ namespace openarchive
             void set_poi    (struct iovec * v)   
             {
                 val        =  v;
-                type       =  POI_DATA;
             }
 
             void set_bufp   (buff_ptr_t p)       
             {
                 val        =  p;
-                type       =  BUFF_DATA;
             }
 
             void set_pod    (void * d)           
             {
                 val        =  d;
-                type       =  POD_DATA;
             }
 
             void set_xtbufp (buff_ptr_t p)       
             {
                 val        =  p;
-                type       =  XTBUFF_DATA;
             }
 
             void set_pos    (struct stat * p)    
             {
                 val        =  p;
-                type       =  POS_DATA;
             }    
 
             void set_pstat  (stat_ptr_t p)       
             {
                 val        =  p;
-                type       =  STAT_DATA;
             }
 
             void set_ploc (std::list <arch_loc_t> * p)
             {
                 val        =  p;
-                type       =  RESOLVE_DATA; 
             }
 
             void set_phosts (std::list <std::string> * p)
             {
                 val        =  p;
-                type       =  GETHOSTS_DATA; 
             } 
 
             void set_str (std::string * p)
             {
                 val        =  p;
-                type       =  STR_DATA; 
             }
 
             struct iovec *  get_poi    (void)    
             {
-                assert (type == POI_DATA);
                 return boost::get<struct iovec *> (val);
             }
 
             buff_ptr_t      get_bufp   (void)    
             {
-                assert (type == BUFF_DATA);
                 return boost::get<buff_ptr_t> (val);
             }
                                          
             void *          get_pod    (void)    
             {
-                assert (type == POD_DATA);
                 return boost::get<void *> (val);
             }
 
             buff_ptr_t      get_xtbufp (void)    
             {
-                assert (type == XTBUFF_DATA);
                 return boost::get<buff_ptr_t> (val);
             }
 
             struct stat  *  get_pos    (void)    
             {
-                assert (type == POS_DATA);
                 return boost::get<struct stat *> (val);
             }
 
             stat_ptr_t      get_pstat  (void)    
             {
-                assert (type == STAT_DATA);
                 return boost::get<stat_ptr_t> (val);
             }
 
             std::list <arch_loc_t> * get_ploc (void)
             {
-                assert (type ==  RESOLVE_DATA);
                 return boost::get<std::list <arch_loc_t> *> (val);
             }
 
             std::list <std::string> * get_phosts (void)
             {
-                assert (type ==  GETHOSTS_DATA);
                 return boost::get<std::list <std::string> *> (val);
             }
 
             std::string * get_str (void)
             {
-                assert (type == STR_DATA);
                 return boost::get<std::string *> (val);    
             }
                                                  
         };
 
 
-        class iopx_req
+        /*
+         * Requests use the same layer ids as the files passing through the
+         * layers. The deepest tree built by the engine has five layers
+         * (perf, meta, wbcache, fdcache and the store), the layer stack of
+         * a request has room for one more. The engine refuses to build a
+         * deeper tree.
+         */
+        const uint32_t max_layers = 6;
+        static_assert (max_layers <= openarchive::arch_file::max_layers,
+                       "request layers must have a file slot");
+
+        /*
+         * Descriptor (extended attribute name) and info string (uuid) of
+         * a request. Only the extended attribute and getuuid fops use
+         * them. They are kept inline, the rare string which does not fit
+         * is allocated out of line.
+         */
+        const uint32_t req_str_len = 40;
+
+        struct req_strings
+        {
+            std::string desc;
+            std::string info;
+        };
+
+        /*
+         * Per layer context of a request.
+         * childcount  number of children the request was handed to by
+         *             the default fop, 0 if not handed out
+         * respcount   number of children which have responded
+         * id          identifier assigned by the layer (e.g. for tracking
+         *             async requests), no_layer_id when not assigned
+         */
+        const uint32_t no_layer_id = ~(0U);
+
+        struct layer_ctx
+        {
+            uint16_t              childcount;
+            std::atomic<uint16_t> respcount;
+            uint32_t              id;
+        };
+
+        typedef std::chrono::steady_clock::time_point deadline_t;
+        typedef openarchive::arch_core::cancel_flag_t cancel_flag_t;
+
+        /*
+         * Fields of a request used on the read path, at its beginning.
+         * With the reference count of the pool object they fit in two
+         * cache lines.
+         */
+        struct req_io
         {
             file_ptr_t      fptr;
             fop_type        ftype;
             data_type       dtype;
-            fop_data        data;
-            std::string     desc;
-            std::string     info;
+            bool            async_io;
+            bool            zero_copy;  /* Reader accepts a buffer slice  */
             uint64_t        len; 
-            uint64_t        flags;
             uint64_t        offset;   
             int64_t         ret;
-            bool            async_io;
+            fop_data        data;
+            buff_slice_t    slice;      /* Data of a zero copy read       */
+        };
+
+        static_assert (sizeof (openarchive::arch_mem::pool_object) +
+                       sizeof (req_io) <=
+                       2 * openarchive::arch_core::cache_line_size,
+                       "iopx_req read path has grown past two cache lines");
+
+        class iopx_req: public openarchive::arch_mem::pool_object
+        {
+            struct req_io   io;
+            uint64_t        flags;
             std::error_code code;
-            openarchive::arch_core::mtmap<std::string, int64_t>   rcmap;
-            openarchive::arch_core::mtmap<std::string, uint64_t>  childcount; 
-            openarchive::arch_core::mtmap<std::string, uint64_t>  respcount; 
-            openarchive::arch_core::mtmap<std::string, uint64_t>  idmap;
+            deadline_t      deadline;   /* max () if there is no deadline */
+            cancel_flag_t   cancelled;  /* Cancel flag of the owning job   */
+            struct layer_ctx layers[max_layers];
+            char            desc[req_str_len];
+            char            info[req_str_len];
+            std::unique_ptr<req_strings> strs;  /* Strings too long inline */
+
+            req_strings & get_strs (void)
+            {
+                if (!strs) {
+                    strs.reset (new req_strings);
+                }
+
+                return *strs;
+            }
 
             public:
             iopx_req (void) 
             {
-                ftype = UNDEF_FOP;
-                dtype = UNDEF_DATA;
-                len = 0;
-                offset = 0;
-                ret = -1;
-                async_io = false;
+                io.ftype = UNDEF_FOP;
+                io.dtype = UNDEF_DATA;
+                io.len = 0;
+                io.offset = 0;
+                io.ret = -1;
+                io.async_io = false;
+                io.zero_copy = false;
+                deadline = deadline_t::max ();
+                desc[0] = '\0';
+                info[0] = '\0';
+
+                for (uint32_t layer = 0; layer < max_layers; layer++) {
+                    layers[layer].childcount = 0;
+                    layers[layer].respcount.store (0, 
+                                                   std::memory_order_relaxed);
+                    layers[layer].id = no_layer_id;
+                }
             }
 
-            void set_fptr   (file_ptr_t fp)      { fptr = fp;                 }
-            void set_ftype  (fop_type t)         { ftype = t;                 }
-            void set_len    (uint64_t l)         { len = l;                   }
-            void set_ret    (int64_t r)          { ret = r;                   }
+            void set_fptr   (file_ptr_t fp)      { io.fptr = fp;              }
+            void set_ftype  (fop_type t)         { io.ftype = t;              }
+            void set_len    (uint64_t l)         { io.len = l;                }
+            void set_ret    (int64_t r)          { io.ret = r;                }
             void set_flags  (uint64_t f)         { flags = f;                 }
-            void set_offset (uint64_t o)         { offset = o;                }
+            void set_offset (uint64_t o)         { io.offset = o;             }
             void set_ec     (std::error_code ec) { code = ec;                 } 
-            void set_desc   (std::string &s)     { desc = s;                  }
-            void set_info   (std::string &i)     { info = i;                  }
-            void set_asyncio(bool b)             { async_io = b;              }
+            /*
+             * An empty inline string stands for the out of line one, if
+             * there is one.
+             */
+            void set_desc   (const std::string &s)
+            {
+                if (s.size () < req_str_len) {
+                    memcpy (desc, s.c_str (), s.size () + 1);
+                    if (strs) {
+                        strs->desc.clear ();
+                    }
+                } else {
+                    desc[0] = '\0';
+                    get_strs ().desc = s;
+                }
+            }
+
+            void set_info   (const std::string &i)
+            {
+                if (i.size () < req_str_len) {
+                    memcpy (info, i.c_str (), i.size () + 1);
+                    if (strs) {
+                        strs->info.clear ();
+                    }
+                } else {
+                    info[0] = '\0';
+                    get_strs ().info = i;
+                }
+            }
+
+            void set_asyncio(bool b)             { io.async_io = b;           }
+            void set_zcopy  (bool b)             { io.zero_copy = b;          }
+
+            /*
+             * A request gives up with ETIMEDOUT once its deadline has 
+             * passed and with ECANCELED once the job which owns it has been
+             * cancelled. A timeout of 0 leaves the request without a 
+             * deadline.
+             */
+            void set_timeout (std::chrono::milliseconds ms)
+            {
+                deadline = (ms.count ()? std::chrono::steady_clock::now () + ms:
+                                         deadline_t::max ());
+            }
+
+            void set_deadline (deadline_t d)     { deadline = d;              }
+            void set_cancel_flag (const cancel_flag_t & f) { cancelled = f;   }
+            deadline_t get_deadline (void)       { return deadline;           }
+            const cancel_flag_t & get_cancel_flag (void) { return cancelled;  }
+
+            bool has_deadline (void) 
+            { 
+                return (cancelled || deadline != deadline_t::max ());
+            }
+
+            std::error_code check_deadline (void)
+            {
+                if (cancelled && cancelled->load (std::memory_order_relaxed)) {
+                    return std::error_code (ECANCELED, 
+                                            std::generic_category ());
+                }
+
+                if (deadline != deadline_t::max () && 
+                    std::chrono::steady_clock::now () >= deadline) {
+                    return std::error_code (ETIMEDOUT, 
+                                            std::generic_category ());
+                }
+
+                return openarchive::success;
+            }
+
+            /*
+             * Layers holding the data of a zero copy read in a pooled 
+             * buffer return a slice of it instead of copying the data to
+             * the buffer of the request.
+             */
+            void set_slice  (const buff_slice_t &s) { io.slice = s;           }
+            void clear_slice(void)
+            {
+                io.zero_copy = false;
+                io.slice.reset ();
+            }
 
             void set_poi    (struct iovec * v)   
             {
-                data.set_poi (v);
-                dtype = POI_DATA;
+                io.data.set_poi (v);
+                io.dtype = POI_DATA;
             }
 
             void set_bufp   (buff_ptr_t p)       
             { 
-                data.set_bufp (p);
-                dtype = BUFF_DATA;       
+                io.data.set_bufp (p);
+                io.dtype = BUFF_DATA;       
             }
 
             void set_pod    (void * d)           
             {
-                data.set_pod (d);
-                dtype = POD_DATA;
+                io.data.set_pod (d);
+                io.dtype = POD_DATA;
             } 
 
             void set_xtbufp (buff_ptr_t p)       
             { 
-                data.set_xtbufp (p);
-                dtype = XTBUFF_DATA;
+                io.data.set_xtbufp (p);
+                io.dtype = XTBUFF_DATA;
             }
 
             void set_pos    (struct stat * p)    
             {
-                data.set_pos (p);
-                dtype = POS_DATA;
+                io.data.set_pos (p);
+                io.dtype = POS_DATA;
             }    
 
             void set_pstat  (stat_ptr_t p)       
             { 
-                data.set_pstat (p); 
-                dtype = STAT_DATA;       
+                io.data.set_pstat (p); 
+                io.dtype = STAT_DATA;       
             }
 
             void set_ploc (std::list <arch_loc_t> * p)
             {
-                data.set_ploc (p);
-                dtype = RESOLVE_DATA;
+                io.data.set_ploc (p);
+                io.dtype = RESOLVE_DATA;
             }
 
             void set_phosts (std::list <std::string> * p)
             {
-                data.set_phosts (p);
-                dtype = GETHOSTS_DATA;
+                io.data.set_phosts (p);
+                io.dtype = GETHOSTS_DATA;
             }
 
             void set_str (std::string * p)
             {
-                data.set_str (p);
-                dtype = STR_DATA;
+                io.data.set_str (p);
+                io.dtype = STR_DATA;
             }
 
-            bool set_retcode (std::string, int64_t); 
-            bool set_childcount (std::string, uint64_t);
-            bool set_id (std::string, uint64_t); 
-            bool post_resp (std::string); 
+            bool set_childcount (uint32_t, uint32_t);
+            bool set_id (uint32_t, uint32_t); 
+            bool post_resp (uint32_t, uint64_t &); 
 
-            bool erase_id (std::string);
+            bool erase_id (uint32_t);
  
-            file_ptr_t       get_fptr   (void)   { return fptr;               }
-            fop_type         get_ftype  (void)   { return ftype;              }
-            data_type        get_dtype  (void)   { return dtype;              }
-            uint64_t         get_len    (void)   { return len;                }
-            uint64_t         get_offset (void)   { return offset;             }
-            int64_t          get_ret    (void)   { return ret;                }
+            file_ptr_t       get_fptr   (void)   { return io.fptr;            }
+            fop_type         get_ftype  (void)   { return io.ftype;           }
+            data_type        get_dtype  (void)   { return io.dtype;           }
+            uint64_t         get_len    (void)   { return io.len;             }
+            uint64_t         get_offset (void)   { return io.offset;          }
+            int64_t          get_ret    (void)   { return io.ret;             }
             std::error_code  get_ec     (void)   { return code;               }
             uint64_t         get_flags  (void)   { return flags;              }
-            std::string &    get_desc   (void)   { return desc;               }
-            std::string &    get_info   (void)   { return info;               }
-            bool             get_asyncio(void)   { return async_io;           }
+            const char *     get_desc   (void)   
+            { 
+                return ((desc[0] || !strs)? desc: strs->desc.c_str ());
+            }
+
+            const char *     get_info   (void)   
+            { 
+                return ((info[0] || !strs)? info: strs->info.c_str ());
+            }
+
+            bool             get_asyncio(void)   { return io.async_io;        }
+            bool             get_zcopy  (void)   { return io.zero_copy;       }
+            const buff_slice_t & get_slice (void) { return io.slice;          }
 
             struct iovec *   get_poi    (void)   
             {
-                assert (dtype == POI_DATA);
-                return data.get_poi();
+                assert (io.dtype == POI_DATA);
+                return io.data.get_poi();
             }
 
             buff_ptr_t       get_bufp   (void)   
             { 
-                assert (dtype == BUFF_DATA);
-                return data.get_bufp ();  
+                assert (io.dtype == BUFF_DATA);
+                return io.data.get_bufp ();  
             }
                                          
             void *           get_pod    (void)   
             {
-                assert (dtype == POD_DATA);
-                return data.get_pod();
+                assert (io.dtype == POD_DATA);
+                return io.data.get_pod();
             }
 
             buff_ptr_t       get_xtbufp (void)   
             { 
-                assert (dtype == XTBUFF_DATA);
-                return data.get_xtbufp (); 
+                assert (io.dtype == XTBUFF_DATA);
+                return io.data.get_xtbufp (); 
             }
 
             struct stat  *   get_pos    (void)   
             {
-                assert (dtype == POS_DATA);
-                return data.get_pos();
+                assert (io.dtype == POS_DATA);
+                return io.data.get_pos();
             }
 
             stat_ptr_t       get_pstat  (void)   
             { 
-                assert (dtype == STAT_DATA);
-                return data.get_pstat ();  
+                assert (io.dtype == STAT_DATA);
+                return io.data.get_pstat ();  
             }
 
             std::list <arch_loc_t> * get_ploc (void)
             {
-                assert (dtype == RESOLVE_DATA);
-                return data.get_ploc ();  
+                assert (io.dtype == RESOLVE_DATA);
+                return io.data.get_ploc ();  
             } 
 
             std::list <std::string> * get_phosts (void)
             {
-                assert (dtype == GETHOSTS_DATA);
-                return data.get_phosts ();  
+                assert (io.dtype == GETHOSTS_DATA);
+                return io.data.get_phosts ();  
             } 
             
             std::string * get_str (void)
             {
-                assert (dtype == STR_DATA);
-                return data.get_str ();
+                assert (io.dtype == STR_DATA);
+                return io.data.get_str ();
             }
 
-            bool get_retcode (std::string, int64_t &);
-            bool get_childcount (std::string, uint64_t &);
-            bool get_id (std::string, uint64_t &); 
-            bool get_resp (std::string, uint64_t &);  
+            bool get_childcount (uint32_t, uint64_t &);
+            bool get_id (uint32_t, uint32_t &); 
+            bool get_resp (uint32_t, uint64_t &);  
         };
 
-        void         *  get_buff_baseaddr   (boost::shared_ptr<iopx_req>);
-        void         *  get_xtattr_baseaddr (boost::shared_ptr<iopx_req>);
-        struct stat  *  get_stat_baseaddr   (boost::shared_ptr<iopx_req>);
+        /*
+         * The read path uses the first two cache lines of the request, the
+         * per-layer slots, the error, deadline and cancel flag and the
+         * inline strings follow, they are only touched by the layers and
+         * fops which use them.
+         */
+        static_assert (sizeof (iopx_req) <= 
+                       5 * openarchive::arch_core::cache_line_size,
+                       "iopx_req has grown past five cache lines");
+
+        void         *  get_buff_baseaddr   (boost::intrusive_ptr<iopx_req>);
+        void         *  get_xtattr_baseaddr (boost::intrusive_ptr<iopx_req>);
+        struct stat  *  get_stat_baseaddr   (boost::intrusive_ptr<iopx_req>);
 
         void init_fstat_req (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              struct stat *); 
 
         void init_stat_req  (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              struct stat *); 
 
         void init_open_req  (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t);
 
         void init_creat_req (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t);
 
         void init_close_req (file_ptr_t fp,
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>);
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>);
 
         void init_read_req  (file_ptr_t,
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t, uint64_t, struct iovec *);
 
         void init_read_req  (file_ptr_t,
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t, uint64_t, buff_ptr_t);
 
         void init_read_req  (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t, uint64_t, void *);
 
         void init_write_req (file_ptr_t,
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t, uint64_t, struct iovec *);
 
         void init_write_req (file_ptr_t,
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t, uint64_t, uint64_t, buff_ptr_t);
 
+        void init_write_req (file_ptr_t,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
+                             uint64_t, uint64_t, uint64_t, const buff_slice_t &);
+
         void init_fsetxattr_req (file_ptr_t,
-                                 boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                 boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                  std::string, struct iovec *, uint64_t); 
 
         void init_setxattr_req (file_ptr_t,
-                                boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                 std::string, struct iovec *, uint64_t); 
 
         void init_fgetxattr_req (file_ptr_t,
-                                 boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                 boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                  std::string, struct iovec *);
 
         void init_getxattr_req (file_ptr_t,
-                                boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                 std::string, struct iovec *);
 
         void init_fremovexattr_req (file_ptr_t,
-                                    boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                    boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                     std::string);
 
         void init_removexattr_req (file_ptr_t,
-                                   boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                   boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                    std::string);
 
         void init_mkdir_req (file_ptr_t, 
-                             boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                             boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                              uint64_t);
 
         void init_ftruncate_req (file_ptr_t, 
-                                 boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                 boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                  uint64_t); 
 
         void init_getuuid_req (file_ptr_t,
-                               boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                               boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                struct iovec *);
 
         void init_resolve_req (file_ptr_t,
-                               boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                               boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                std::list <arch_loc_t> *, uint64_t);
 
         void init_gethosts_req (file_ptr_t,
-                                boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                                boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                                 std::list <std::string> *);
 
         void init_scan_req (file_ptr_t,
-                            boost::shared_ptr<openarchive::iopx_req::iopx_req>,
+                            boost::intrusive_ptr<openarchive::iopx_req::iopx_req>,
                             std::string *, archstore_scan_type_t);
 
     } /* End of namespace iopx_req */
 
     typedef openarchive::iopx_req::iopx_req     req_t;
-    typedef boost::shared_ptr<req_t>            req_ptr_t;
+    typedef boost::intrusive_ptr<req_t>         req_ptr_t;
 
 } /* End of namespace openarchive */
 #endif /* End of __IOPX_REQPX_H__ */
@@ -0,0 +1,143 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __META_CACHE_H__
+#define __META_CACHE_H__
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+#include <arch_core.h>
+
+namespace openarchive
+{
+    namespace meta_iopx
+    {
+        const uint32_t num_meta_shards = 16;
+
+        typedef std::chrono::steady_clock::time_point meta_time_t;
+
+        /*
+         * Process wide near-cache of the extended attributes kept in
+         * memcached by the meta iopx of all the trees, keyed like the
+         * memcached entries. Entries live for a short ttl and are recycled
+         * with a clock once the cache holds its max number of entries.
+         * Invalidated and expired entries stay in the index, without their
+         * value, until the hand reaches them or the key is cached again.
+         *
+         * Every shard carries a version which is bumped whenever one of
+         * its keys is invalidated. A value fetched from memcached or from
+         * the store is only cached if the version of its shard has not
+         * changed since the fetch started, so that a fetch racing with a
+         * set or a remove cannot put a stale value back.
+         */
+        class meta_cache
+        {
+            struct entry
+            {
+                std::string value;
+                meta_time_t expiry;
+                bool valid;               /* False once invalidated      */
+                bool ref;                 /* Used since the hand passed  */
+            };
+
+            typedef std::unordered_map <std::string, entry> index_t;
+
+            struct shard
+            {
+                std::mutex lock;
+                index_t index;
+                std::deque <std::string> ring; /* Clock, hand at the front */
+                uint64_t version;
+            };
+
+            uint32_t max_entries;         /* 0 disables the cache        */
+            uint32_t shard_entries;
+            std::chrono::milliseconds ttl;
+            std::unique_ptr <shard []> shards;
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+            std::atomic<uint64_t> expired;
+            std::atomic<uint64_t> inserts;
+            std::atomic<uint64_t> stale;  /* Fills lost to a version bump */
+            std::atomic<uint64_t> invalidations;
+            std::atomic<uint64_t> evictions;
+
+            private:
+            shard & get_shard (const std::string &key)
+            {
+                return shards[std::hash<std::string> () (key) %
+                              num_meta_shards];
+            }
+
+            /*
+             * Evict entries until the shard holds no more than the given
+             * number of them. Called with the shard lock held.
+             */
+            void evict (shard &, size_t);
+
+            /*
+             * Bump the version of the shard and drop the value of the key.
+             * Called with the shard lock held.
+             */
+            void drop (shard &, const std::string &);
+
+            /*
+             * Cache the value of the key. Called with the shard lock held.
+             */
+            void store (shard &, const std::string &, const void *, size_t);
+
+            public:
+            meta_cache (uint32_t, std::chrono::milliseconds);
+            ~meta_cache (void);
+
+            bool enabled (void)              { return (max_entries != 0); }
+
+            /*
+             * Copy the cached value of the key into the buffer, which may
+             * be NULL to only get the length of the value. Returns false
+             * on a miss or if the buffer is too small for the value.
+             */
+            bool lookup (const std::string &, void *, size_t, size_t &);
+
+            /*
+             * Version to pass to insert for a value about to be fetched.
+             */
+            uint64_t version (const std::string &);
+
+            /*
+             * Cache a value fetched since version returned the given tag,
+             * dropped if the key has been invalidated in the meanwhile.
+             */
+            void insert (const std::string &, const void *, size_t, uint64_t);
+
+            void invalidate (const std::string &);
+
+            /*
+             * Invalidate the key and cache the value just written to it,
+             * under the same shard lock, so that no other invalidation or
+             * fill can come in between.
+             */
+            void update (const std::string &, const void *, size_t);
+
+            void getstats (std::string &);
+        };
+
+        typedef boost::shared_ptr <meta_cache> meta_cache_ptr_t;
+        meta_cache_ptr_t get_meta_cache (void);
+    }
+}
+
+#endif /* End of __META_CACHE_H__ */
@@ -14,33 +14,51 @@
 #include <arch_iopx.h>
 #include <arch_tls.h>
 #include <mem_cache.h>
+#include <meta_cache.h>
 #include <cfgparams.h>
 
 namespace openarchive
 {
     namespace meta_iopx
     {
+        /*
+         * Extended attributes are looked up in the process wide near-cache
+         * first, then in memcached and at last in the child iopx. Values
+         * found further down are cached on the way back.
+         */
         class meta_iopx: public openarchive::arch_iopx::arch_iopx
         {
             src::severity_logger<int> log; 
             uint32_t ttl;
             int32_t log_level; 
+            meta_cache_ptr_t l1;
+            std::atomic<uint64_t> mc_hits;      /* Served by memcached   */
+            std::atomic<uint64_t> mc_misses;
 
             private: 
             mem_cache_ptr_t get_mcache (file_ptr_t);
             std::string form_key (file_ptr_t, req_ptr_t);
             std::error_code pxsetxresp (file_ptr_t, req_ptr_t);
-            std::error_code pxgetxreq (file_ptr_t, req_ptr_t, bool &);
+            std::error_code pxgetxreq (file_ptr_t, req_ptr_t, bool &,
+                                       uint64_t &);
+            void pxgetxresp (file_ptr_t, req_ptr_t, uint64_t);
 
             public:
             meta_iopx (std::string, io_service_ptr_t, uint32_t);
             ~meta_iopx (void);
-            std::error_code fsetxattr    (file_ptr_t, req_ptr_t);
-            std::error_code setxattr     (file_ptr_t, req_ptr_t);
-            std::error_code fgetxattr    (file_ptr_t, req_ptr_t);
-            std::error_code getxattr     (file_ptr_t, req_ptr_t);
-            std::error_code fremovexattr (file_ptr_t, req_ptr_t);
-            std::error_code removexattr  (file_ptr_t, req_ptr_t);
+            std::error_code fsetxattr    (const file_ptr_t &,
+                                          const req_ptr_t &);
+            std::error_code setxattr     (const file_ptr_t &,
+                                          const req_ptr_t &);
+            std::error_code fgetxattr    (const file_ptr_t &,
+                                          const req_ptr_t &);
+            std::error_code getxattr     (const file_ptr_t &,
+                                          const req_ptr_t &);
+            std::error_code fremovexattr (const file_ptr_t &,
+                                          const req_ptr_t &);
+            std::error_code removexattr  (const file_ptr_t &,
+                                          const req_ptr_t &);
+            void profile (void);
         };
     }
 
@@ -34,8 +34,8 @@ namespace openarchive
             bool ready;
             src::severity_logger<int> log;
             int32_t log_level;
-            std::atomic<uint64_t> seq;
-            openarchive::arch_core::mtmap<uint64_t, req_info> request_map;
+            std::atomic<uint32_t> seq;  /* Ids of the async requests    */
+            openarchive::arch_core::mthashmap<uint64_t, req_info> request_map;
 
             /*
              * Number of times the FOP has been invoked.
@@ -101,54 +101,76 @@ namespace openarchive
             /*
              * File operations
              */
-            virtual std::error_code open              (file_ptr_t, req_ptr_t);
+            virtual std::error_code open              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code close             (file_ptr_t, req_ptr_t);
+            virtual std::error_code close             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
             virtual std::error_code close             (file_t &);
 
-            virtual std::error_code pread             (file_ptr_t, req_ptr_t);
+            virtual std::error_code pread             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pread_async       (file_ptr_t, req_ptr_t);
+            virtual std::error_code pread_async       (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pwrite            (file_ptr_t, req_ptr_t);
+            virtual std::error_code pwrite            (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fstat             (file_ptr_t, req_ptr_t);
+            virtual std::error_code fstat             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code stat              (file_ptr_t, req_ptr_t);
+            virtual std::error_code stat              (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code ftruncate         (file_ptr_t, req_ptr_t);
+            virtual std::error_code ftruncate         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code truncate          (file_ptr_t, req_ptr_t);
+            virtual std::error_code truncate          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fsetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fsetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code setxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code setxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fgetxattr         (file_ptr_t, req_ptr_t);
+            virtual std::error_code fgetxattr         (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getxattr          (file_ptr_t, req_ptr_t);
+            virtual std::error_code getxattr          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code fremovexattr      (file_ptr_t, req_ptr_t);
+            virtual std::error_code fremovexattr      (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code removexattr       (file_ptr_t, req_ptr_t);
+            virtual std::error_code removexattr       (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code lseek             (file_ptr_t, req_ptr_t);
+            virtual std::error_code lseek             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code getuuid           (file_ptr_t, req_ptr_t);
+            virtual std::error_code getuuid           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code gethosts          (file_ptr_t, req_ptr_t);
+            virtual std::error_code gethosts          (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code pread_cbk         (file_ptr_t, req_ptr_t,
+            virtual std::error_code pread_cbk         (const file_ptr_t &,
+                                                       const req_ptr_t &,
                                                        std::error_code);
             /*
              * File system operations
              */
-            virtual std::error_code mkdir             (file_ptr_t, req_ptr_t);
+            virtual std::error_code mkdir             (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code resolve           (file_ptr_t, req_ptr_t);
+            virtual std::error_code resolve           (const file_ptr_t &,
+                                                       const req_ptr_t &);
 
-            virtual std::error_code dup               (file_ptr_t, file_ptr_t);
+            virtual std::error_code dup               (const file_ptr_t &,
+                                                       const file_ptr_t &);
 
             virtual void profile (void);
 
@@ -0,0 +1,150 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#ifndef __WBCACHE_IOPX_H__
+#define __WBCACHE_IOPX_H__
+
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <boost/shared_ptr.hpp>
+#include <arch_core.h>
+#include <arch_iopx.h>
+#include <arch_mem.hpp>
+#include <cfgparams.h>
+#include <logger.h>
+
+namespace openarchive
+{
+    namespace wbcache_iopx
+    {
+        const uint32_t wb_extent_size = 0x400000; /* Extent size of 4MB   */
+        const uint32_t num_wb_alloc   = 8;
+        const uint32_t num_req_alloc  = 32;
+
+        typedef std::chrono::steady_clock::time_point wb_time_t;
+
+        /*
+         * Dirty range [lo, hi) of an extent aligned block of a file. The
+         * buffer holds the data of the range at the same offsets.
+         */
+        struct wb_extent
+        {
+            uint32_t lo;
+            uint32_t hi;
+            wb_time_t dirtied;      /* When the range was first written  */
+            plbuff_ptr_t plbuff;
+        };
+
+        /*
+         * Dirty extents of a file keyed by their offset. The op_mtx
+         * serializes the writers and the flushes of the file and protects
+         * the extents and the error, it is taken before the lock of the
+         * cache.
+         */
+        struct wb_file
+        {
+            file_ptr_t fp;
+            std::mutex op_mtx;
+            std::map <uint64_t, wb_extent> extents;
+            std::error_code error;  /* Failed write back, not reported yet */
+            bool dead;              /* Removed from the map of the cache  */
+        };
+
+        typedef boost::shared_ptr <wb_file> wb_file_ptr_t;
+
+        /*
+         * Write-back cache of the files written through the tree. Small
+         * and unaligned writes are copied into 4MB extent buffers, writes
+         * which extend the dirty range of an extent are merged into it and
+         * a full extent is written to the child as a single aligned write.
+         * Writes of whole extents go straight to the child.
+         *
+         * The dirty extents of a file are written back when the file is
+         * closed or truncated, before it is read or stat'ed, when a write
+         * leaves a gap in the dirty range of an extent, and by the flusher
+         * thread once they are older than the flush interval. Writers wait
+         * for the flusher when the buffers held reach the dirty limit.
+         *
+         * A failed write back is reported to the next write or close of
+         * the file, the data of the failed extent is dropped.
+         */
+        class wbcache_iopx: public openarchive::arch_iopx::arch_iopx
+        {
+            typedef std::unordered_map <file_t *, wb_file_ptr_t> file_map_t;
+
+            src::severity_logger<int> log;
+            int32_t log_level;
+
+            /*
+             * Protects the file map and the count of dirty bytes.
+             */
+            std::mutex lock;
+            std::condition_variable space_cv;
+            std::condition_variable flush_cv;
+            file_map_t files;
+            uint64_t dirty;         /* Bytes of the buffers held         */
+            uint64_t dirty_limit;
+            std::chrono::milliseconds interval;
+            bool stop;
+            std::thread flusher;
+
+            openarchive::arch_mem::plbpool <wb_extent_size, num_wb_alloc> pool;
+            openarchive::arch_mem::objpool <req_t, num_req_alloc> req_pool;
+
+            std::atomic<uint64_t> writes;       /* Writes buffered       */
+            std::atomic<uint64_t> merges;       /* Merged into an extent */
+            std::atomic<uint64_t> passthru;     /* Sent to the child     */
+            std::atomic<uint64_t> full_flushes;
+            std::atomic<uint64_t> partial_flushes;
+            std::atomic<uint64_t> bytes_flushed;
+            std::atomic<uint64_t> throttled;
+            std::atomic<uint64_t> failures;
+
+            private:
+            wb_file_ptr_t lookup (const file_ptr_t &, bool);
+            std::error_code write_extent (const file_ptr_t &, uint64_t,
+                                          const wb_extent &);
+            std::error_code flush_extent (wb_file &, uint64_t);
+            void flush_file (wb_file &, bool);
+            std::error_code flush (const file_ptr_t &);
+            std::error_code take_error (wb_file &);
+            void release (wb_file &);
+            void throttle (void);
+            bool buffer (wb_file &, uint64_t, uint64_t, const char *);
+            void flush_loop (void);
+
+            public:
+            wbcache_iopx (std::string, io_service_ptr_t, uint64_t);
+            ~wbcache_iopx (void);
+
+            virtual std::error_code close     (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual std::error_code pread     (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual std::error_code pwrite    (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual std::error_code fstat     (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual std::error_code ftruncate (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual std::error_code truncate  (const file_ptr_t &,
+                                               const req_ptr_t &);
+            virtual void profile (void);
+        };
+    }
+
+    typedef openarchive::wbcache_iopx::wbcache_iopx wbcache_iopx_t;
+    typedef boost::shared_ptr <wbcache_iopx_t> wbcache_iopx_ptr_t;
+}
+
+#endif
@@ -0,0 +1,196 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <arch_copy.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace openarchive
+{
+    namespace arch_copy
+    {
+        static void copy_memcpy (void *dst, const void *src, size_t len)
+        {
+            memcpy (dst, src, len);
+        }
+
+#if defined(__x86_64__)
+
+        /*
+         * The kernels copy the unaligned head of the destination with
+         * memcpy, stream the aligned middle part and copy the tail with
+         * memcpy. Loads from the source are unaligned. The streaming
+         * stores are weakly ordered, hence the sfence before returning.
+         */
+
+        static void copy_sse2 (void *dst, const void *src, size_t len)
+        {
+            char *d = (char *) dst;
+            const char *s = (const char *) src;
+            size_t head = (-(uintptr_t) d) & 15;
+
+            memcpy (d, s, head);
+            d += head;
+            s += head;
+            len -= head;
+
+            for (; len >= 64; len -= 64, d += 64, s += 64) {
+                __m128i r0 = _mm_loadu_si128 ((const __m128i *) (s));
+                __m128i r1 = _mm_loadu_si128 ((const __m128i *) (s + 16));
+                __m128i r2 = _mm_loadu_si128 ((const __m128i *) (s + 32));
+                __m128i r3 = _mm_loadu_si128 ((const __m128i *) (s + 48));
+
+                _mm_stream_si128 ((__m128i *) (d), r0);
+                _mm_stream_si128 ((__m128i *) (d + 16), r1);
+                _mm_stream_si128 ((__m128i *) (d + 32), r2);
+                _mm_stream_si128 ((__m128i *) (d + 48), r3);
+            }
+
+            _mm_sfence ();
+            memcpy (d, s, len);
+        }
+
+        __attribute__ ((target ("avx2")))
+        static void copy_avx2 (void *dst, const void *src, size_t len)
+        {
+            char *d = (char *) dst;
+            const char *s = (const char *) src;
+            size_t head = (-(uintptr_t) d) & 31;
+
+            memcpy (d, s, head);
+            d += head;
+            s += head;
+            len -= head;
+
+            for (; len >= 128; len -= 128, d += 128, s += 128) {
+                __m256i r0 = _mm256_loadu_si256 ((const __m256i *) (s));
+                __m256i r1 = _mm256_loadu_si256 ((const __m256i *) (s + 32));
+                __m256i r2 = _mm256_loadu_si256 ((const __m256i *) (s + 64));
+                __m256i r3 = _mm256_loadu_si256 ((const __m256i *) (s + 96));
+
+                _mm256_stream_si256 ((__m256i *) (d), r0);
+                _mm256_stream_si256 ((__m256i *) (d + 32), r1);
+                _mm256_stream_si256 ((__m256i *) (d + 64), r2);
+                _mm256_stream_si256 ((__m256i *) (d + 96), r3);
+            }
+
+            _mm_sfence ();
+            _mm256_zeroupper ();
+            memcpy (d, s, len);
+        }
+
+        __attribute__ ((target ("avx512f")))
+        static void copy_avx512 (void *dst, const void *src, size_t len)
+        {
+            char *d = (char *) dst;
+            const char *s = (const char *) src;
+            size_t head = (-(uintptr_t) d) & 63;
+
+            memcpy (d, s, head);
+            d += head;
+            s += head;
+            len -= head;
+
+            for (; len >= 256; len -= 256, d += 256, s += 256) {
+                __m512i r0 = _mm512_loadu_si512 ((const void *) (s));
+                __m512i r1 = _mm512_loadu_si512 ((const void *) (s + 64));
+                __m512i r2 = _mm512_loadu_si512 ((const void *) (s + 128));
+                __m512i r3 = _mm512_loadu_si512 ((const void *) (s + 192));
+
+                _mm512_stream_si512 ((__m512i *) (d), r0);
+                _mm512_stream_si512 ((__m512i *) (d + 64), r1);
+                _mm512_stream_si512 ((__m512i *) (d + 128), r2);
+                _mm512_stream_si512 ((__m512i *) (d + 192), r3);
+            }
+
+            _mm_sfence ();
+            _mm256_zeroupper ();
+            memcpy (d, s, len);
+        }
+
+#endif
+
+        /*
+         * Kernel in use, memcpy until init has picked one.
+         */
+        static copy_kernel_t kernel = copy_memcpy;
+        static const char *  kernel_name = "memcpy";
+
+        copy_kernel_t find_copy_kernel (const std::string &name)
+        {
+            if (name == "memcpy") {
+                return copy_memcpy;
+            }
+
+#if defined(__x86_64__)
+            __builtin_cpu_init ();
+
+            if (name == "avx512" && __builtin_cpu_supports ("avx512f")) {
+                return copy_avx512;
+            }
+
+            if (name == "avx2" && __builtin_cpu_supports ("avx2")) {
+                return copy_avx2;
+            }
+
+            if (name == "sse2") {
+                return copy_sse2;
+            }
+#endif
+
+            return NULL;
+        }
+
+        void init (const std::string &wanted)
+        {
+            /*
+             * A kernel named in the config file is used if the CPU
+             * supports it, otherwise the best one available is used.
+             */
+            const char * order[] = { "avx512", "avx2", "sse2", "memcpy" };
+            size_t first = 0;
+
+            if (wanted == "avx2") {
+                first = 1;
+            } else if (wanted == "sse2") {
+                first = 2;
+            } else if (wanted == "memcpy") {
+                first = 3;
+            }
+
+            for (size_t idx = first; idx < sizeof (order) / sizeof (order[0]);
+                 idx++) {
+                copy_kernel_t found = find_copy_kernel (order[idx]);
+                if (found) {
+                    kernel = found;
+                    kernel_name = order[idx];
+                    break;
+                }
+            }
+
+            return;
+        }
+
+        copy_kernel_t get_copy_kernel (void)
+        {
+            return kernel;
+        }
+
+        const char * get_copy_kernel_name (void)
+        {
+            return kernel_name;
+        }
+
+    } /* namespace arch_copy */
+} /* namespace openarchive */
@@ -14,6 +14,7 @@
 #include <gfapi_iopx.h>
 #include <meta_iopx.h>
 #include <fdcache_iopx.h>
+#include <wbcache_iopx.h>
 #include <perf_iopx.h>
 
 typedef boost::tokenizer<boost::char_separator<char>> tokenizer_t;
@@ -95,16 +96,37 @@ namespace openarchive
 
         uint32_t arch_engine::create_threads (io_service_ptr_t iosvc,
                                               boost::thread_group &tg,
-                                              uint32_t nthreads)
+                                              uint32_t nthreads,
+                                              openarchive::arch_mem::arena_type
+                                              arena)
         {
             uint32_t ret = 0;
+            uint32_t nnodes = openarchive::arch_numa::get_num_nodes ();
+            std::vector<uint32_t> node_threads (nnodes, 0);
   
             for(uint32_t count=0; count<nthreads; count++) {
+                /*
+                 * Threads are spread over the NUMA nodes in proportion to
+                 * the number of CPUs of each node. Each thread pins itself
+                 * to the CPUs of its node.
+                 */
+                uint32_t node = 0;
+                for (uint32_t nd = 1; nd < nnodes; nd++) {
+                    size_t cpus = openarchive::arch_numa::get_node_cpus (nd).size ();
+                    size_t best = openarchive::arch_numa::get_node_cpus (node).size ();
+
+                    if (node_threads[nd] * best < node_threads[node] * cpus) {
+                        node = nd;
+                    }
+                }
+
                 boost::thread *th = tg.create_thread(boost::bind(&worker_thread,
-                                                                 iosvc, count));
+                                                                 iosvc, count,
+                                                                 node, arena));
                 if (th) {
      
                     ret++;
+                    node_threads[node]++;
 
                     boost::thread::native_handle_type hnd = th->native_handle();
 
@@ -128,6 +150,17 @@ namespace openarchive
                 }
             }
 
+            if (nnodes > 1 && log_level >= openarchive::logger::level_error) {
+                for (uint32_t node = 0; node < nnodes; node++) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " NUMA node " << node << " cpus: "
+                                   << openarchive::arch_numa::get_node_cpus (node).size ()
+                                   << " worker threads: " 
+                                   << node_threads[node];
+                }
+            }
+
             return ret;
         } 
                                                         
@@ -148,8 +181,17 @@ namespace openarchive
                     return (std::error_code (ENOMEM, std::generic_category()));
                 }
 
+                /*
+                 * The fast threads do most of the allocations, give them
+                 * an arena of their own.
+                 */
                 nfastthreads = create_threads (fast_iosvc, fast_threads, 
-                                               nfastthreads);  
+                                               nfastthreads,
+                                      openarchive::arch_mem::ARENA_FAST_IO);  
+
+                fast_sched = boost::make_shared <arch_sched_t> ("fast",
+                                                                fast_iosvc,
+                                                                nfastthreads);
             }
 
             if (enable_slow) {
@@ -167,7 +209,12 @@ namespace openarchive
                 }
 
                 nslowthreads = create_threads (slow_iosvc, slow_threads, 
-                                               nslowthreads);  
+                                               nslowthreads,
+                                      openarchive::arch_mem::ARENA_DEFAULT);  
+
+                slow_sched = boost::make_shared <arch_sched_t> ("slow",
+                                                                slow_iosvc,
+                                                                nslowthreads);
             }
 
             if (log_level >= openarchive::logger::level_error) {
@@ -184,6 +231,25 @@ namespace openarchive
 
         std::error_code arch_engine::release_engine_resources(void)
         {
+            /*
+             * Let the work items of the jobs run to completion before the
+             * threads are stopped. Whatever is still queued when the 
+             * shutdown timeout expires is dropped.
+             */
+            std::chrono::milliseconds timeout = 
+                               openarchive::cfgparams::get_shutdown_timeout ();
+            arch_sched_ptr_t scheds[] = { fast_sched, slow_sched };
+
+            for (uint32_t count = 0; count < 2; count++) {
+                if (scheds[count] && !scheds[count]->drain (timeout)) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV(log, openarchive::logger::level_error)
+                                  << " cancelling work items which did not"
+                                  << " complete within the shutdown timeout";
+                    scheds[count]->cancel ();
+                }
+            }
+
             if (enable_fast) {
                 fast_iosvc->stop();
                 fast_threads.interrupt_all();
@@ -225,10 +291,20 @@ namespace openarchive
                 parent = ch;
             }
 
+            if (tree_cfg.wb_cache_size) {
+                iopx_ptr_t ch = boost::make_shared <wbcache_iopx_t> ("wbcache",
+                                                  ptr, tree_cfg.wb_cache_size);
+                parent->add_child (ch);
+                ch->set_parent (parent); 
+                parent = ch;
+            }
+
             if (tree_cfg.enable_fd_cache) {
                 iopx_ptr_t ch = boost::make_shared <fdcache_iopx_t> ("fdcache", 
-                                                                     ptr,
-                                                                     cache_size);
+                                                  ptr, cache_size,
+                                                  tree_cfg.fd_cache_ra_window,
+                                                  tree_cfg.fd_cache_ra_direct,
+                                                  tree_cfg.fd_cache_private);
                 parent->add_child (ch);
                 ch->set_parent (parent); 
                 parent = ch;
@@ -258,10 +334,20 @@ namespace openarchive
             iopx = boost::make_shared <perf_iopx_t> ("perf", ptr);
             parent = iopx;
             
+            if (tree_cfg.wb_cache_size) {
+                iopx_ptr_t ch = boost::make_shared <wbcache_iopx_t> ("wbcache",
+                                                  ptr, tree_cfg.wb_cache_size);
+                parent->add_child (ch);
+                ch->set_parent (parent); 
+                parent = ch;
+            }
+
             if (tree_cfg.enable_fd_cache) {
                 iopx_ptr_t ch = boost::make_shared <fdcache_iopx_t> ("fdcache", 
-                                                                     ptr,
-                                                                     cache_size);
+                                                  ptr, cache_size,
+                                                  tree_cfg.fd_cache_ra_window,
+                                                  tree_cfg.fd_cache_ra_direct,
+                                                  tree_cfg.fd_cache_private);
                 parent->add_child (ch);
                 ch->set_parent (parent); 
                 parent = ch;
@@ -285,14 +371,28 @@ namespace openarchive
              * be created.
              */
 
+            iopx_ptr_t iopx;
+
             if (tree_cfg.product == "glusterfs") {
-                return mkgltree (tree_cfg);
+                iopx = mkgltree (tree_cfg);
             } else if (tree_cfg.product == "commvault") {
-                return mkcvlttree (tree_cfg);
+                iopx = mkcvlttree (tree_cfg);
             }
 
-            iopx_ptr_t dummy;
-            return dummy;
+            uint32_t max_layers = openarchive::iopx_req::max_layers;
+
+            if (iopx && iopx->set_layer_ids (0) > max_layers) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " Tree for " << tree_cfg.product 
+                               << " has more than " << max_layers
+                               << " layers";
+                iopx->reset_links ();
+                iopx_ptr_t dummy;
+                return dummy;
+            }
+
+            return iopx;
         }
 
         void arch_engine::map_cvlt_store_id (std::string &inp_store,
@@ -373,8 +473,20 @@ namespace openarchive
             return;
         }
 
-        void worker_thread(io_service_ptr_t ptr, uint32_t threadid)
+        void worker_thread(io_service_ptr_t ptr, uint32_t threadid,
+                           uint32_t node, 
+                           openarchive::arch_mem::arena_type arena)
         {
+            if (openarchive::arch_numa::get_num_nodes () > 1) {
+                /*
+                 * Failing to pin the thread is not fatal, the pools then
+                 * use the node of the CPU the thread happens to run on.
+                 */
+                openarchive::arch_numa::bind_thread (node);
+            }
+
+            openarchive::arch_mem::bind_thread_arena (arena);
+
             ptr->run();
         }
 
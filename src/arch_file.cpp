@@ -19,6 +19,11 @@ namespace openarchive
                                                                    failed(false)
         {
             cbk_invoked.store (false);
+            lock.set_stats (get_file_lock_stats ());
+
+            for (uint32_t slot = 0; slot < max_slots; slot++) {
+                slots[slot].valid.store (false, std::memory_order_relaxed);
+            }
         }
 
         arch_file::~arch_file (void)
@@ -33,34 +38,65 @@ namespace openarchive
             }
         } 
         
-        void arch_file::set_file_info (std::string name, file_info_t & info)
+        bool arch_file::set_file_info (uint32_t slot, file_info_t & info)
         {
+            if (slot >= max_slots) {
+                return false;
+            }
+
             openarchive::arch_core::spinlock_handle handle(lock);
 
-            nvstore.insert (std::pair<std::string, file_info_t> (name, info));
+            /*
+             * An existing entry is not replaced as readers may be using it
+             * without holding the lock.
+             */
+            if (slots[slot].valid.load (std::memory_order_relaxed)) {
+                return false;
+            }
+
+            slots[slot].info = info;
+            slots[slot].valid.store (true, std::memory_order_release);
+
+            return true;
         }
 
-        bool arch_file::get_file_info (std::string name, file_info_t & ret)
+        bool arch_file::get_file_info (uint32_t slot, file_info_t & ret)
         {
-            std::map<std::string, file_info_t>::iterator iter;
-            bool found = false;
+            if (slot >= max_slots) {
+                return false;
+            }
 
+            /*
+             * The copy is made under the lock so that it does not race with
+             * a concurrent erase of the slot.
+             */
             openarchive::arch_core::spinlock_handle handle(lock);
 
-            iter = nvstore.find (name);
-            if (iter != nvstore.end()) {
-                ret = iter->second;
-                found = true;
-            } 
-           
-            return found;
+            if (!slots[slot].valid.load (std::memory_order_relaxed)) {
+                return false;
+            }
+
+            ret = slots[slot].info;
+            return true;
         }
 
-        void arch_file::erase_file_info (std::string name)
+        void arch_file::erase_file_info (uint32_t slot)
         {
+            if (slot >= max_slots) {
+                return;
+            }
+
             openarchive::arch_core::spinlock_handle handle(lock);
 
-            nvstore.erase(name);
+            if (slots[slot].valid.load (std::memory_order_relaxed)) {
+                slots[slot].valid.store (false, std::memory_order_release);
+
+                /*
+                 * Drop the references held by the slot.
+                 */
+                slots[slot].info = file_info_t ();
+            }
+
             return ;
         }
     } /* Namespace arch_file */
@@ -8,6 +8,7 @@
   cases as published by the Free Software Foundation.
 */
 
+#include <boost/make_shared.hpp>
 #include <arch_iopx.h>
 
 namespace openarchive
@@ -15,44 +16,74 @@ namespace openarchive
     namespace arch_iopx
     {
         arch_iopx::arch_iopx (std::string n, io_service_ptr_t is): name(n), 
-                                                                   iosvc(is)
+                                                                   iosvc(is),
+                                                                   layer_id(0)
         {
+            cancelled = boost::make_shared<std::atomic<bool>> (false);
+
             /*
              * For the base iopx we don't have nothing much to do. But the 
              * other one's might check for the existence of a parent and 
              * number of children and other stuff.
              */ 
-
-            refcount.store (0); /* Initialize the ref count to zero */
-
         }
 
         arch_iopx::~arch_iopx (void)
         {
-            while (get_refcount () > 0 ) {
-                /*
-                 * Wait until there are no more active references
-                 */ 
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-            }
+            drain ();
         } 
 
+        std::error_code arch_iopx::drain (void)
+        {
+            static src::severity_logger<int> log;
+            std::chrono::milliseconds timeout = 
+                              openarchive::cfgparams::get_shutdown_timeout ();
+
+            for (uint32_t count = 0; count <= drain_retries; count++) {
+
+                if (refs.drain (timeout)) {
+                    return openarchive::success;
+                }
+
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " still waiting for " << get_refcount () 
+                               << " active references to iopx " << name;
+
+                if (count + 1 == drain_retries) {
+                    /*
+                     * The requests of the layer give up with ECANCELED
+                     * at their next check, the last timeout is theirs.
+                     */
+                    cancelled->store (true);
+                }
+            }
+
+            BOOST_LOG_FUNCTION ();
+            BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                           << " giving up on " << get_refcount ()
+                           << " active references to iopx " << name;
+
+            return std::error_code (ETIMEDOUT, std::generic_category ());
+        }
+
         void arch_iopx::put (void)
         {
-            refcount.fetch_sub (1);
+            refs.exit ();
         }
             
         void arch_iopx::get (void)
         {
-            refcount.fetch_add (1);
+            refs.enter ();
         }
             
         uint64_t arch_iopx::get_refcount (void)
         {
-            return (atomic_load (&refcount));
+            return refs.get_count ();
         }
 
-        std::error_code arch_iopx::run_fop (file_ptr_t fp, req_ptr_t req)
+        std::error_code arch_iopx::run_fop (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             switch (req->get_ftype())
             {
@@ -144,7 +175,7 @@ namespace openarchive
             }
         }
 
-        bool arch_iopx::schedule_fop (req_ptr_t req)
+        bool arch_iopx::schedule_fop (const req_ptr_t & req)
         {
             switch (req->get_ftype())
             {
@@ -235,7 +266,8 @@ namespace openarchive
             }
         }
 
-        std::error_code arch_iopx::parent_cbk (file_ptr_t fp, req_ptr_t req,
+        std::error_code arch_iopx::parent_cbk (const file_ptr_t & fp,
+                                               const req_ptr_t & req,
                                                std::error_code ec)
         {
             /*
@@ -342,14 +374,15 @@ namespace openarchive
         /*
          * Default fop implementation
          */
-        std::error_code arch_iopx::fop_default (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::fop_default (const file_ptr_t & fp,
+                                                const req_ptr_t & rq)
         {
             std::list<boost::shared_ptr<arch_iopx>>::iterator iter;
 
             /*
              * Update the number of children that this iopx has.
              */
-            if (false == rq->set_childcount (name, children.size())) {
+            if (false == rq->set_childcount (layer_id, children.size())) {
                 std::error_code ec (EPERM, std::generic_category ());
                 return (ec);
             }
@@ -402,8 +435,8 @@ namespace openarchive
         /*
          * Default dup implementation
          */
-        std::error_code arch_iopx::dup_default (file_ptr_t src_fp, 
-                                                file_ptr_t dest_fp)
+        std::error_code arch_iopx::dup_default (const file_ptr_t & src_fp, 
+                                                const file_ptr_t & dest_fp)
         {
             std::list<boost::shared_ptr<arch_iopx>>::iterator iter;
 
@@ -423,13 +456,16 @@ namespace openarchive
         /*
          * Default fop callback implementation
          */
-        std::error_code arch_iopx::fop_cbk_default (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::fop_cbk_default (const file_ptr_t & fp,
+                                                    const req_ptr_t & rq,
                                                     std::error_code ec) 
         {
+            uint64_t child, resp;
+
             /*
              * Increase the response count.
              */
-            if (false == rq->post_resp (name)) {
+            if (false == rq->post_resp (layer_id, resp)) {
 
                 std::error_code ecode (ENOKEY, std::generic_category ());
                 parent_cbk (fp, rq, ecode);
@@ -448,11 +484,7 @@ namespace openarchive
                 /*
                  * Check whether response has been received for all children.
                  */
-    
-                uint64_t child, resp;
-                if (rq->get_childcount (name, child) && 
-                    rq->get_resp (name, resp) && 
-                    child==resp) {
+                if (rq->get_childcount (layer_id, child) && child == resp) {
                     parent_cbk (fp, rq, ec);
                 }
             } 
@@ -464,12 +496,14 @@ namespace openarchive
          * File operations
          */
 
-        std::error_code arch_iopx::open (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::open (const file_ptr_t & fp,
+                                         const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::close (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::close (const file_ptr_t & fp,
+                                          const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
@@ -479,77 +513,92 @@ namespace openarchive
             return close_default (fp);
         }
 
-        std::error_code arch_iopx::pread (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::pread (const file_ptr_t & fp,
+                                          const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::pwrite (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::pwrite (const file_ptr_t & fp,
+                                           const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::fstat (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::fstat (const file_ptr_t & fp,
+                                          const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::stat (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::stat (const file_ptr_t & fp,
+                                         const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::ftruncate (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::ftruncate (const file_ptr_t & fp,
+                                              const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::truncate (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::truncate (const file_ptr_t & fp,
+                                             const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::fsetxattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::fsetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::setxattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::setxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::fgetxattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::fgetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::getxattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::getxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::fremovexattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::fremovexattr (const file_ptr_t & fp,
+                                                 const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::removexattr (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::removexattr (const file_ptr_t & fp,
+                                                const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::lseek (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::lseek (const file_ptr_t & fp,
+                                          const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::getuuid (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::getuuid (const file_ptr_t & fp,
+                                            const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::gethosts (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::gethosts (const file_ptr_t & fp,
+                                             const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
@@ -558,22 +607,26 @@ namespace openarchive
          * File system operations
          */
 
-        std::error_code arch_iopx::mkdir (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::mkdir (const file_ptr_t & fp,
+                                          const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::resolve (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::resolve (const file_ptr_t & fp,
+                                            const req_ptr_t & rq)
         {
             return fop_default (fp, rq);
         }
 
-        std::error_code arch_iopx::dup (file_ptr_t src_fp, file_ptr_t dest_fp)
+        std::error_code arch_iopx::dup (const file_ptr_t & src_fp,
+                                        const file_ptr_t & dest_fp)
         {
             return dup_default (src_fp, dest_fp); 
         }   
 
-        std::error_code arch_iopx::scan (file_ptr_t fp, req_ptr_t rq)
+        std::error_code arch_iopx::scan (const file_ptr_t & fp,
+                                         const req_ptr_t & rq)
         {
             return fop_default (fp, rq); 
         }   
@@ -582,103 +635,120 @@ namespace openarchive
          * File operation callbacks
          */
 
-        std::error_code arch_iopx::open_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::open_cbk (const file_ptr_t & fp,
+                                             const req_ptr_t & rq,
                                              std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::close_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::close_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & rq,
                                               std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::pread_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::pread_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & rq,
                                               std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::pwrite_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::pwrite_cbk (const file_ptr_t & fp,
+                                               const req_ptr_t & rq,
                                                std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::fstat_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::fstat_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & rq,
                                               std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::stat_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::stat_cbk (const file_ptr_t & fp,
+                                             const req_ptr_t & rq,
                                              std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::ftruncate_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::ftruncate_cbk (const file_ptr_t & fp,
+                                                  const req_ptr_t & rq,
                                                   std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::truncate_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::truncate_cbk (const file_ptr_t & fp,
+                                                 const req_ptr_t & rq,
                                                  std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::fsetxattr_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::fsetxattr_cbk (const file_ptr_t & fp,
+                                                  const req_ptr_t & rq,
                                                   std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::setxattr_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::setxattr_cbk (const file_ptr_t & fp,
+                                                 const req_ptr_t & rq,
                                                  std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::fgetxattr_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::fgetxattr_cbk (const file_ptr_t & fp,
+                                                  const req_ptr_t & rq,
                                                   std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::getxattr_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::getxattr_cbk (const file_ptr_t & fp,
+                                                 const req_ptr_t & rq,
                                                  std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::fremovexattr_cbk (file_ptr_t fp, req_ptr_t q,
+        std::error_code arch_iopx::fremovexattr_cbk (const file_ptr_t & fp,
+                                                     const req_ptr_t & q,
                                                      std::error_code ec)
         {
             return fop_cbk_default (fp, q, ec);
         }
 
-        std::error_code arch_iopx::removexattr_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::removexattr_cbk (const file_ptr_t & fp,
+                                                    const req_ptr_t & rq,
                                                     std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::lseek_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::lseek_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & rq,
                                               std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::getuuid_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::getuuid_cbk (const file_ptr_t & fp,
+                                                const req_ptr_t & rq,
                                                 std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::gethosts_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::gethosts_cbk (const file_ptr_t & fp,
+                                                 const req_ptr_t & rq,
                                                  std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
@@ -688,19 +758,22 @@ namespace openarchive
          * File system operation callbacks
          */
 
-        std::error_code arch_iopx::mkdir_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::mkdir_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & rq,
                                               std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::resolve_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::resolve_cbk (const file_ptr_t & fp,
+                                                const req_ptr_t & rq,
                                                 std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
         }
 
-        std::error_code arch_iopx::scan_cbk (file_ptr_t fp, req_ptr_t rq,
+        std::error_code arch_iopx::scan_cbk (const file_ptr_t & fp,
+                                             const req_ptr_t & rq,
                                              std::error_code ec)
         {
             return fop_cbk_default (fp, rq, ec);
@@ -745,6 +818,24 @@ namespace openarchive
 
             return;
         }
+
+        uint32_t arch_iopx::set_layer_ids (uint32_t id)
+        {
+            std::list<boost::shared_ptr<arch_iopx>>::iterator iter;
+
+            layer_id = id++;
+
+            for(iter = children.begin(); iter != children.end(); iter++) {
+
+                if ((*iter)) {
+
+                    id = (*iter)->set_layer_ids (id);
+
+                }
+            }
+
+            return id;
+        }
   
     } /* End of namespace arch_iopx */
 } /* End of namespace arch_iopx */
@@ -8,22 +8,52 @@
   cases as published by the Free Software Foundation.
 */
 
+#include <unistd.h>
 #include <arch_mem.hpp>
 
 namespace openarchive
 {
     static openarchive::arch_core::spinlock mem_lock;
-    std::string libmalloc = "libjemalloc.so"; 
 
     namespace arch_mem
     {
-        malloc_fops::malloc_fops (std::string name): ready(false), lib(name)
+        /*
+         * Map the allocator named in the config file to a backend.
+         */
+        static enum malloc_backend get_backend (void)
+        {
+            std::string name = openarchive::cfgparams::get_allocator ();
+
+            if (name == "tcmalloc") {
+                return MALLOC_TCMALLOC;
+            } else if (name == "system") {
+                return MALLOC_SYSTEM;
+            }
+
+            return MALLOC_JEMALLOC;
+        }
+
+        malloc_fops::malloc_fops (enum malloc_backend type): ready(false), 
+                                                             handle(NULL),
+                                                             backend(type)
         {
             log_level = openarchive::cfgparams::get_log_level();
             init_fops(); 
 
+            switch (backend) {
+                case MALLOC_JEMALLOC:
+                     lib = "libjemalloc.so";
+                     break;
+                case MALLOC_TCMALLOC:
+                     lib = "libtcmalloc.so";
+                     break;
+                case MALLOC_SYSTEM:
+                     init_system_fops ();
+                     return;
+            }
+
             /*
-             * Open libjemalloc dll
+             * Open the memory manager dll
              */
             dlerror ();  
             handle = dlopen (lib.c_str(), RTLD_NOW);
@@ -31,7 +61,9 @@ namespace openarchive
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to open  " << lib
-                               << " error : "  << dlerror ();
+                               << " error : "  << dlerror ()
+                               << " reverting to the system malloc";
+                init_system_fops ();
                 return;
             }
 
@@ -39,6 +71,22 @@ namespace openarchive
              * Extract the required symbols from dll
              */
             extract_all_symbols();
+
+            if (!fops.malloc || !fops.calloc || !fops.posix_memalign || 
+                !fops.aligned_alloc || !fops.realloc || !fops.free) {
+                /*
+                 * Memory allocated by one memory manager must never be 
+                 * released by another, use the system malloc for all the
+                 * functions if any of them is missing.
+                 */
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " incomplete memory manager " << lib
+                               << " reverting to the system malloc";
+                init_system_fops ();
+                return;
+            }
+
             dump_all_symbols();
 
             ready = true; 
@@ -62,10 +110,28 @@ namespace openarchive
             fops.realloc                  =  NULL;
             fops.free                     =  NULL;
             fops.malloc_stats_print       =  NULL;
+            fops.mallctl                  =  NULL;
+            fops.numeric_property         =  NULL;
 
             return;
         }  
 
+        void malloc_fops::init_system_fops (void)
+        {
+            init_fops ();
+
+            fops.malloc                   =  ::malloc;
+            fops.calloc                   =  ::calloc;
+            fops.posix_memalign           =  ::posix_memalign;
+            fops.aligned_alloc            =  ::aligned_alloc;
+            fops.realloc                  =  ::realloc;
+            fops.free                     =  ::free;
+            backend                       =  MALLOC_SYSTEM;
+            lib                           =  "libc";
+
+            return;
+        }
+
         void* malloc_fops::extract_symbol (std::string name)
         {
             dlerror(); /* Reset errors */
@@ -147,6 +213,22 @@ namespace openarchive
                                    << (uint64_t) fops.malloc_stats_print;
                 }
 
+                {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " mallctl:                   0x"
+                                   << std::hex
+                                   << (uint64_t) fops.mallctl;
+                }
+
+                {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " numeric_property:          0x"
+                                   << std::hex
+                                   << (uint64_t) fops.numeric_property;
+                }
+
         }
  
         void  malloc_fops::extract_all_symbols (void)
@@ -171,8 +253,20 @@ namespace openarchive
             fptr = extract_symbol ("free");
             fops.free = (libmalloc_free_t) fptr;
 
-            fptr = extract_symbol ("malloc_stats_print");
-            fops.malloc_stats_print = (libmalloc_malloc_stats_print_t) fptr;
+            if (backend == MALLOC_JEMALLOC) {
+
+                fptr = extract_symbol ("malloc_stats_print");
+                fops.malloc_stats_print = (libmalloc_malloc_stats_print_t) fptr;
+
+                fptr = extract_symbol ("mallctl");
+                fops.mallctl = (libmalloc_mallctl_t) fptr;
+
+            } else if (backend == MALLOC_TCMALLOC) {
+
+                fptr = extract_symbol ("MallocExtension_GetNumericProperty");
+                fops.numeric_property = (libmalloc_numeric_property_t) fptr;
+
+            }
 
             return;
 
@@ -210,11 +304,175 @@ namespace openarchive
          * If none of these are present then we will revert to the good old 
          * malloc/free provided by glibc.
          */   
-        malloc_intfx::malloc_intfx(std::string lib):fops(lib),
+        malloc_intfx::malloc_intfx(enum malloc_backend type):fops(type),
                                                     fptrs(fops.get_fops ()) 
         {
             alloced.store (0);
             released.store (0);
+
+            for (uint32_t count = 0; count < ARENA_MAX; count++) {
+                arenas[count] = -1;
+            }
+        }
+
+        int64_t malloc_intfx::create_arena (void)
+        {
+            unsigned arena = 0;
+            size_t len = sizeof (arena);
+
+            if (!fptrs.mallctl) {
+                return -1;
+            }
+
+            /*
+             * "arenas.extend" was renamed to "arenas.create" in jemalloc 5.
+             */
+            if (fptrs.mallctl ("arenas.create", &arena, &len, NULL, 0) &&
+                fptrs.mallctl ("arenas.extend", &arena, &len, NULL, 0)) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " failed to create an arena";
+                return -1;
+            }
+
+            return arena;
+        }
+
+        bool malloc_intfx::bind_arena (enum arena_type type)
+        {
+            if (type == ARENA_DEFAULT || type >= ARENA_MAX || 
+                !fptrs.mallctl || !openarchive::cfgparams::malloc_arenas ()) {
+                return false;
+            }
+
+            int64_t arena;
+            {
+                openarchive::arch_core::spinlock_handle handle (arena_lock);
+
+                if (arenas[type] < 0) {
+                    arenas[type] = create_arena ();
+                }
+                arena = arenas[type];
+            }
+
+            if (arena < 0) {
+                return false;
+            }
+
+            unsigned id = arena;
+            if (fptrs.mallctl ("thread.arena", NULL, NULL, &id, sizeof (id))) {
+                return false;
+            }
+
+            return true;
+        }
+
+        bool malloc_intfx::read_stat (std::string name, size_t &val)
+        {
+            size_t len = sizeof (val);
+
+            val = 0;
+            if (fptrs.mallctl) {
+                return !fptrs.mallctl (name.c_str (), &val, &len, NULL, 0);
+            }
+
+            if (fptrs.numeric_property) {
+                return fptrs.numeric_property (name.c_str (), &val);
+            }
+
+            return false;
+        }
+
+        void malloc_intfx::get_arena_stats (std::string &stat)
+        {
+            static const char * arena_names[ARENA_MAX] = {"default", 
+                                                          "fast io", 
+                                                          "callback"};
+            size_t allocated, active, mapped;
+
+            stat.clear ();
+
+            if (fptrs.numeric_property) {
+                read_stat ("generic.current_allocated_bytes", allocated);
+                read_stat ("generic.heap_size", mapped);
+                read_stat ("tcmalloc.pageheap_free_bytes", active);
+
+                stat = " tcmalloc allocated: " + 
+                       boost::lexical_cast <std::string> (allocated) +
+                       " heap: " + 
+                       boost::lexical_cast <std::string> (mapped) +
+                       " free pages: " + 
+                       boost::lexical_cast <std::string> (active);
+                return;
+            }
+
+            if (!fptrs.mallctl) {
+                return;
+            }
+
+            /*
+             * The statistics of jemalloc are only refreshed when the epoch
+             * is advanced.
+             */
+            uint64_t epoch = 1;
+            size_t len = sizeof (epoch);
+            fptrs.mallctl ("epoch", &epoch, &len, &epoch, len);
+
+            size_t page = sysconf (_SC_PAGESIZE);
+
+            for (uint32_t count = 0; count < ARENA_MAX; count++) {
+
+                int64_t arena;
+                {
+                    openarchive::arch_core::spinlock_handle handle (arena_lock);
+                    arena = arenas[count];
+                }
+
+                if (count != ARENA_DEFAULT && arena < 0) {
+                    continue;
+                }
+
+                /*
+                 * Threads which were not bound allocate from arena 0 and 
+                 * the arenas jemalloc assigns them round robin, report 
+                 * arena 0 for them.
+                 */
+                std::string prefix = "stats.arenas." + 
+                        boost::lexical_cast <std::string> (arena < 0 ? 0 : 
+                                                           arena) + ".";
+                size_t small, large, pactive, pdirty;
+
+                read_stat (prefix + "small.allocated", small);
+                read_stat (prefix + "large.allocated", large);
+                read_stat (prefix + "pactive", pactive);
+                read_stat (prefix + "pdirty", pdirty);
+                read_stat (prefix + "mapped", mapped);
+
+                allocated = small + large;
+                active = pactive * page;
+
+                /*
+                 * Fragmentation is the share of the active pages which 
+                 * does not hold allocated memory.
+                 */
+                uint64_t frag = active ? 
+                                ((active - std::min (active, allocated)) * 100)
+                                / active : 0;
+
+                stat += std::string (" arena ") + arena_names[count] + 
+                        " allocated: " + 
+                        boost::lexical_cast <std::string> (allocated) +
+                        " active: " + 
+                        boost::lexical_cast <std::string> (active) +
+                        " dirty: " + 
+                        boost::lexical_cast <std::string> (pdirty * page) +
+                        " mapped: " + 
+                        boost::lexical_cast <std::string> (mapped) +
+                        " fragmentation: " + 
+                        boost::lexical_cast <std::string> (frag) + "%";
+            }
+
+            return;
         }
 
         void malloc_intfx::getstats (std::string &stat)
@@ -344,13 +602,191 @@ namespace openarchive
 
             if (!init) {
 
-                malloc_ptr = boost::make_shared <malloc_intfx_t> (libmalloc);
+                malloc_ptr = boost::make_shared <malloc_intfx_t> (
+                                                              get_backend ());
                 init=true;
             }
 
             return malloc_ptr; 
         }
 
+        void bind_thread_arena (enum arena_type type)
+        {
+            static thread_local bool bound = false;
+
+            if (bound || type == ARENA_DEFAULT) {
+                return;
+            }
+
+            get_malloc_intfx ()->bind_arena (type);
+            bound = true;
+        }
+
+        mem_governor::mem_governor (uint64_t bytes, uint32_t ms): 
+                                    budget (bytes), wait_ms (ms)
+        {
+            used.store (0);
+            peak.store (0);
+            waits.store (0);
+            denied.store (0);
+            trimmed.store (0);
+        }
+
+        void mem_governor::register_client (mem_client *client)
+        {
+            std::lock_guard<std::mutex> guard (client_lock);
+
+            clients.push_back (client);
+        }
+
+        void mem_governor::unregister_client (mem_client *client)
+        {
+            std::lock_guard<std::mutex> guard (client_lock);
+
+            clients.remove (client);
+        }
+
+        void mem_governor::update_peak (uint64_t val)
+        {
+            uint64_t cur = peak.load ();
+
+            while (val > cur && !peak.compare_exchange_weak (cur, val)) {
+            }
+        }
+
+        void mem_governor::charge (uint64_t bytes)
+        {
+            update_peak (used.fetch_add (bytes) + bytes);
+        }
+
+        bool mem_governor::try_reserve (uint64_t bytes)
+        {
+            uint64_t cur = used.load ();
+
+            do {
+                if (budget && cur + bytes > budget) {
+                    return false;
+                }
+            } while (!used.compare_exchange_weak (cur, cur + bytes));
+
+            update_peak (cur + bytes);
+            return true;
+        }
+
+        bool mem_governor::reserve (uint64_t bytes, bool wait,
+                                    mem_client *requester)
+        {
+            if (try_reserve (bytes)) {
+                return true;
+            }
+
+            /*
+             * Over budget. Reclaim the free memory held by the other pools
+             * before making the caller wait. The requester is expanding, 
+             * its free list is empty or about to be used.
+             */
+            trim (true, requester);
+            if (try_reserve (bytes)) {
+                return true;
+            }
+
+            if (wait && wait_ms) {
+                waits.fetch_add (1);
+
+                std::unique_lock<std::mutex> guard (wait_lock);
+                if (wait_cv.wait_for (guard, 
+                                      std::chrono::milliseconds (wait_ms),
+                                      [this, bytes] { 
+                                          return try_reserve (bytes); 
+                                      })) {
+                    return true;
+                }
+            }
+
+            denied.fetch_add (1);
+            return false;
+        }
+
+        void mem_governor::release (uint64_t bytes)
+        {
+            used.fetch_sub (bytes);
+
+            if (budget) {
+                std::lock_guard<std::mutex> guard (wait_lock);
+                wait_cv.notify_all ();
+            }
+        }
+
+        uint64_t mem_governor::trim (bool force, mem_client *skip)
+        {
+            uint64_t bytes = 0;
+
+            std::lock_guard<std::mutex> guard (client_lock);
+
+            std::list<mem_client *>::iterator iter;
+            for (iter = clients.begin (); iter != clients.end (); iter++) {
+                if (*iter != skip) {
+                    bytes += (*iter)->trim (force);
+                }
+            }
+
+            trimmed.fetch_add (bytes);
+            return bytes;
+        }
+
+        void mem_governor::getstats (std::string &stat)
+        {
+            /*
+             * Free memory cached by the threads is part of used but can
+             * only be trimmed once the threads have flushed it.
+             */
+            uint64_t cached = 0;
+
+            {
+                std::lock_guard<std::mutex> guard (client_lock);
+
+                std::list<mem_client *>::iterator iter;
+                for (iter = clients.begin (); iter != clients.end (); 
+                     iter++) {
+                    cached += (*iter)->get_cached ();
+                }
+            }
+
+            stat = " budget: " + 
+                   boost::lexical_cast <std::string> (budget) +
+                   " used: " + 
+                   boost::lexical_cast <std::string> (used.load ()) +
+                   " cached: " + 
+                   boost::lexical_cast <std::string> (cached) +
+                   " peak: " + 
+                   boost::lexical_cast <std::string> (peak.load ()) +
+                   " waits: " + 
+                   boost::lexical_cast <std::string> (waits.load ()) +
+                   " denied: " + 
+                   boost::lexical_cast <std::string> (denied.load ()) +
+                   " trimmed: " + 
+                   boost::lexical_cast <std::string> (trimmed.load ());
+            return;
+        }
+
+        mem_governor_ptr_t get_mem_governor (void)
+        {
+            openarchive::arch_core::spinlock_handle handle(mem_lock);
+
+            static bool init=false;
+            static mem_governor_ptr_t governor_ptr;
+
+            if (!init) {
+
+                governor_ptr = boost::make_shared <mem_governor> (
+                              openarchive::cfgparams::get_mem_budget (),
+                              openarchive::cfgparams::get_mem_budget_wait ());
+                init=true;
+            }
+
+            return governor_ptr; 
+        }
+
     } /*namespace arch_mem */
 
 } /*namespace openarchive */
@@ -0,0 +1,263 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <arch_mrc.h>
+
+namespace openarchive
+{
+    namespace arch_mrc
+    {
+        /*
+         * The callers pass hashes of their keys, they are mixed once more
+         * so that the sampling value is uniform.
+         */
+        static uint64_t mix (uint64_t val)
+        {
+            val ^= val >> 30;
+            val *= 0xBF58476D1CE4E5B9ULL;
+            val ^= val >> 27;
+            val *= 0x94D049BB133111EBULL;
+            val ^= val >> 31;
+            return val;
+        }
+
+        mrc_sampler::mrc_sampler (uint32_t rate): dropped (0),
+                                                  tree (4 * mrc_max_keys + 1),
+                                                  now (0), refs (0)
+        {
+            threshold.store (rate? std::max (1U, mrc_modulus / rate): 0);
+
+            for (uint32_t idx = 0; idx < mrc_buckets; idx++) {
+                hist[idx] = 0;
+            }
+        }
+
+        void mrc_sampler::mark (uint32_t time, int32_t delta)
+        {
+            for (uint32_t idx = time + 1; idx < tree.size ();
+                 idx += idx & -idx) {
+                tree[idx] += delta;
+            }
+        }
+
+        /*
+         * Number of marks at times up to the given one.
+         */
+        uint32_t mrc_sampler::count (uint32_t time)
+        {
+            uint32_t sum = 0;
+
+            for (uint32_t idx = time + 1; idx; idx -= idx & -idx) {
+                sum += tree[idx];
+            }
+
+            return sum;
+        }
+
+        void mrc_sampler::compact (void)
+        {
+            std::vector <std::pair <uint32_t, uint64_t>> keys;
+            std::unordered_map <uint64_t, uint32_t>::iterator iter;
+
+            for (iter = last.begin (); iter != last.end (); iter++) {
+                keys.push_back (std::make_pair (iter->second, iter->first));
+            }
+
+            std::sort (keys.begin (), keys.end ());
+            std::fill (tree.begin (), tree.end (), 0);
+
+            for (now = 0; now < keys.size (); now++) {
+                last[keys[now].second] = now;
+                mark (now, 1);
+            }
+
+            return;
+        }
+
+        void mrc_sampler::shrink (void)
+        {
+            /*
+             * Drop the keys with the largest sampling value until the
+             * sample fits again.
+             */
+            while (last.size () > mrc_max_keys) {
+                uint32_t value = (--order.end ())->first;
+
+                while (!order.empty () && (--order.end ())->first >= value) {
+                    uint64_t key = (--order.end ())->second;
+
+                    mark (last[key], -1);
+                    last.erase (key);
+                    order.erase (--order.end ());
+                }
+
+                threshold.store (value);
+            }
+
+            return;
+        }
+
+        void mrc_sampler::access (uint64_t hash)
+        {
+            uint64_t key = mix (hash);
+            uint32_t value = key & (mrc_modulus - 1);
+
+            if (value >= threshold.load (std::memory_order_relaxed)) {
+                return;
+            }
+
+            if (!pending.bounded_push (key)) {
+                dropped.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            std::unique_lock<std::mutex> guard (lock, std::try_to_lock);
+            if (guard.owns_lock ()) {
+                drain ();
+            }
+
+            return;
+        }
+
+        /*
+         * Account the sampled keys queued so far. Called with the lock
+         * held.
+         */
+        void mrc_sampler::drain (void)
+        {
+            uint64_t key;
+
+            while (pending.pop (key)) {
+                record (key);
+            }
+
+            return;
+        }
+
+        void mrc_sampler::record (uint64_t key)
+        {
+            uint32_t value = key & (mrc_modulus - 1);
+
+            /*
+             * The threshold may have been lowered since the key was
+             * queued.
+             */
+            uint32_t limit = threshold.load ();
+            if (value >= limit) {
+                return;
+            }
+
+            refs++;
+
+            if (now + 1 >= tree.size ()) {
+                compact ();
+            }
+
+            std::unordered_map <uint64_t, uint32_t>::iterator it;
+            it = last.find (key);
+
+            if (it != last.end ()) {
+                /*
+                 * Distinct keys used since the previous access, scaled up
+                 * to the whole stream.
+                 */
+                uint64_t dist = count (now - 1) - count (it->second);
+                dist = dist * mrc_modulus / limit;
+
+                uint32_t bucket = 0;
+                while (dist && bucket < mrc_buckets - 1) {
+                    dist >>= 1;
+                    bucket++;
+                }
+                hist[bucket]++;
+
+                mark (it->second, -1);
+                it->second = now;
+            } else {
+                last[key] = now;
+                order.insert (std::make_pair (value, key));
+            }
+
+            mark (now, 1);
+            now++;
+
+            shrink ();
+            return;
+        }
+
+        void mrc_sampler::get_curve (std::vector <std::pair <uint64_t,
+                                                             double>> &curve)
+        {
+            std::lock_guard<std::mutex> guard (lock);
+
+            drain ();
+
+            curve.clear ();
+            if (!refs) {
+                return;
+            }
+
+            uint32_t top = 0;
+            for (uint32_t idx = 0; idx < mrc_buckets; idx++) {
+                if (hist[idx]) {
+                    top = idx;
+                }
+            }
+
+            /*
+             * A reuse distance below the size of the cache is a hit, the
+             * distances in bucket k are below 2^k.
+             */
+            uint64_t hits = 0;
+            for (uint32_t idx = 0; idx <= top; idx++) {
+                hits += hist[idx];
+                curve.push_back (std::make_pair (1ULL << idx,
+                                                 1.0 - (double) hits / refs));
+            }
+
+            return;
+        }
+
+        void mrc_sampler::getstats (std::string &stat)
+        {
+            std::vector <std::pair <uint64_t, double>> curve;
+            uint32_t limit = threshold.load ();
+            uint64_t sampled;
+
+            get_curve (curve);
+
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                sampled = refs;
+            }
+
+            stat = " sampled: " +
+                   boost::lexical_cast <std::string> (sampled) +
+                   " dropped: " +
+                   boost::lexical_cast <std::string> (dropped.load ()) +
+                   " rate: 1/" +
+                   boost::lexical_cast <std::string> (
+                                         limit? mrc_modulus / limit: 0) +
+                   " size:miss";
+
+            std::vector <std::pair <uint64_t, double>>::iterator iter;
+            for (iter = curve.begin (); iter != curve.end (); iter++) {
+                char point[48];
+                snprintf (point, sizeof (point), " %llu:%.3f",
+                          (unsigned long long) iter->first, iter->second);
+                stat += point;
+            }
+
+            return;
+        }
+    } /* namespace arch_mrc */
+} /* namespace openarchive */
@@ -0,0 +1,215 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <sched.h>
+#include <pthread.h>
+#include <fstream>
+#include <boost/thread.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/lexical_cast.hpp>
+#include <arch_numa.h>
+
+namespace openarchive
+{
+    namespace arch_numa
+    {
+        /*
+         * Upper limit on the node ids probed in sysfs.
+         */
+        const uint32_t max_nodes = 64;
+        const std::string node_dir = "/sys/devices/system/node/node";
+
+        struct numa_topology
+        {
+            std::vector <std::vector<uint32_t>> node_cpus;
+            std::vector <uint32_t> cpu_node;
+
+            /*
+             * Until init has been called all the CPUs are on node 0.
+             */
+            numa_topology (void)
+            {
+                load (false);
+            }
+
+            void load (bool numa)
+            {
+                node_cpus.clear ();
+                cpu_node.clear ();
+
+                if (numa) {
+                    discover ();
+                }
+
+                if (node_cpus.size () <= 1) {
+                    /*
+                     * NUMA awareness is disabled or this is a single node
+                     * machine. Report all the CPUs on node 0.
+                     */
+                    uint32_t ncpus = boost::thread::hardware_concurrency ();
+                    node_cpus.assign (1, std::vector<uint32_t> ());
+                    cpu_node.assign (ncpus, 0);
+
+                    for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+                        node_cpus[0].push_back (cpu);
+                    }
+                }
+            }
+
+            /*
+             * Parse a sysfs cpu list such as "0-3,8-11".
+             */
+            static bool parse_cpulist (std::string &list,
+                                       std::vector<uint32_t> &cpus)
+            {
+                typedef boost::tokenizer<boost::char_separator<char>> tok_t;
+                boost::char_separator<char> sep (",\n ");
+                tok_t tokens (list, sep);
+
+                try {
+                    for (tok_t::iterator iter = tokens.begin ();
+                         iter != tokens.end (); iter++) {
+
+                        size_t pos = iter->find ('-');
+                        uint32_t first, last;
+
+                        first = boost::lexical_cast<uint32_t> (iter->substr (0,
+                                                                         pos));
+                        last = first;
+                        if (pos != std::string::npos) {
+                            last = boost::lexical_cast<uint32_t> (
+                                                      iter->substr (pos + 1));
+                        }
+
+                        for (uint32_t cpu = first; cpu <= last; cpu++) {
+                            cpus.push_back (cpu);
+                        }
+                    }
+                } catch (const boost::bad_lexical_cast &) {
+                    return false;
+                }
+
+                return true;
+            }
+
+            void discover (void)
+            {
+                for (uint32_t node = 0; node < max_nodes; node++) {
+
+                    std::ifstream inp (node_dir +
+                                       boost::lexical_cast<std::string> (node) +
+                                       "/cpulist");
+                    if (!inp.is_open ()) {
+                        /*
+                         * Node ids are dense on all the machines we run on,
+                         * stop at the first missing node.
+                         */
+                        break;
+                    }
+
+                    std::string list;
+                    std::vector<uint32_t> cpus;
+
+                    std::getline (inp, list);
+                    if (!parse_cpulist (list, cpus)) {
+                        node_cpus.clear ();
+                        return;
+                    }
+
+                    node_cpus.push_back (cpus);
+
+                    for (uint32_t count = 0; count < cpus.size (); count++) {
+                        if (cpus[count] >= cpu_node.size ()) {
+                            cpu_node.resize (cpus[count] + 1, 0);
+                        }
+                        cpu_node[cpus[count]] = node;
+                    }
+                }
+            }
+        };
+
+        static numa_topology & get_topology (void)
+        {
+            static numa_topology topology;
+            return topology;
+        }
+
+        void init (void)
+        {
+            get_topology ().load (openarchive::cfgparams::numa_aware ());
+        }
+
+        /*
+         * Node of the calling thread if it has been pinned, -1 otherwise.
+         */
+        static thread_local int32_t thread_node = -1;
+
+        uint32_t get_num_nodes (void)
+        {
+            return get_topology ().node_cpus.size ();
+        }
+
+        uint32_t get_current_node (void)
+        {
+            if (thread_node >= 0) {
+                return thread_node;
+            }
+
+            numa_topology & topology = get_topology ();
+
+            if (topology.node_cpus.size () == 1) {
+                return 0;
+            }
+
+            int cpu = sched_getcpu ();
+            if (cpu < 0 || (uint32_t) cpu >= topology.cpu_node.size ()) {
+                return 0;
+            }
+
+            return topology.cpu_node[cpu];
+        }
+
+        const std::vector<uint32_t> & get_node_cpus (uint32_t node)
+        {
+            numa_topology & topology = get_topology ();
+
+            if (node >= topology.node_cpus.size ()) {
+                node = 0;
+            }
+
+            return topology.node_cpus[node];
+        }
+
+        bool bind_thread (uint32_t node)
+        {
+            if (node >= get_num_nodes ()) {
+                return false;
+            }
+
+            const std::vector<uint32_t> & cpus = get_node_cpus (node);
+            cpu_set_t set;
+
+            CPU_ZERO (&set);
+            for (uint32_t count = 0; count < cpus.size (); count++) {
+                if (cpus[count] < CPU_SETSIZE) {
+                    CPU_SET (cpus[count], &set);
+                }
+            }
+
+            if (pthread_setaffinity_np (pthread_self (), sizeof (set), &set)) {
+                return false;
+            }
+
+            thread_node = node;
+            return true;
+        }
+
+    } /* namespace arch_numa */
+} /* namespace openarchive */
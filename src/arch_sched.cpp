@@ -0,0 +1,364 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <boost/bind.hpp>
+#include <arch_sched.h>
+
+namespace openarchive
+{
+    namespace arch_sched
+    {
+        static openarchive::arch_core::lock_stats sched_lock_stats (
+                                                                "arch_sched");
+
+        arch_sched::arch_sched (std::string sname, io_service_ptr_t svc,
+                                uint32_t nslots): name (sname), iosvc (svc),
+                                                  window (nslots? nslots: 1),
+                                                  inflight (0)
+        {
+            log_level = openarchive::cfgparams::get_log_level();
+            lock.set_stats (&sched_lock_stats);
+        }
+
+        arch_sched::~arch_sched (void)
+        {
+            openarchive::arch_core::spinlock_handle handle(lock);
+
+            active.clear ();
+        }
+
+        sched_job_ptr_t arch_sched::add_job (std::string jname,
+                                             uint32_t weight,
+                                             uint32_t max_inflight)
+        {
+            if (!max_inflight || max_inflight > window) {
+                max_inflight = window;
+            }
+
+            sched_job_ptr_t job = boost::make_shared <sched_job> (jname,
+                                                                  weight,
+                                                                  max_inflight);
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                std::list <boost::weak_ptr <sched_job>>::iterator iter;
+                for (iter = jobs.begin (); iter != jobs.end ();) {
+                    if (iter->expired ()) {
+                        iter = jobs.erase (iter);
+                    } else {
+                        iter++;
+                    }
+                }
+
+                jobs.push_back (job);
+            }
+
+            if (log_level >= openarchive::logger::level_debug_2) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
+                               << " added job " << jname << " to " << name
+                               << " scheduler weight: " << job->weight
+                               << " max inflight: " << job->max_inflight;
+            }
+
+            return job;
+        }
+
+        std::error_code arch_sched::submit (sched_job_ptr_t job,
+                                            sched_task_t task,
+                                            sched_task_t on_cancel)
+        {
+            if (!job) {
+                std::error_code ec (EINVAL, std::generic_category ());
+                return ec;
+            }
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                sched_item item = { task, on_cancel };
+
+                pending.enter ();
+                job->tasks.push (item);
+                if (!job->active) {
+                    /*
+                     * A job joining the round starts without any credit
+                     * so that it cannot jump ahead of the jobs which are
+                     * already waiting.
+                     */
+                    job->active = true;
+                    job->deficit = 0;
+                    active.push_back (job);
+                }
+            }
+
+            dispatch ();
+
+            return (openarchive::success);
+        }
+
+        void arch_sched::dispatch (void)
+        {
+            /*
+             * Pick work items in deficit round robin order until all the
+             * slots of the window are in use. The picked work items are
+             * posted to the ioservice after the lock has been released.
+             */
+            std::queue <sched_task_t> ready;
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                /*
+                 * Number of jobs visited in a row which could not make
+                 * progress because they have hit their max_inflight limit.
+                 */
+                size_t blocked = 0;
+
+                while (inflight < window && !active.empty () &&
+                       blocked < active.size ()) {
+
+                    sched_job_ptr_t job = active.front ();
+                    active.pop_front ();
+
+                    if (job->tasks.empty ()) {
+                        job->active = false;
+                        job->deficit = 0;
+                        continue;
+                    }
+
+                    if (job->inflight >= job->max_inflight) {
+                        active.push_back (job);
+                        blocked++;
+                        continue;
+                    }
+
+                    if (!job->deficit) {
+                        /*
+                         * Start of a new round for the job. Grant the
+                         * quantum which is proportional to its weight.
+                         */
+                        job->deficit = job->weight;
+                    }
+
+                    while (job->deficit && !job->tasks.empty () &&
+                           job->inflight < job->max_inflight &&
+                           inflight < window) {
+
+                        ready.push (boost::bind (&arch_sched::run, this, job,
+                                                 job->tasks.front ()));
+                        job->tasks.pop ();
+                        job->deficit--;
+                        job->inflight++;
+                        job->dispatched++;
+                        inflight++;
+                    }
+
+                    blocked = 0;
+
+                    if (job->tasks.empty ()) {
+                        /*
+                         * Idle jobs do not get to keep unused credit.
+                         */
+                        job->active = false;
+                        job->deficit = 0;
+                    } else if (job->deficit && inflight >= window) {
+                        /*
+                         * The window filled up before the job could use
+                         * up its quantum. Let it continue its turn once
+                         * a slot is released.
+                         */
+                        active.push_front (job);
+                    } else {
+                        active.push_back (job);
+                    }
+                }
+            }
+
+            while (!ready.empty ()) {
+                iosvc->post (ready.front ());
+                ready.pop ();
+            }
+
+            return;
+        }
+
+        void arch_sched::run (sched_job_ptr_t job, sched_item item)
+        {
+            /*
+             * The slot of the work item is given back even if the work
+             * item throws, otherwise the job would stall once all of its
+             * max_inflight slots have leaked.
+             */
+            struct run_guard
+            {
+                arch_sched * sched;
+                sched_job_ptr_t job;
+
+                ~run_guard (void)
+                {
+                    openarchive::arch_core::current_cancel_flag ().reset ();
+                    sched->complete (job);
+                    sched->pending.exit ();
+                }
+            } guard = { this, job };
+
+            if (!job->get_cancelled ()) {
+                openarchive::arch_core::current_cancel_flag () = 
+                                                            job->cancelled;
+                item.task ();
+
+            } else if (item.on_cancel) {
+                item.on_cancel ();
+            }
+        }
+
+        void arch_sched::drop (sched_job_ptr_t job, 
+                               std::queue <sched_item> & dropped)
+        {
+            /*
+             * Called with the lock held. The cancel handlers are run by
+             * the caller once the lock has been released.
+             */
+            while (!job->tasks.empty ()) {
+                dropped.push (job->tasks.front ());
+                job->tasks.pop ();
+            }
+
+            job->active = false;
+            job->deficit = 0;
+        }
+
+        bool arch_sched::drain (std::chrono::milliseconds timeout)
+        {
+            return pending.drain (timeout);
+        }
+
+        void arch_sched::cancel (void)
+        {
+            std::queue <sched_item> dropped;
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                while (!active.empty ()) {
+                    drop (active.front (), dropped);
+                    active.pop_front ();
+                }
+            }
+
+            while (!dropped.empty ()) {
+                if (dropped.front ().on_cancel) {
+                    dropped.front ().on_cancel ();
+                }
+                dropped.pop ();
+                pending.exit ();
+            }
+        }
+
+        void arch_sched::cancel_job (sched_job_ptr_t job)
+        {
+            std::queue <sched_item> dropped;
+
+            job->cancelled->store (true);
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                drop (job, dropped);
+                active.remove (job);
+            }
+
+            if (log_level >= openarchive::logger::level_error) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " cancelled job " << job->name 
+                               << " queued work items dropped: " 
+                               << dropped.size ();
+            }
+
+            while (!dropped.empty ()) {
+                if (dropped.front ().on_cancel) {
+                    dropped.front ().on_cancel ();
+                }
+                dropped.pop ();
+                pending.exit ();
+            }
+        }
+
+        uint32_t arch_sched::cancel_job (const std::string & jname)
+        {
+            std::list <sched_job_ptr_t> matched;
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                std::list <boost::weak_ptr <sched_job>>::iterator iter;
+                for (iter = jobs.begin (); iter != jobs.end (); iter++) {
+                    sched_job_ptr_t job = iter->lock ();
+                    if (job && job->name == jname) {
+                        matched.push_back (job);
+                    }
+                }
+            }
+
+            std::list <sched_job_ptr_t>::iterator iter;
+            for (iter = matched.begin (); iter != matched.end (); iter++) {
+                cancel_job (*iter);
+            }
+
+            return matched.size ();
+        }
+
+        void arch_sched::complete (sched_job_ptr_t job)
+        {
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                job->inflight--;
+                inflight--;
+            }
+
+            dispatch ();
+        }
+
+        void arch_sched::profile (void)
+        {
+            std::ostringstream stats;
+
+            {
+                openarchive::arch_core::spinlock_handle handle(lock);
+
+                stats << name << " scheduler window: " << window
+                      << " inflight: " << inflight
+                      << " active jobs: " << active.size ();
+
+                std::list<sched_job_ptr_t>::iterator iter;
+                for (iter = active.begin (); iter != active.end (); iter++) {
+                    sched_job_ptr_t job = *iter;
+                    stats << std::endl << "    job: " << job->name
+                          << " weight: " << job->weight
+                          << " max inflight: " << job->max_inflight
+                          << " inflight: " << job->inflight
+                          << " queued: " << job->tasks.size ()
+                          << " dispatched: " << job->dispatched;
+                }
+            }
+
+            BOOST_LOG_FUNCTION ();
+            BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                           << stats.str ();
+
+            return;
+        }
+
+    } /* namespace arch_sched */
+} /* namespace openarchive */
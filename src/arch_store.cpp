@@ -18,6 +18,8 @@ extern "C" {
 #include <data_mgmt.h>
 #include <arch_store.h>
 #include <arch_mem.hpp>
+#include <arch_numa.h>
+#include <arch_copy.h>
 
 namespace openarchive
 {
@@ -36,6 +38,9 @@ namespace openarchive
             if (!plogger) {
                
                 openarchive::cfgparams::parse_config_file(); 
+                openarchive::arch_numa::init ();
+                openarchive::arch_copy::init (
+                                  openarchive::cfgparams::get_copy_kernel ());
                 std::string dir = openarchive::cfgparams::get_log_dir();
                 std::string prefix = (log_file ? log_file :
                                       openarchive::cfgparams::get_log_prefix());
@@ -0,0 +1,237 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cfgparams.h>
+#include <block_cache.h>
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        block_cache::block_cache (uint64_t bytes): budget (bytes),
+                                                   shards (new shard
+                                                           [num_block_shards]),
+                                                   pool ("blockpool"),
+                                                   hits (0), misses (0),
+                                                   inserts (0), evictions (0)
+        {
+            governor = openarchive::arch_mem::get_mem_governor ();
+
+            /*
+             * Every shard can hold at least one block, a small budget is
+             * rounded up accordingly.
+             */
+            shard_budget = 0;
+            if (budget) {
+                shard_budget = std::max ((uint64_t) block_size,
+                                         budget / num_block_shards);
+            }
+
+            for (uint32_t idx = 0; idx < num_block_shards; idx++) {
+                shards[idx].used = 0;
+            }
+
+            governor->register_client (this);
+        }
+
+        block_cache::~block_cache (void)
+        {
+            governor->unregister_client (this);
+        }
+
+        uint64_t block_cache::evict (shard &sh, uint64_t limit)
+        {
+            uint64_t freed = 0;
+
+            /*
+             * Two turns of the hand clear all the reference bits. Blocks
+             * which are still being read from can be evicted, the readers
+             * hold a reference of their own.
+             */
+            for (size_t count = 2 * sh.ring.size ();
+                 count && sh.used > limit; count--) {
+
+                block_key key = sh.ring.front ();
+                sh.ring.pop_front ();
+
+                index_t::iterator it = sh.index.find (key);
+                if (it == sh.index.end ()) {
+                    continue;
+                }
+
+                if (it->second.ref) {
+                    it->second.ref = false;
+                    sh.ring.push_back (key);
+                    continue;
+                }
+
+                sh.index.erase (it);
+                sh.used -= block_size;
+                freed += block_size;
+                evictions++;
+            }
+
+            return freed;
+        }
+
+        plbuff_ptr_t block_cache::lookup (const uuid_key_t &uid,
+                                          uint64_t version, uint64_t offset)
+        {
+            plbuff_ptr_t plbuff;
+
+            if (!budget) {
+                return plbuff;
+            }
+
+            block_key key = { uid, version, offset };
+            shard & sh = get_shard (key);
+
+            {
+                std::lock_guard<std::mutex> guard (sh.lock);
+
+                index_t::iterator it = sh.index.find (key);
+                if (it != sh.index.end ()) {
+                    it->second.ref = true;
+                    plbuff = it->second.plbuff;
+                }
+            }
+
+            if (plbuff) {
+                hits.fetch_add (1, std::memory_order_relaxed);
+            } else {
+                misses.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            return plbuff;
+        }
+
+        bool block_cache::contains (const uuid_key_t &uid, uint64_t version,
+                                    uint64_t offset)
+        {
+            if (!budget) {
+                return false;
+            }
+
+            block_key key = { uid, version, offset };
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+            return (sh.index.find (key) != sh.index.end ());
+        }
+
+        void block_cache::insert (const uuid_key_t &uid, uint64_t version,
+                                  plbuff_ptr_t plbuff)
+        {
+            if (!budget || !plbuff || !plbuff->get_bytes ()) {
+                return;
+            }
+
+            block_key key = { uid, version, (uint64_t) plbuff->get_offset () };
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+
+            index_t::iterator it = sh.index.find (key);
+            if (it != sh.index.end ()) {
+                /*
+                 * Another tree read the same block in the meanwhile.
+                 */
+                it->second.plbuff = plbuff;
+                return;
+            }
+
+            evict (sh, shard_budget - block_size);
+            if (sh.used + block_size > shard_budget) {
+                return;
+            }
+
+            entry ent = { plbuff, false };
+            sh.index.insert (std::make_pair (key, ent));
+            sh.ring.push_back (key);
+            sh.used += block_size;
+            inserts++;
+
+            return;
+        }
+
+        uint64_t block_cache::trim (bool force)
+        {
+            uint64_t freed = 0;
+
+            /*
+             * Cached blocks are kept while the budget is not exceeded,
+             * even if they have not been used for a while.
+             */
+            if (!force || !budget) {
+                return 0;
+            }
+
+            for (uint32_t idx = 0; idx < num_block_shards; idx++) {
+                std::lock_guard<std::mutex> guard (shards[idx].lock);
+                freed += evict (shards[idx], shard_budget / 2);
+            }
+
+            return freed;
+        }
+
+        void block_cache::getstats (std::string &stat)
+        {
+            uint64_t used = 0;
+            uint64_t blocks = 0;
+
+            for (uint32_t idx = 0; idx < num_block_shards; idx++) {
+                std::lock_guard<std::mutex> guard (shards[idx].lock);
+                used += shards[idx].used;
+                blocks += shards[idx].index.size ();
+            }
+
+            std::string pool_stat;
+            pool.getstats (pool_stat);
+
+            stat = " block cache budget: " +
+                   boost::lexical_cast <std::string> (budget) +
+                   " used: " + boost::lexical_cast <std::string> (used) +
+                   " blocks: " + boost::lexical_cast <std::string> (blocks) +
+                   " hits: " +
+                   boost::lexical_cast <std::string> (hits.load ()) +
+                   " misses: " +
+                   boost::lexical_cast <std::string> (misses.load ()) +
+                   " inserts: " +
+                   boost::lexical_cast <std::string> (inserts.load ()) +
+                   " evictions: " +
+                   boost::lexical_cast <std::string> (evictions.load ()) +
+                   pool_stat;
+            return;
+        }
+
+        /*
+         * A mutex rather than a spinlock, creating the cache fills its
+         * pool and may wait for the memory budget.
+         */
+        static std::mutex block_cache_lock;
+
+        block_cache_ptr_t get_block_cache (void)
+        {
+            std::lock_guard<std::mutex> guard (block_cache_lock);
+
+            static block_cache_ptr_t cache_ptr;
+
+            if (!cache_ptr) {
+                cache_ptr = boost::make_shared <block_cache> (
+                               openarchive::cfgparams::get_block_cache_size ());
+            }
+
+            return cache_ptr;
+        }
+    }
+}
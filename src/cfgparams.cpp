@@ -31,6 +31,127 @@ namespace openarchive
         int32_t log_level = 0; /* Current log level */
         uint64_t work_items = 128;   
 
+        /*
+         * Weights and concurrency limits used by the job scheduler for
+         * sharing worker threads between concurrent data management jobs.
+         * A max inflight value of 0 picks the default for the job type.
+         */
+        uint32_t backup_weight = 1;
+        uint32_t archive_weight = 1;
+        uint32_t restore_weight = 4;
+        uint32_t backup_max_inflight = 0;
+        uint32_t archive_max_inflight = 0;
+        uint32_t restore_max_inflight = 0;
+
+        /*
+         * Pin the worker threads to NUMA nodes and keep per node memory 
+         * pools. Disabled by default.
+         */
+        bool numa = false;
+
+        /*
+         * Extent buffers of the plain buffer pools. Huge pages are used 
+         * when available, the buffers can be locked in memory and a 
+         * minimum number of them allocated up front so that the steady
+         * state copies do not page fault.
+         */
+        bool plb_huge_pages = true;
+        bool plb_mlock = false;
+        uint32_t plb_prealloc = 0;
+
+        /*
+         * Memory budget in MB for the memory pools, 0 for no limit, and 
+         * the time in milliseconds an allocation waits for memory to be 
+         * released when the budget has been used up.
+         */
+        uint64_t mem_budget = 0;
+        uint32_t mem_budget_wait = 1000;
+
+        /*
+         * Memory manager backing the memory pools (jemalloc, tcmalloc or
+         * system) and whether the busy threads get arenas of their own.
+         */
+        std::string allocator = "jemalloc";
+        bool arenas = true;
+
+        /*
+         * Kernel used for the large data copies: auto picks the best one
+         * the CPU supports, avx512, avx2 and sse2 cap the instruction set
+         * used and memcpy disables the non temporal copies.
+         */
+        std::string copy_kernel = "auto";
+
+        /*
+         * Lock profiling measures one in every lock_profiling acquisitions
+         * of the named locks, 0 disables it.
+         */
+        uint32_t lock_profiling = 0;
+
+        /*
+         * Time in milliseconds a shutdown waits for the work in flight to
+         * finish before the remaining work is cancelled.
+         */
+        uint32_t shutdown_timeout = 30000;
+
+        /*
+         * Time in milliseconds a request of a job may take end to end, 0
+         * for no limit.
+         */
+        uint32_t request_timeout = 0;
+
+        /*
+         * Replacement policy of the fd-cache: arc, 2q or fifo.
+         */
+        std::string fdcache_policy = "arc";
+
+        /*
+         * Max number of 4MB buffers the fd-cache prefetches ahead of a 
+         * sequential reader, 0 disables the prefetch. Random readers go
+         * straight to the store unless fdcache_ra_direct is false.
+         */
+        uint32_t fdcache_ra_window = 8;
+        bool ra_direct = true;
+
+        /*
+         * Size in MB of the block cache shared by the fd-caches of all the
+         * trees, 0 disables it.
+         */
+        uint64_t block_cache_size = 1024;
+
+        /*
+         * Directory of the block cache kept on local disk across restarts,
+         * none by default, and its size in MB.
+         */
+        std::string l2_cache_dir = "";
+        uint64_t l2_cache_size = 10240;
+
+        /*
+         * The fd-caches sample one in every mrc_sampling files and blocks
+         * to estimate their miss ratio at other sizes, 0, the default,
+         * disables it. 100 gives usable curves when sizing the caches.
+         */
+        uint32_t mrc_sampling = 0;
+
+        /*
+         * Max MB of dirty data held by the write-back cache of the restore
+         * trees, 0, the default, disables it. Dirty data is written back
+         * once it is older than wb_flush_interval milliseconds. Until then
+         * a crash loses the data of the restore, which has to be run again.
+         */
+        uint64_t wb_cache_size = 0;
+        uint32_t wb_flush_interval = 1000;
+
+        /*
+         * Max number of extended attributes the meta iopx keeps in process
+         * in front of memcached and the time in milliseconds they are kept
+         * for, 0, the default, disables the near-cache. Sets and removes
+         * done by this process invalidate the cached values right away,
+         * changes made by other processes sharing memcached are only seen
+         * once meta_l1_ttl has expired.
+         */
+        uint32_t meta_l1_entries = 0;
+        uint32_t meta_l1_ttl = 500;
+
         void extract_str (boost::program_options::variables_map &map,
                           std::string name, std::string &val)
         {
@@ -65,7 +186,90 @@ namespace openarchive
                        ("expand_val", boost::program_options::value<int>(), 
                         "Get request processing queue expansion factor")
                        ("flush_interval", boost::program_options::value<int>(), 
-                        "Log entries flush frequency");  
+                        "Log entries flush frequency")
+                       ("backup_weight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Scheduling weight of backup jobs")
+                       ("archive_weight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Scheduling weight of archive jobs")
+                       ("restore_weight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Scheduling weight of restore jobs")
+                       ("backup_max_inflight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max concurrent work items of a backup job")
+                       ("archive_max_inflight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max concurrent work items of an archive job")
+                       ("restore_max_inflight", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max concurrent work items of a restore job")
+                       ("numa_aware", boost::program_options::value<bool>(), 
+                        "Per NUMA node worker threads and memory pools")
+                       ("plbuff_huge_pages", 
+                        boost::program_options::value<bool>(), 
+                        "Back extent buffers with huge pages")
+                       ("plbuff_mlock", boost::program_options::value<bool>(), 
+                        "Lock extent buffers in memory")
+                       ("plbuff_prealloc", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Extent buffers preallocated per pool")
+                       ("mem_budget", boost::program_options::value<uint64_t>(), 
+                        "Memory budget of the memory pools in MB")
+                       ("mem_budget_wait", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max wait for memory in milliseconds")
+                       ("allocator", 
+                        boost::program_options::value<std::string>(), 
+                        "Memory manager: jemalloc, tcmalloc or system")
+                       ("malloc_arenas", boost::program_options::value<bool>(), 
+                        "Separate allocator arenas for the busy threads")
+                       ("copy_kernel", 
+                        boost::program_options::value<std::string>(), 
+                        "Large copies: auto, avx512, avx2, sse2 or memcpy")
+                       ("lock_profiling", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Sample rate of the lock profiling, 0 to disable")
+                       ("shutdown_timeout", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max wait in milliseconds for work in flight at exit")
+                       ("request_timeout", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Deadline in milliseconds of the job requests")
+                       ("fdcache_policy", 
+                        boost::program_options::value<std::string>(), 
+                        "Replacement policy of the fd-cache: arc, 2q or fifo")
+                       ("fdcache_ra_window", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max read-ahead buffers prefetched by the fd-cache")
+                       ("fdcache_ra_direct", 
+                        boost::program_options::value<bool>(), 
+                        "Random reads bypass the fd-cache read-ahead")
+                       ("block_cache_size", 
+                        boost::program_options::value<uint64_t>(), 
+                        "Size in MB of the block cache shared by the trees")
+                       ("l2_cache_dir", 
+                        boost::program_options::value<std::string>(), 
+                        "Local directory of the persistent block cache")
+                       ("l2_cache_size", 
+                        boost::program_options::value<uint64_t>(), 
+                        "Size in MB of the persistent block cache")
+                       ("mrc_sampling", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Sample rate of the fd-cache miss ratio curves")
+                       ("wb_cache_size", 
+                        boost::program_options::value<uint64_t>(), 
+                        "Max MB of dirty data held by the write-back cache")
+                       ("wb_flush_interval", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Age in milliseconds of the dirty data written back")
+                       ("meta_l1_entries", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Max extended attributes cached in process")
+                       ("meta_l1_ttl", 
+                        boost::program_options::value<uint32_t>(), 
+                        "Time in milliseconds extended attributes are cached");
             
             boost::program_options::variables_map var_map;
             std::ifstream inpstream { config_file.c_str() };
@@ -80,6 +284,60 @@ namespace openarchive
                 extract_val (var_map, "rotation_size", rotation_size); 
                 extract_val (var_map, "free_space", min_free_space);
                 extract_val (var_map, "log_level", log_level);
+                extract_val (var_map, "backup_weight", backup_weight);
+                extract_val (var_map, "archive_weight", archive_weight);
+                extract_val (var_map, "restore_weight", restore_weight);
+                extract_val (var_map, "backup_max_inflight", 
+                             backup_max_inflight);
+                extract_val (var_map, "archive_max_inflight", 
+                             archive_max_inflight);
+                extract_val (var_map, "restore_max_inflight", 
+                             restore_max_inflight);
+                extract_val (var_map, "numa_aware", numa);
+                extract_val (var_map, "plbuff_mlock", plb_mlock);
+                extract_val (var_map, "plbuff_prealloc", plb_prealloc);
+                extract_val (var_map, "mem_budget", mem_budget);
+                extract_val (var_map, "mem_budget_wait", mem_budget_wait);
+
+                if (var_map.count ("plbuff_huge_pages")) {
+                    /*
+                     * extract_val ignores false values.
+                     */
+                    plb_huge_pages = var_map["plbuff_huge_pages"].as<bool>();
+                }
+
+                extract_str (var_map, "allocator", allocator);
+                if (var_map.count ("malloc_arenas")) {
+                    arenas = var_map["malloc_arenas"].as<bool>();
+                }
+
+                extract_str (var_map, "copy_kernel", copy_kernel);
+                extract_val (var_map, "lock_profiling", lock_profiling);
+                extract_val (var_map, "shutdown_timeout", shutdown_timeout);
+                extract_val (var_map, "request_timeout", request_timeout);
+                extract_str (var_map, "fdcache_policy", fdcache_policy);
+                if (var_map.count ("fdcache_ra_window")) {
+                    fdcache_ra_window = 
+                                 var_map["fdcache_ra_window"].as<uint32_t>();
+                }
+                if (var_map.count ("fdcache_ra_direct")) {
+                    ra_direct = var_map["fdcache_ra_direct"].as<bool>();
+                }
+                if (var_map.count ("block_cache_size")) {
+                    block_cache_size = 
+                                 var_map["block_cache_size"].as<uint64_t>();
+                }
+                extract_str (var_map, "l2_cache_dir", l2_cache_dir);
+                extract_val (var_map, "l2_cache_size", l2_cache_size);
+                if (var_map.count ("mrc_sampling")) {
+                    mrc_sampling = var_map["mrc_sampling"].as<uint32_t>();
+                }
+                if (var_map.count ("wb_cache_size")) {
+                    wb_cache_size = var_map["wb_cache_size"].as<uint64_t>();
+                }
+                extract_val (var_map, "wb_flush_interval", wb_flush_interval);
+                extract_val (var_map, "meta_l1_entries", meta_l1_entries);
+                extract_val (var_map, "meta_l1_ttl", meta_l1_ttl);
             }
         }
         
@@ -90,6 +348,45 @@ namespace openarchive
         int         get_log_level       (void) { return (log_level);       }
         bool        create_fast_threads (void) { return true;              }
         bool        create_slow_threads (void) { return false;             }
+        bool        numa_aware          (void) { return numa;              }
+        bool        plbuff_huge_pages   (void) { return plb_huge_pages;    }
+        bool        plbuff_mlock        (void) { return plb_mlock;         }
+        uint32_t    plbuff_prealloc     (void) { return plb_prealloc;      }
+        uint64_t    get_mem_budget      (void) { return mem_budget<<20;    }
+        uint32_t    get_mem_budget_wait (void) { return mem_budget_wait;   }
+        std::string get_allocator       (void) { return allocator;         }
+        bool        malloc_arenas       (void) { return arenas;            }
+        std::string get_copy_kernel     (void) { return copy_kernel;       }
+        uint32_t    get_lock_profiling  (void) { return lock_profiling;    }
+        std::string get_fdcache_policy  (void) { return fdcache_policy;    }
+        uint32_t    get_fdcache_ra_window (void) { return fdcache_ra_window; }
+        bool        fdcache_ra_direct   (void) { return ra_direct;         }
+        uint64_t    get_block_cache_size (void) { return block_cache_size<<20; }
+        std::string get_l2_cache_dir    (void) { return l2_cache_dir;      }
+        uint64_t    get_l2_cache_size   (void) { return l2_cache_size<<20; }
+        uint32_t    get_mrc_sampling    (void) { return mrc_sampling;      }
+        uint64_t    get_wb_cache_size   (void) { return wb_cache_size<<20; }
+        uint32_t    get_meta_l1_entries (void) { return meta_l1_entries;   }
+
+        std::chrono::milliseconds get_shutdown_timeout (void) 
+        { 
+            return std::chrono::milliseconds (shutdown_timeout);
+        }
+
+        std::chrono::milliseconds get_request_timeout (void) 
+        { 
+            return std::chrono::milliseconds (request_timeout);
+        }
+
+        std::chrono::milliseconds get_wb_flush_interval (void) 
+        { 
+            return std::chrono::milliseconds (wb_flush_interval);
+        }
+
+        std::chrono::milliseconds get_meta_l1_ttl (void) 
+        { 
+            return std::chrono::milliseconds (meta_l1_ttl);
+        }
 
         uint64_t    get_num_work_items (arch_op_type op_type) 
         { 
@@ -104,6 +401,51 @@ namespace openarchive
             return 0;
         }
 
+        uint32_t    get_job_weight (arch_op_type op_type)
+        {
+            switch (op_type)
+            {
+                case BACKUP:
+                     return backup_weight;
+                case ARCHIVE:
+                     return archive_weight;
+                case RESTORE:
+                     return restore_weight;
+            }
+
+            return 1;
+        }
+
+        uint32_t    get_job_max_inflight (arch_op_type op_type, 
+                                          uint32_t nthreads)
+        {
+            /*
+             * Unless configured otherwise, bulk jobs (backup/archive) are
+             * allowed to occupy only three fourths of the worker threads.
+             * This keeps threads available for restores which would
+             * otherwise have to wait for a long running batch to finish.
+             */
+            uint32_t bulk_limit = nthreads - nthreads/4;
+            if (!bulk_limit) {
+                bulk_limit = 1;
+            }
+
+            switch (op_type)
+            {
+                case BACKUP:
+                     return (backup_max_inflight? backup_max_inflight:
+                                                  bulk_limit);
+                case ARCHIVE:
+                     return (archive_max_inflight? archive_max_inflight:
+                                                   bulk_limit);
+                case RESTORE:
+                     return (restore_max_inflight? restore_max_inflight:
+                                                   nthreads);
+            }
+
+            return nthreads;
+        }
+
         bool        extent_based_backups (arch_loc_t &loc) 
         {
             /*
@@ -1,5 +1,6 @@
 #include <cvlt_iopx.h>
 #include <arch_tls.h>
+#include <arch_copy.h>
 
 namespace openarchive
 {
@@ -159,7 +160,8 @@ namespace openarchive
             return; 
         }
 
-        std::error_code cvlt_iopx::open (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::open (const file_ptr_t & fp,
+                                         const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -227,7 +229,7 @@ namespace openarchive
                  */ 
                 file_info_t info;
                 info.set_cvlt_stream (stream);
-                fp->set_file_info (get_name(), info);
+                fp->set_file_info (get_layer_id (), info);
 
             } else if (job_type == CVLT_RESTORE) {
 
@@ -246,7 +248,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code cvlt_iopx::close (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::close (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -265,7 +268,7 @@ namespace openarchive
             if (job_type == CVLT_FULL_BACKUP || job_type == CVLT_INCR_BACKUP) {
 
                 file_info_t info;
-                if (!fp->get_file_info (get_name(), info)) {
+                if (!fp->get_file_info (get_layer_id (), info)) {
 
                     BOOST_LOG_FUNCTION ();
                     BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
@@ -287,7 +290,7 @@ namespace openarchive
                 /*
                  * Drop the stream from map.
                  */
-                fp->erase_file_info (get_name());
+                fp->erase_file_info (get_layer_id ());
             }
                 
             return openarchive::success;
@@ -313,7 +316,7 @@ namespace openarchive
             if (job_type == CVLT_FULL_BACKUP || job_type == CVLT_INCR_BACKUP) {
 
                 file_info_t info;
-                if (!fp.get_file_info (get_name(), info)) {
+                if (!fp.get_file_info (get_layer_id (), info)) {
 
                     BOOST_LOG_FUNCTION ();
                     BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
@@ -335,13 +338,14 @@ namespace openarchive
                 /*
                  * Drop the stream from map.
                  */
-                fp.erase_file_info (get_name());
+                fp.erase_file_info (get_layer_id ());
             }
 
             return openarchive::success;
         }
 
-        std::error_code cvlt_iopx::pread (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::pread (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -409,7 +413,7 @@ namespace openarchive
             }
 
             std::error_code ec = receive_data (num, cvguid, (char *) buff, len,
-                                               offset, async_io, ret);
+                                               offset, req, ret);
 
             if (ec != ok) {
                 BOOST_LOG_FUNCTION ();
@@ -437,7 +441,8 @@ namespace openarchive
    
         } 
 
-        std::error_code cvlt_iopx::pwrite (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::pwrite (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -451,7 +456,7 @@ namespace openarchive
             if (job_type == CVLT_FULL_BACKUP || job_type == CVLT_INCR_BACKUP) {
 
                 file_info_t info;
-                if (!fp->get_file_info (get_name(), info)) {
+                if (!fp->get_file_info (get_layer_id (), info)) {
 
                     BOOST_LOG_FUNCTION ();
                     BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
@@ -472,13 +477,19 @@ namespace openarchive
 
                 size_t len = req->get_len ();
 
+                std::error_code ec = req->check_deadline ();
+                if (ec != ok) {
+                    return ec;
+                }
+
                 return stream->send_data ((char *)buff, len);
             } 
 
             return (std::error_code (ENOSYS, std::generic_category()));
         } 
 
-        std::error_code cvlt_iopx::fstat (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::fstat (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -492,7 +503,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::stat (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::stat (const file_ptr_t & fp,
+                                         const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -506,7 +518,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::ftruncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::ftruncate (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -520,7 +533,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::truncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::truncate (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -534,7 +548,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::fsetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::fsetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -548,7 +563,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::setxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::setxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -562,7 +578,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         } 
 
-        std::error_code cvlt_iopx::fgetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::fgetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -576,7 +593,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::getxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::getxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -590,7 +608,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }  
 
-        std::error_code cvlt_iopx::fremovexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::fremovexattr (const file_ptr_t & fp,
+                                                 const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -604,7 +623,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::removexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::removexattr (const file_ptr_t & fp,
+                                                const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -618,7 +638,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::lseek (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::lseek (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -632,7 +653,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::getuuid (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::getuuid (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -646,7 +668,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::gethosts (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::gethosts (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -660,7 +683,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::mkdir (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::mkdir (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -674,7 +698,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::resolve (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::resolve (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -688,7 +713,8 @@ namespace openarchive
             return (std::error_code (ENOSYS, std::generic_category()));
         }
 
-        std::error_code cvlt_iopx::dup (file_ptr_t src_fp, file_ptr_t dest_fp)
+        std::error_code cvlt_iopx::dup (const file_ptr_t & src_fp,
+                                        const file_ptr_t & dest_fp)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -719,7 +745,8 @@ namespace openarchive
             }
         } 
 
-        std::error_code cvlt_iopx::scan (file_ptr_t fp, req_ptr_t req)
+        std::error_code cvlt_iopx::scan (const file_ptr_t & fp,
+                                         const req_ptr_t & req)
         {
             if (!ready) {
                 if (log_level >= openarchive::logger::level_error) {
@@ -1088,6 +1115,7 @@ namespace openarchive
                 ctx->iopx = this;
                 ctx->stream = s;
                 ctx->async_io = async_io; 
+                ctx->abandoned = false;
             }
 
             return ctx;
@@ -1107,9 +1135,15 @@ namespace openarchive
                                                  char * buffptr,
                                                  size_t bufflen, 
                                                  off_t offset,
-                                                 bool async_io,
+                                                 const req_ptr_t &req,
                                                  int64_t &ret)
         {
+            bool async_io = req->get_asyncio ();
+
+            std::error_code ec = req->check_deadline ();
+            if (ec != ok) {
+                return ec;
+            }
 
             /*
              * Allocate a stream to be used for restoring the file.
@@ -1167,7 +1201,23 @@ namespace openarchive
 
             if (!async_io) {
 
-                context->sem.wait ();
+                ec = wait_data (context, req);
+                if (ec != ok) {
+                    /*
+                     * The context now belongs to the callbacks.
+                     */
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " gave up waiting for data of "
+                                   << cvguid << " error : " << ec.value ();
+                    return ec;
+                }
+
+                /*
+                 * Drop the request from the map.
+                 */
+                request_map.erase (seq);
+
                 ret = context->ret;
                 if (ret < 0) {
                     return std::error_code (context->err, std::generic_category());
@@ -1184,8 +1234,66 @@ namespace openarchive
             return openarchive::success;
         }
 
+        std::error_code cvlt_iopx::wait_data (cvlt_cbk_context *ctx,
+                                              const req_ptr_t &req)
+        {
+            if (!req->has_deadline ()) {
+                ctx->sem.wait ();
+                return openarchive::success;
+            }
+
+            /*
+             * Wake up at least once a second to find out whether the job 
+             * has been cancelled.
+             */
+            while (true) {
+                openarchive::iopx_req::deadline_t wake =
+                                  std::chrono::steady_clock::now () + 
+                                  std::chrono::seconds (1);
+                if (req->get_deadline () < wake) {
+                    wake = req->get_deadline ();
+                }
+
+                if (!ctx->sem.timed_wait (wake)) {
+                    return openarchive::success;
+                }
+
+                std::error_code ec = req->check_deadline ();
+                if (ec == ok) {
+                    continue;
+                }
+
+                /*
+                 * The callback may have posted right after the wait timed
+                 * out. Both sides decide under the context lock.
+                 */
+                std::lock_guard<std::mutex> guard (ctx->mtx);
+                if (!ctx->sem.try_wait ()) {
+                    return openarchive::success;
+                }
+
+                ctx->abandoned = true;
+                return ec;
+            }
+        }
+
         void cvlt_iopx::run_cbk (cvlt_cbk_context *ctx)
         {
+            std::unique_lock<std::mutex> guard (ctx->mtx, std::defer_lock);
+
+            if (!ctx->async_io) {
+                guard.lock ();
+                if (ctx->abandoned) {
+                    /*
+                     * The reader is gone and so is its request.
+                     */
+                    guard.unlock ();
+                    release_stream (ctx->stream);
+                    release_ctx (ctx);
+                    return;
+                }
+            }
+
             /*
              * Extract the request corresponding to this callback context.
              */
@@ -1244,7 +1352,8 @@ namespace openarchive
             } else {
                 
                 /*
-                 * Wake up the thread waiting for data.
+                 * Wake up the thread waiting for data. The lock is held 
+                 * so that the thread cannot give up in the meanwhile.
                  */ 
                 ctx->sem.post ();
 
@@ -1450,6 +1559,9 @@ namespace openarchive
         }
 
  
+        static openarchive::arch_core::lock_stats stream_queue_stats (
+                                                         "cvlt stream queue");
+
         cvlt_stream_manager::cvlt_stream_manager (CVOB_hJob *job, 
                                                   uint32_t streams, 
                                                   libcvob_fops_t & fops,
@@ -1461,6 +1573,8 @@ namespace openarchive
                                                   sem (NULL),
                                                   fptrs (fops)
         {
+            queue_streams.set_stats (&stream_queue_stats);
+
             /*
              * Start allocating the required number of streams
              */
@@ -1664,6 +1778,14 @@ namespace openarchive
             static src::severity_logger<int> log;
             static int32_t log_level = openarchive::cfgparams::get_log_level ();
 
+            /*
+             * The callbacks run on the threads of the commvault library,
+             * keep their allocations apart from those of the worker 
+             * threads.
+             */
+            openarchive::arch_mem::bind_thread_arena (
+                                       openarchive::arch_mem::ARENA_CVLT_CBK);
+
             /*
              * Fill the needed information in the context structure.
              */
@@ -1688,6 +1810,9 @@ namespace openarchive
             static src::severity_logger<int> log;
             static int32_t log_level = openarchive::cfgparams::get_log_level ();
 
+            openarchive::arch_mem::bind_thread_arena (
+                                       openarchive::arch_mem::ARENA_CVLT_CBK);
+
             /*
              * Parse the metadata buffer and populate the required fields
              */ 
@@ -1738,6 +1863,9 @@ namespace openarchive
             static src::severity_logger<int> log;
             static int32_t log_level = openarchive::cfgparams::get_log_level ();
 
+            openarchive::arch_mem::bind_thread_arena (
+                                       openarchive::arch_mem::ARENA_CVLT_CBK);
+
             if (ctx->ret < 0) {
                 /*
                  * Error occured during earlier callback processing
@@ -1782,7 +1910,17 @@ namespace openarchive
 
             } else {
 
-                memcpy (tgtbuff+ctx->buff_offset, buffer, buff_size);
+                std::lock_guard<std::mutex> guard (ctx->mtx);
+
+                /*
+                 * The buffer of an abandoned request may already be in use
+                 * by another request.
+                 */
+                if (!ctx->abandoned) {
+                    openarchive::arch_copy::bulk_copy (
+                                               tgtbuff + ctx->buff_offset,
+                                               buffer, buff_size);
+                }
                 ctx->buff_offset += buff_size;
 
             }
@@ -1796,6 +1934,9 @@ namespace openarchive
             static src::severity_logger<int> log;
             static int32_t log_level = openarchive::cfgparams::get_log_level ();
 
+            openarchive::arch_mem::bind_thread_arena (
+                                       openarchive::arch_mem::ARENA_CVLT_CBK);
+
             if (log_level >= openarchive::logger::level_debug_2) {
 
                 BOOST_LOG_FUNCTION ();
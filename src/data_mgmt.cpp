@@ -32,6 +32,8 @@ namespace openarchive
                                      done (false) 
         {
             log_level = openarchive::cfgparams::get_log_level();
+            openarchive::arch_core::set_lock_profiling (
+                                 openarchive::cfgparams::get_lock_profiling ());
 
             engine = openarchive::arch_engine::alloc_engine ();
             if (!engine) {
@@ -61,7 +63,12 @@ namespace openarchive
             /*
              * Stop the memory profiler thread
              */ 
-            done.store (true);
+            {
+                std::lock_guard<std::mutex> guard (prof_mtx);
+                done.store (true);
+                prof_cv.notify_all ();
+            }
+
             if (memprof_th) {
                 memprof_th->join ();
                 delete memprof_th;
@@ -134,7 +141,11 @@ namespace openarchive
                                           false,
                                           0,
                                           false,
-                                          0
+                                          0,
+                                          0,
+                                          false,
+                                          0,
+                                          false
                                       }; 
 
             alloc_src_iopx (src_cfg);
@@ -153,8 +164,8 @@ namespace openarchive
              * sink iopx fops.
              */ 
 
-            file_ptr_t    fp      = file_pool.make_shared ();
-            req_ptr_t     req     = req_pool.make_shared ();
+            file_ptr_t    fp      = file_pool.make_intrusive ();
+            req_ptr_t     req     = req_pool.make_intrusive ();
 
             fp->set_loc (loc);
             fp->set_iopx (source); 
@@ -325,12 +336,37 @@ namespace openarchive
             dmstats_ptr_t dmp = dmstat_pool.make_shared ();
             std::list<std::string>::iterator iter;
 
+            /*
+             * The work items are handed over to the job scheduler rather
+             * than being posted to the ioservice directly, so that the
+             * other jobs running in parallel get their share of threads.
+             */
+            arch_sched_ptr_t sched = engine->get_scheduler (is_fast_iosvc);
+            if (!sched) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " no job scheduler for the "
+                               << (is_fast_iosvc? "fast": "slow")
+                               << " ioservice";
+                std::error_code ec (ENXIO, std::generic_category());
+                return (ec); 
+            }
+
+            uint32_t nthreads = (is_fast_iosvc? engine->get_num_fast_threads ():
+                                                engine->get_num_slow_threads ());
+            sched_job_ptr_t job = sched->add_job (collectfile,
+                       openarchive::cfgparams::get_job_weight (op_type),
+                       openarchive::cfgparams::get_job_max_inflight (op_type,
+                                                                     nthreads));
+
             for(iter = work_items_list.begin (); 
                 iter != work_items_list.end (); iter++) {
 
                 dmp->incr_pending (1);
-                src_iosvc->post (boost::bind (fptr, this, src, dest, *iter, dmp,
-                                              fftracker, cbki));
+                sched->submit (job, boost::bind (fptr, this, src, dest, *iter,
+                                                 dmp, fftracker, cbki),
+                               boost::bind (&data_mgmt::work_done_cbk, this,
+                                            cbki, dmp, -1, ECANCELED));
             }
              
             dmp->set_done ();
@@ -361,7 +397,15 @@ namespace openarchive
         {
             /*
              * Backup the list of files mentioned in src location.
+             *
+             * The files are read once from start to end, the fd-cache of
+             * the source reads them ahead into buffers of its own and
+             * sendfile writes those buffers to the sink without copying
+             * them. They are kept out of the caches shared with reads.
              */
+            uint32_t ra_window = 
+                          openarchive::cfgparams::get_fdcache_ra_window ();
+
             static iopx_tree_cfg_t src_cfg = {
                                                  src_loc.get_product (),
                                                  src_loc.get_store (),
@@ -369,8 +413,12 @@ namespace openarchive
                                                  true,
                                                  false,
                                                  0,
+                                                 true,
+                                                 fd_cache_size,
+                                                 ra_window,
                                                  false,
-                                                 0
+                                                 0,
+                                                 true
                                              }; 
 
             alloc_src_iopx (src_cfg);
@@ -392,7 +440,11 @@ namespace openarchive
                                                   false,
                                                   0,
                                                   false,
-                                                  0
+                                                  0,
+                                                  0,
+                                                  false,
+                                                  0,
+                                                  false
                                               }; 
 
             alloc_sink_iopx (sink_cfg);
@@ -636,7 +688,7 @@ namespace openarchive
              * the UUID aasociated with the file on destination store will be
              * set in the info field of the req. Get the UUID.
              */ 
-            uuid_parse (req->get_info().c_str(), uuid);
+            uuid_parse (req->get_info(), uuid);
 
             off_t offset = 0;
             size_t buffsize = bufp->get_size ();
@@ -709,7 +761,11 @@ namespace openarchive
                                                  false,
                                                  0,
                                                  false,
-                                                 0
+                                                 0,
+                                                 0,
+                                                 false,
+                                                 0,
+                                                 false
                                              }; 
 
             alloc_src_iopx (src_cfg);
@@ -979,7 +1035,11 @@ namespace openarchive
                                                   true,
                                                   meta_cache_ttl,
                                                   false,
-                                                  0
+                                                  0,
+                                                  0,
+                                                  false,
+                                                  0,
+                                                  false
                                               }; 
 
             alloc_src_iopx (src_cfg);
@@ -999,6 +1059,12 @@ namespace openarchive
              */ 
             src_iosvc = engine->get_ioservice (true);
 
+            /*
+             * The restore streams write the files in pieces, the sink tree
+             * coalesces them into full extents.
+             */
+            uint64_t wb_size = openarchive::cfgparams::get_wb_cache_size ();
+
             static iopx_tree_cfg_t sink_cfg = {
                                                   dest.get_product (),
                                                   dest.get_store (),
@@ -1007,7 +1073,11 @@ namespace openarchive
                                                   false,
                                                   0,
                                                   false,
-                                                  0
+                                                  0,
+                                                  0,
+                                                  false,
+                                                  wb_size,
+                                                  false
                                               };  
 
             alloc_sink_iopx (sink_cfg);
@@ -1021,10 +1091,26 @@ namespace openarchive
                 return (ec); 
             }
 
+            arch_sched_ptr_t sched = engine->get_scheduler (true);
+            if (!sched) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " no job scheduler for the fast ioservice";
+                std::error_code ec (ENXIO, std::generic_category());
+                return (ec); 
+            }
+
+            sched_job_ptr_t job = sched->add_job (src.get_pathstr (),
+                       openarchive::cfgparams::get_job_weight (RESTORE),
+                       openarchive::cfgparams::get_job_max_inflight (RESTORE,
+                                           engine->get_num_fast_threads ()));
+
             dmstats_ptr_t dmp = dmstat_pool.make_shared ();
             dmp->incr_pending (1);
-            src_iosvc->post(boost::bind(&data_mgmt::restore_worker, this,
-                                        src, dest, dmp,  cbki));
+            sched->submit (job, boost::bind (&data_mgmt::restore_worker, this,
+                                             src, dest, dmp,  cbki),
+                           boost::bind (&data_mgmt::work_done_cbk, this,
+                                        cbki, dmp, -1, ECANCELED));
             dmp->set_done ();
             return (openarchive::success);
         } 
@@ -1122,6 +1208,25 @@ namespace openarchive
 
             } while (sent > 0);
 
+            /*
+             * Close the file on the sink explicitly so that the data held
+             * by the write-back cache has reached the store before the
+             * restore is reported as done.
+             */
+            openarchive::iopx_req::init_close_req (sink_fp, req);
+
+            ec = sink->close (sink_fp, req);
+            if (ec != ok) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " close failed for file " 
+                               << loc.get_pathstr ()
+                               << " error code: " << ec.value ()
+                               << " error desc: " << ec.message ();
+                work_done_cbk (cbk, dmp, -1, ec.value ()); 
+                return ec;
+            }
+
             /*
              * The file has been restored successfully.
              */
@@ -1162,6 +1267,10 @@ namespace openarchive
             std::string store_id;
             map_store_id (loc->get_product (), loc->get_store (), store_id);
 
+            uint32_t ra_window = 
+                          openarchive::cfgparams::get_fdcache_ra_window ();
+            bool ra_direct = openarchive::cfgparams::fdcache_ra_direct ();
+
             static iopx_tree_cfg_t src_cfg = {
                                                  loc->get_product (),
                                                  store_id,
@@ -1170,7 +1279,11 @@ namespace openarchive
                                                  false,
                                                  0,
                                                  true,
-                                                 fd_cache_size
+                                                 fd_cache_size,
+                                                 ra_window,
+                                                 ra_direct,
+                                                 0,
+                                                 false
                                              }; 
 
             alloc_src_iopx (src_cfg);
@@ -1242,7 +1355,7 @@ namespace openarchive
              */ 
             file_info_t info;
             info.set_cbk_info (cbki);
-            fp->set_file_info ("arch_store", info);
+            fp->set_file_info (openarchive::arch_file::store_slot, info);
 
             ec =  source->pread (fp, req);
 
@@ -1261,6 +1374,32 @@ namespace openarchive
 
         }
 
+        std::error_code data_mgmt::cancel_job (const std::string & jname)
+        {
+            uint32_t count = 0;
+
+            /*
+             * The slow ioservice and its scheduler may not have been
+             * created.
+             */
+            arch_sched_ptr_t sched = engine->get_scheduler (true);
+            if (sched) {
+                count += sched->cancel_job (jname);
+            }
+
+            sched = engine->get_scheduler (false);
+            if (sched) {
+                count += sched->cancel_job (jname);
+            }
+
+            if (!count) {
+                std::error_code ec (ENOENT, std::generic_category ());
+                return (ec);
+            }
+
+            return (openarchive::success);
+        }
+
         void data_mgmt::work_done_cbk (arch_store_cbk_info_ptr_t cbk, 
                                        dmstats_ptr_t dmp, int32_t ret, 
                                        int32_t errnum)
@@ -1310,6 +1449,12 @@ namespace openarchive
             openarchive::iopx_req::init_read_req  (src_fp, req, offset, bytes, 
                                                    0, bufp);
 
+            /*
+             * Layers caching the file data can return a reference to their
+             * buffer, bufp is only filled when they cannot.
+             */
+            req->set_zcopy (true);
+
             std::error_code ec = source->pread (src_fp, req);
             if (ec != ok) {
                 BOOST_LOG_FUNCTION ();
@@ -1328,8 +1473,18 @@ namespace openarchive
                 /*
                  * The data read should be written to archive store.
                  */ 
-                openarchive::iopx_req::init_write_req  (dest_fp, req, offset, bytes,
-                                                        0, bufp);
+                if (!req->get_slice ().empty ()) {
+
+                    buff_slice_t slice = req->get_slice ();
+                    openarchive::iopx_req::init_write_req  (dest_fp, req, 
+                                                            offset, bytes,
+                                                            0, slice);
+                } else {
+
+                    openarchive::iopx_req::init_write_req  (dest_fp, req, 
+                                                            offset, bytes,
+                                                            0, bufp);
+                }
 
                 ec = sink->pwrite (dest_fp, req);
                 if (ec != ok) {
@@ -1345,6 +1500,7 @@ namespace openarchive
             }
 
             sent = req->get_ret ();
+            req->clear_slice ();
 
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -1578,6 +1734,8 @@ namespace openarchive
         void data_mgmt::mem_prof (void)
         {
             uint32_t count = 0;
+            openarchive::arch_mem::mem_governor_ptr_t governor = 
+                                openarchive::arch_mem::get_mem_governor ();
          
             while(!done.load()) {
 
@@ -1588,8 +1746,28 @@ namespace openarchive
                     log_memory_stats ();
                     count = 0;
                 }
+
+                /*
+                 * Once a minute give back the free memory held by the 
+                 * pools which have not been used since the last round.
+                 */
+                if (count && !(count % 600)) {
+                    governor->trim (false);
+                }
+
+                /*
+                 * Rank the named locks every 5 minutes when profiling.
+                 */
+                if (count && !(count % 3000) && 
+                    openarchive::arch_core::get_lock_sample_rate ().load ()) {
+                    log_lock_stats ();
+                }
  
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                {
+                    std::unique_lock<std::mutex> guard (prof_mtx);
+                    prof_cv.wait_for (guard, std::chrono::milliseconds(100),
+                                      [this] { return done.load (); });
+                }
                 count++;  
 
             }  
@@ -1675,6 +1853,27 @@ namespace openarchive
                                << memstats;
             }
 
+            mptr->get_arena_stats (memstats);
+            if (!memstats.empty ()) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << "allocator arena statistics:" << memstats;
+            }
+
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << "memory governor statistics:";
+            }
+
+            openarchive::arch_mem::get_mem_governor ()->getstats (memstats);
+
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << memstats;
+            }
+
             {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
@@ -1682,6 +1881,19 @@ namespace openarchive
             }
             log_tls_stats ();
 
+            /*
+             * Log the state of the job schedulers.
+             */
+            arch_sched_ptr_t sched = engine->get_scheduler (true);
+            if (sched) {
+                sched->profile ();
+            }
+
+            sched = engine->get_scheduler (false);
+            if (sched) {
+                sched->profile ();
+            }
+
             /*
              * Invoke the profiling for source and sink iopx.
              */ 
@@ -1697,6 +1909,69 @@ namespace openarchive
 
         }
 
+        void data_mgmt::log_lock_stats (void)
+        {
+            struct lock_totals
+            {
+                uint64_t acquired;
+                uint64_t contended;
+                uint64_t wait_ns;
+                uint64_t hold_ns;
+            };
+
+            /*
+             * Locks of the same family share a name, add them up.
+             */
+            std::map <std::string, lock_totals> totals;
+            uint64_t rate = 
+                     openarchive::arch_core::get_lock_sample_rate ().load ();
+            openarchive::arch_core::lock_stats * stats = 
+                        openarchive::arch_core::get_lock_stats_list ().load ();
+
+            for (; stats; stats = stats->get_next ()) {
+                lock_totals & tot = totals[stats->get_name ()];
+
+                tot.acquired += stats->acquired.load () * rate;
+                tot.contended += stats->contended.load ();
+                tot.wait_ns += stats->wait_ns.load () * rate;
+                tot.hold_ns += stats->hold_ns.load () * rate;
+            }
+
+            /*
+             * The locks threads spent the most time waiting for come first.
+             */
+            std::vector <std::pair <uint64_t, std::string>> ranked;
+            std::map <std::string, lock_totals>::iterator iter;
+
+            for (iter = totals.begin (); iter != totals.end (); iter++) {
+                ranked.push_back (std::make_pair (iter->second.wait_ns, 
+                                                  iter->first));
+            }
+
+            std::sort (ranked.rbegin (), ranked.rend ());
+
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << "lock statistics (estimated from one in " 
+                               << rate << " acquisitions):";
+            }
+
+            for (uint32_t count = 0; count < ranked.size (); count++) {
+                lock_totals & tot = totals[ranked[count].second];
+
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " lock: " << ranked[count].second
+                               << " acquired: " << tot.acquired
+                               << " contended: " << tot.contended
+                               << " wait ms: " << tot.wait_ns / 1000000
+                               << " hold ms: " << tot.hold_ns / 1000000;
+            }
+
+            return;
+        }
+
         void data_mgmt::log_tls_stats (void)
         {
             bool bfast = openarchive::cfgparams::create_fast_threads ();
@@ -0,0 +1,618 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <cfgparams.h>
+#include <block_cache.h>
+#include <disk_cache.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        /*
+         * crc32c, with the crc32 instruction of SSE 4.2 when the CPU has
+         * it and with a table otherwise.
+         */
+        static uint32_t crc_table[256];
+
+        static uint32_t crc32c_sw (uint32_t crc, const uint8_t *p, size_t len)
+        {
+            for (; len; len--, p++) {
+                crc = crc_table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+            }
+
+            return crc;
+        }
+
+#if defined(__x86_64__)
+        __attribute__ ((target ("sse4.2")))
+        static uint32_t crc32c_hw (uint32_t crc, const uint8_t *p, size_t len)
+        {
+            uint64_t crc64 = crc;
+
+            for (; len >= 8; len -= 8, p += 8) {
+                uint64_t val;
+                memcpy (&val, p, sizeof (val));
+                crc64 = _mm_crc32_u64 (crc64, val);
+            }
+
+            crc = (uint32_t) crc64;
+            for (; len; len--, p++) {
+                crc = _mm_crc32_u8 (crc, *p);
+            }
+
+            return crc;
+        }
+#endif
+
+        struct crc_dispatch
+        {
+            typedef uint32_t (*crc_kernel_t) (uint32_t, const uint8_t *,
+                                              size_t);
+            crc_kernel_t kernel;
+
+            crc_dispatch (void): kernel (crc32c_sw)
+            {
+                for (uint32_t idx = 0; idx < 256; idx++) {
+                    uint32_t val = idx;
+                    for (int bit = 0; bit < 8; bit++) {
+                        val = (val >> 1) ^ ((val & 1)? 0x82F63B78: 0);
+                    }
+                    crc_table[idx] = val;
+                }
+
+#if defined(__x86_64__)
+                __builtin_cpu_init ();
+                if (__builtin_cpu_supports ("sse4.2")) {
+                    kernel = crc32c_hw;
+                }
+#endif
+            }
+        };
+
+        uint32_t crc32c (const void *buf, size_t len)
+        {
+            static crc_dispatch dispatch;
+
+            return ~dispatch.kernel (~0U, (const uint8_t *) buf, len);
+        }
+
+        uint32_t freq_sketch::index (size_t hash, uint32_t row)
+        {
+            uint64_t val = ((uint64_t) hash + row) * 0x9E3779B97F4A7C15ULL;
+            return row * width + (uint32_t) (val >> 51);
+        }
+
+        uint32_t freq_sketch::add (size_t hash)
+        {
+            uint32_t est = 15;
+
+            for (uint32_t row = 0; row < rows; row++) {
+                uint8_t & counter = counters[index (hash, row)];
+                if (counter < 15) {
+                    counter++;
+                }
+                est = std::min (est, (uint32_t) counter);
+            }
+
+            /*
+             * Age the counts once the sketch has seen a few times as many
+             * misses as it has counters in a row.
+             */
+            if (++additions >= 10 * width) {
+                std::vector <uint8_t>::iterator iter;
+                for (iter = counters.begin (); iter != counters.end ();
+                     iter++) {
+                    *iter >>= 1;
+                }
+                additions = 0;
+            }
+
+            return est;
+        }
+
+        static bool read_full (int fd, void *buf, size_t len, off_t offset)
+        {
+            char *ptr = (char *) buf;
+
+            while (len) {
+                ssize_t ret = ::pread (fd, ptr, len, offset);
+                if (ret <= 0) {
+                    if (ret < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                ptr += ret;
+                offset += ret;
+                len -= ret;
+            }
+
+            return true;
+        }
+
+        static bool write_full (int fd, const void *buf, size_t len,
+                                off_t offset)
+        {
+            const char *ptr = (const char *) buf;
+
+            while (len) {
+                ssize_t ret = ::pwrite (fd, ptr, len, offset);
+                if (ret <= 0) {
+                    if (ret < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                ptr += ret;
+                offset += ret;
+                len -= ret;
+            }
+
+            return true;
+        }
+
+        disk_cache::disk_cache (std::string path, uint64_t bytes):
+                                dir (path), budget (bytes), used (0),
+                                stop (false), hits (0), misses (0),
+                                admits (0), rejects (0), evictions (0),
+                                corrupt (0)
+        {
+            log_level = openarchive::cfgparams::get_log_level ();
+
+            /*
+             * The paths of the files found at startup are compared with
+             * the paths built from their headers.
+             */
+            while (dir.size () > 1 && dir[dir.size () - 1] == '/') {
+                dir.erase (dir.size () - 1);
+            }
+
+            recover ();
+            writer = std::thread (boost::bind (&disk_cache::write_loop, this));
+        }
+
+        disk_cache::~disk_cache (void)
+        {
+            {
+                std::lock_guard<std::mutex> guard (wr_lock);
+                stop = true;
+            }
+
+            wr_cv.notify_all ();
+            writer.join ();
+        }
+
+        std::string disk_cache::get_path (const disk_key &key)
+        {
+            std::string uid = boost::uuids::to_string (key.uid);
+            char name[64];
+
+            snprintf (name, sizeof (name), "-%016llx-%016llx.blk",
+                      (unsigned long long) key.offset,
+                      (unsigned long long) key.version);
+
+            /*
+             * Spread the files over 256 directories.
+             */
+            return (dir + "/" + uid.substr (0, 2) + "/" + uid + name);
+        }
+
+        void disk_cache::recover (void)
+        {
+            namespace fs = boost::filesystem;
+
+            boost::system::error_code bec;
+            std::vector <std::string> stale;
+            std::vector <disk_key> victims;
+
+            fs::create_directories (dir, bec);
+
+            fs::recursive_directory_iterator iter (dir, bec);
+            fs::recursive_directory_iterator end;
+
+            for (; !bec && iter != end; iter.increment (bec)) {
+
+                if (!fs::is_regular_file (iter->status ())) {
+                    continue;
+                }
+
+                std::string path = iter->path ().string ();
+                std::string ext = iter->path ().extension ().string ();
+
+                if (ext == ".tmp") {
+                    /*
+                     * Left behind by a crash in the middle of a write.
+                     */
+                    stale.push_back (path);
+                    continue;
+                }
+
+                if (ext != ".blk") {
+                    continue;
+                }
+
+                disk_block_hdr hdr;
+                bool valid = false;
+
+                int fd = ::open (path.c_str (), O_RDONLY);
+                if (fd >= 0) {
+                    valid = read_full (fd, &hdr, sizeof (hdr), 0);
+                    close (fd);
+                }
+
+                disk_key key;
+                if (valid) {
+                    memcpy (key.uid.data, hdr.uid, sizeof (hdr.uid));
+                    key.offset = hdr.offset;
+                    key.version = hdr.version;
+
+                    /*
+                     * The data itself is checked when the block is read.
+                     */
+                    valid = (hdr.magic == disk_block_magic &&
+                             hdr.format == disk_block_format &&
+                             hdr.bytes && hdr.bytes <= block_size &&
+                             fs::file_size (iter->path (), bec) ==
+                             disk_data_offset + hdr.bytes &&
+                             get_path (key) == path &&
+                             index.find (key) == index.end ());
+                }
+
+                if (!valid) {
+                    stale.push_back (path);
+                    continue;
+                }
+
+                insert (key, hdr.bytes);
+            }
+
+            /*
+             * The cap may have been lowered since the last run.
+             */
+            evict (victims);
+
+            std::vector <disk_key>::iterator kiter;
+            for (kiter = victims.begin (); kiter != victims.end (); kiter++) {
+                stale.push_back (get_path (*kiter));
+            }
+
+            std::vector <std::string>::iterator siter;
+            for (siter = stale.begin (); siter != stale.end (); siter++) {
+                unlink (siter->c_str ());
+            }
+
+            BOOST_LOG_FUNCTION ();
+            BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                           << " l2 cache " << dir << " recovered "
+                           << index.size () << " blocks, " << used
+                           << " bytes, dropped " << stale.size () << " files";
+        }
+
+        bool disk_cache::insert (const disk_key &key, uint32_t bytes)
+        {
+            entry ent = { bytes, false, ring.end () };
+
+            std::pair <index_t::iterator, bool> res =
+                                     index.insert (std::make_pair (key, ent));
+            if (!res.second) {
+                return false;
+            }
+
+            res.first->second.pos = ring.insert (ring.end (), key);
+            used += disk_data_offset + bytes;
+
+            return true;
+        }
+
+        void disk_cache::evict (std::vector <disk_key> &victims)
+        {
+            for (size_t count = 2 * ring.size (); count && used > budget;
+                 count--) {
+
+                index_t::iterator it = index.find (ring.front ());
+                assert (it != index.end ());
+
+                if (it->second.ref) {
+                    it->second.ref = false;
+                    ring.splice (ring.end (), ring, ring.begin ());
+                    continue;
+                }
+
+                ring.pop_front ();
+                used -= disk_data_offset + it->second.bytes;
+                victims.push_back (it->first);
+                index.erase (it);
+                evictions++;
+            }
+
+            return;
+        }
+
+        void disk_cache::drop (const disk_key &key)
+        {
+            {
+                std::lock_guard<std::mutex> guard (lock);
+
+                index_t::iterator it = index.find (key);
+                if (it == index.end ()) {
+                    return;
+                }
+
+                ring.erase (it->second.pos);
+                used -= disk_data_offset + it->second.bytes;
+                index.erase (it);
+            }
+
+            unlink (get_path (key).c_str ());
+            return;
+        }
+
+        bool disk_cache::read (const disk_key &key, plbuff_ptr_t plbuff,
+                               uint32_t &bytes)
+        {
+            {
+                std::lock_guard<std::mutex> guard (lock);
+
+                index_t::iterator it = index.find (key);
+                if (it == index.end ()) {
+                    misses.fetch_add (1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                it->second.ref = true;
+                bytes = it->second.bytes;
+            }
+
+            if (bytes > plbuff->get_size ()) {
+                drop (key);
+                return false;
+            }
+
+            std::string path = get_path (key);
+            disk_block_hdr hdr;
+            bool valid = false;
+
+            int fd = ::open (path.c_str (), O_RDONLY);
+            if (fd >= 0) {
+                valid = read_full (fd, &hdr, sizeof (hdr), 0) &&
+                        read_full (fd, plbuff->get_base (), bytes,
+                                   disk_data_offset);
+                close (fd);
+            }
+
+            valid = valid && hdr.magic == disk_block_magic &&
+                    hdr.format == disk_block_format &&
+                    !memcmp (hdr.uid, key.uid.data, sizeof (hdr.uid)) &&
+                    hdr.offset == key.offset && hdr.version == key.version &&
+                    hdr.bytes == bytes &&
+                    hdr.crc == crc32c (plbuff->get_base (), bytes);
+
+            if (!valid) {
+                corrupt++;
+                drop (key);
+
+                if (log_level >= openarchive::logger::level_error) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " dropped invalid l2 cache block "
+                                   << path;
+                }
+                return false;
+            }
+
+            hits.fetch_add (1, std::memory_order_relaxed);
+            return true;
+        }
+
+        void disk_cache::admit (const disk_key &key, plbuff_ptr_t plbuff)
+        {
+            if (!plbuff->get_bytes () || plbuff->get_bytes () > block_size) {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard (lock);
+
+                if (index.find (key) != index.end ()) {
+                    return;
+                }
+
+                if (sketch.add (disk_key_hash () (key)) < disk_admit_misses) {
+                    rejects++;
+                    return;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> guard (wr_lock);
+
+                /*
+                 * Blocks are dropped rather than queued without limit when
+                 * the disk cannot keep up.
+                 */
+                if (stop || queue.size () >= disk_max_pending) {
+                    rejects++;
+                    return;
+                }
+
+                std::deque <pending>::iterator iter;
+                for (iter = queue.begin (); iter != queue.end (); iter++) {
+                    if (iter->key == key) {
+                        return;
+                    }
+                }
+
+                pending pend = { key, plbuff };
+                queue.push_back (pend);
+            }
+
+            admits++;
+            wr_cv.notify_one ();
+            return;
+        }
+
+        bool disk_cache::write_block (const pending &pend)
+        {
+            std::string path = get_path (pend.key);
+            std::string tmp = path + ".tmp";
+            uint32_t bytes = pend.plbuff->get_bytes ();
+            char hdr_block[disk_data_offset];
+            disk_block_hdr hdr;
+
+            hdr.magic = disk_block_magic;
+            hdr.format = disk_block_format;
+            memcpy (hdr.uid, pend.key.uid.data, sizeof (hdr.uid));
+            hdr.offset = pend.key.offset;
+            hdr.version = pend.key.version;
+            hdr.bytes = bytes;
+            hdr.crc = crc32c (pend.plbuff->get_base (), bytes);
+
+            memset (hdr_block, 0, sizeof (hdr_block));
+            memcpy (hdr_block, &hdr, sizeof (hdr));
+
+            boost::system::error_code bec;
+            boost::filesystem::create_directories (
+                          boost::filesystem::path (path).parent_path (), bec);
+
+            int fd = ::open (tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0) {
+                return false;
+            }
+
+            bool done = write_full (fd, hdr_block, sizeof (hdr_block), 0) &&
+                        write_full (fd, pend.plbuff->get_base (), bytes,
+                                    disk_data_offset);
+            close (fd);
+
+            if (!done || rename (tmp.c_str (), path.c_str ())) {
+                if (log_level >= openarchive::logger::level_error) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " failed to write l2 cache block "
+                                   << path << " error code: " << errno
+                                   << " error desc: " << strerror (errno);
+                }
+
+                unlink (tmp.c_str ());
+                return false;
+            }
+
+            return true;
+        }
+
+        void disk_cache::write_loop (void)
+        {
+            while (true) {
+                pending pend;
+
+                {
+                    std::unique_lock<std::mutex> lk (wr_lock);
+
+                    while (!stop && queue.empty ()) {
+                        wr_cv.wait (lk);
+                    }
+
+                    /*
+                     * Blocks still queued at shutdown are not written, the
+                     * cache only holds data which can be read again.
+                     */
+                    if (stop) {
+                        return;
+                    }
+
+                    pend = queue.front ();
+                    queue.pop_front ();
+                }
+
+                if (!write_block (pend)) {
+                    continue;
+                }
+
+                std::vector <disk_key> victims;
+                {
+                    std::lock_guard<std::mutex> guard (lock);
+
+                    insert (pend.key, pend.plbuff->get_bytes ());
+                    evict (victims);
+                }
+
+                std::vector <disk_key>::iterator iter;
+                for (iter = victims.begin (); iter != victims.end (); iter++) {
+                    unlink (get_path (*iter).c_str ());
+                }
+            }
+        }
+
+        void disk_cache::getstats (std::string &stat)
+        {
+            uint64_t blocks, bytes;
+
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                blocks = index.size ();
+                bytes = used;
+            }
+
+            stat = " l2 cache: " + dir +
+                   " cap: " + boost::lexical_cast <std::string> (budget) +
+                   " used: " + boost::lexical_cast <std::string> (bytes) +
+                   " blocks: " + boost::lexical_cast <std::string> (blocks) +
+                   " hits: " +
+                   boost::lexical_cast <std::string> (hits.load ()) +
+                   " misses: " +
+                   boost::lexical_cast <std::string> (misses.load ()) +
+                   " admits: " +
+                   boost::lexical_cast <std::string> (admits.load ()) +
+                   " rejects: " +
+                   boost::lexical_cast <std::string> (rejects.load ()) +
+                   " evictions: " +
+                   boost::lexical_cast <std::string> (evictions.load ()) +
+                   " corrupt: " +
+                   boost::lexical_cast <std::string> (corrupt.load ());
+            return;
+        }
+
+        static std::mutex disk_cache_lock;
+
+        disk_cache_ptr_t get_disk_cache (void)
+        {
+            std::lock_guard<std::mutex> guard (disk_cache_lock);
+
+            static bool init = false;
+            static disk_cache_ptr_t cache_ptr;
+
+            if (!init) {
+                std::string dir = openarchive::cfgparams::get_l2_cache_dir ();
+                uint64_t size = openarchive::cfgparams::get_l2_cache_size ();
+
+                if (!dir.empty () && size) {
+                    cache_ptr = boost::make_shared <disk_cache> (dir, size);
+                }
+                init = true;
+            }
+
+            return cache_ptr;
+        }
+    }
+}
@@ -74,35 +74,74 @@ namespace openarchive
             return;
         }
 
+        static openarchive::arch_core::lock_stats fdlock_stats (
+                                                            "fdcache fdlock");
+        static openarchive::arch_core::lock_stats rqlock_stats (
+                                                            "fdcache rqlock");
+
         fdcache_iopx::fdcache_iopx (std::string name, io_service_ptr_t svc,
-                                    uint32_t num):
+                                    uint32_t num, uint32_t ra_window,
+                                    bool direct, bool priv):
                                     openarchive::arch_iopx::arch_iopx (name, svc),
-                                    capacity(num+1),
+                                    capacity(num? num: 1),
+                                    ra_max_window (ra_window),
+                                    ra_direct (direct),
+                                    shared (!priv),
                                     file_pool ("filepool"),
                                     req_pool ("reqpool"),
-                                    buff_pool ("rabuffpool")
+                                    blocks (get_block_cache ()),
+                                    disk (priv? disk_cache_ptr_t ():
+                                                 get_disk_cache ()),
+                                    file_mrc (openarchive::cfgparams::
+                                              get_mrc_sampling ()),
+                                    block_mrc (openarchive::cfgparams::
+                                               get_mrc_sampling ())
         {
 
             log_level = openarchive::cfgparams::get_log_level();
+            fdlock.set_stats (&fdlock_stats);
+            rqlock.set_stats (&rqlock_stats);
+
             /*
              * Reserve memory in the vector. 
              */
             fd_queue.reserve (capacity);
+            uuid_map.reserve (capacity);
 
             for(uint32_t count = 0; count < capacity; count++) {
                 struct vec_entry ventry;
                 init_vec_entry (ventry);
                 ventry.op_mtx = boost::make_shared<std::mutex> ();
                 ventry.rabuff.rd_mtx = boost::make_shared<std::mutex> ();
+                ventry.ra_mtx = boost::make_shared<std::mutex> ();
+                ventry.ra_cv = boost::make_shared<std::condition_variable> ();
+                ventry.ra.gen = 0;
+                ventry.ra.pf.resize (ra_max_window);
+                ventry.snap = boost::make_shared<std::atomic<ra_snapshot *>> (
+                                                                       nullptr);
+                reset_ra_state (ventry);
                 fd_queue.push_back (ventry);                
+                free_slots.push_back (capacity - count - 1);
             }
 
-            front = rear = 0;
+            policy = make_repl_policy (
+                           openarchive::cfgparams::get_fdcache_policy (),
+                           capacity);
         }
 
         fdcache_iopx::~fdcache_iopx (void)
         {
-            req_ptr_t req = req_pool.make_shared ();
+            /*
+             * Wait for the prefetch reads before closing the files.
+             */
+            if (drain () != ok) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " closing the files with reads still"
+                               << " in flight";
+            }
+
+            req_ptr_t req = req_pool.make_intrusive ();
 
             wrlock_guard_t guard (&fdlock);
 
@@ -115,13 +154,22 @@ namespace openarchive
                     }
  
                 }
+
+                openarchive::arch_core::hazard_retire (
+                                  fd_queue[slot].snap->exchange (nullptr));
             }
+
+            /*
+             * No reader is left, free the snapshots retired by this cache
+             * before the buffer pool goes away.
+             */
+            openarchive::arch_core::get_hazard_domain ().reclaim ();
         } 
 
         std::error_code fdcache_iopx::search_fd (file_ptr_t fp)
         {
-            std::string uid = fp->get_loc ().get_uuidstr ();
-            std::map <std::string, map_entry>::iterator it;
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            uuid_map_t::iterator it;
             file_ptr_t cache_fp;
             uint32_t slot;
 
@@ -141,6 +189,7 @@ namespace openarchive
                              */ 
                      
                             cache_fp = fd_queue[slot].fp;
+                            policy->hit (slot);
                         }
                     }
                 } 
@@ -162,7 +211,7 @@ namespace openarchive
                          */  
                         file_info_t info;
                         info.set_slot_num (slot);
-                        fp->set_file_info (get_name (), info);
+                        fp->set_file_info (get_layer_id (), info);
                     }
 
                     return ec;
@@ -179,8 +228,8 @@ namespace openarchive
                                                   uint32_t & close_slot,
                                                   bool & needs_close)
         {
-            std::string uid = fp->get_loc ().get_uuidstr ();
-            std::map <std::string, map_entry>::iterator it;
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            uuid_map_t::iterator it;
 
             wrlock_guard_t guard (&fdlock);
 
@@ -194,7 +243,9 @@ namespace openarchive
                 free_slot = it->second.index;
                 if (!fd_queue[free_slot].valid && !fd_queue[free_slot].busy) { 
                     reserve_vec_entry (fd_queue[free_slot]);
+                    publish (fd_queue[free_slot]);
                 }
+                policy->hit (free_slot);
                 return openarchive::success;
             }
 
@@ -202,33 +253,35 @@ namespace openarchive
              * No entry exists in the map currently. We will make the 
              * necessary allocations and get out of this funtion. File
              * specific opens/initializations will be done in other functions.
-             * We will first allocate an entry in the circular buffer and then
-             * update the entry in map.  
+             * We will first allocate a slot and then update the entry in
+             * map.  
              */
             
-            if ((front+1) % capacity ==  rear) {
+            if (free_slots.empty ()) {
 
                 /*
-                 * Circular buffer is full. Move the rear forward to 
-                 * make space for new entry.
+                 * All the slots are in use. Let the replacement policy
+                 * pick the slot to be recycled.
                  */
-
-                if (fd_queue[rear].busy || fd_queue[rear].rabuff.busy) {
+                int32_t slot = policy->victim (
+                                  boost::bind (&fdcache_iopx::is_evictable, 
+                                               this, _1));
+                if (slot < 0) {
                     /*
-                     * This is a busy slot.
+                     * All the candidate slots are busy.
                      */
                     return std::error_code (EADDRINUSE, std::generic_category());
                 }
 
-                if (fd_queue[rear].valid) {
+                if (fd_queue[slot].valid) {
 
                     /*
-                     * We are about to remove the entry from circular buffer.
-                     * It is not necessary to invoke the close here. Close will
+                     * We are about to remove the entry from the cache. It is
+                     * not necessary to invoke the close here. Close will
                      * be invoked before allocating a new file descriptor.
                      */
 
-                    std::string id = fd_queue[rear].fp->get_loc ().get_uuidstr ();
+                    uuid_key_t id = fd_queue[slot].fp->get_loc ().get_uuidkey ();
                     it = uuid_map.find (id);
                     if (it != uuid_map.end ()) {
                         /*
@@ -237,25 +290,24 @@ namespace openarchive
                         uuid_map.erase (it);
                     } 
                   
-                    init_vec_entry (fd_queue[rear]); 
-                    close_slot = rear; 
+                    init_vec_entry (fd_queue[slot]); 
+                    reset_ra_state (fd_queue[slot]);
+                    publish (fd_queue[slot]);
+                    close_slot = slot; 
                     needs_close = true;
                 }
 
-                rear=(rear+1) % capacity;
-
+                free_slots.push_back (slot);
             }
 
-            reserve_vec_entry (fd_queue[front]);
+            free_slot = free_slots.back ();
+            free_slots.pop_back ();
+
+            reserve_vec_entry (fd_queue[free_slot]);
             if (lock_rabuf) {
-                reserve_ra_buf (fd_queue[front].rabuff);
+                reserve_ra_buf (fd_queue[free_slot].rabuff);
             }
-            free_slot = front;
-
-            /*
-             * Update front for the next insertion
-             */ 
-            front = (front+1) % capacity;
+            policy->insert (free_slot, uid);
 
             /*
              * Found a slot.
@@ -268,7 +320,7 @@ namespace openarchive
             /*
              * Save the index in map
              */
-            uuid_map.insert (std::pair<std::string, map_entry> (uid, mentry));
+            uuid_map.insert (std::pair<uuid_key_t, map_entry> (uid, mentry));
         
             return openarchive::success;
 
@@ -282,7 +334,13 @@ namespace openarchive
            
             if (needs_close) {
                 assert (fd_queue[close_slot].valid == false);
-                get_first_child()->close (fd_queue[close_slot].fp, req);
+
+                /*
+                 * Fops take the file handle by reference, hold a reference
+                 * of our own while the slot is being recycled.
+                 */
+                file_ptr_t close_fp = fd_queue[close_slot].fp;
+                get_first_child()->close (close_fp, req);
             }
 
             {
@@ -290,7 +348,7 @@ namespace openarchive
 
                 if (fd_queue[free_slot].pending) { 
 
-                    fd_queue[free_slot].fp = file_pool.make_shared ();
+                    fd_queue[free_slot].fp = file_pool.make_intrusive ();
 
                     if (fd_queue[free_slot].fp) {
 
@@ -311,6 +369,8 @@ namespace openarchive
                             return (ec);
                         }
 
+                        set_file_version (fd_queue[free_slot].fp, req);
+
 
                         ec = get_first_child ()->dup (fd_queue[free_slot].fp,
                                                       fp);
@@ -320,8 +380,8 @@ namespace openarchive
                              * initialized, we will update the entries in the 
                              * map
                              */
-                            std::string uid = fp->get_loc ().get_uuidstr ();
-                            std::map <std::string, map_entry>::iterator it;
+                            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+                            uuid_map_t::iterator it;
 
                             wrlock_guard_t guard (&fdlock);
 
@@ -343,7 +403,7 @@ namespace openarchive
                              */  
                             file_info_t info;
                             info.set_slot_num (free_slot);
-                            fp->set_file_info (get_name (), info);
+                            fp->set_file_info (get_layer_id (), info);
 
                             if (log_level >= openarchive::logger::level_debug_2) {
                                 BOOST_LOG_FUNCTION ();
@@ -382,7 +442,7 @@ namespace openarchive
                          */  
                         file_info_t info;
                         info.set_slot_num (free_slot);
-                        fp->set_file_info (get_name (), info);
+                        fp->set_file_info (get_layer_id (), info);
                     }
 
                     return ec;
@@ -395,7 +455,6 @@ namespace openarchive
 
         std::error_code fdcache_iopx::get_fd (file_ptr_t fp)
         {
-            std::string uid = fp->get_loc ().get_uuidstr ();
             uint32_t free_slot, close_slot;
             bool bclose;
 
@@ -408,7 +467,7 @@ namespace openarchive
                 return ec; 
             }
 
-            req_ptr_t req = req_pool.make_shared ();
+            req_ptr_t req = req_pool.make_intrusive ();
 
             if (ec.value () == ENOENT) {
                 /*
@@ -451,15 +510,626 @@ namespace openarchive
             return false;
         }
 
+        /*
+         * Slots with an open or a read-ahead in progress cannot be
+         * recycled. Called with the fdlock held.
+         */
+        bool fdcache_iopx::is_evictable (uint32_t slot)
+        {
+            if (fd_queue[slot].busy || fd_queue[slot].rabuff.busy) {
+                return false;
+            }
+
+            mutex_guard_t guard (fd_queue[slot].ra_mtx);
+            return (fd_queue[slot].ra.inflight == 0);
+        }
+
+        /*
+         * Drop the read-ahead state of a slot which is being recycled.
+         * Called with the fdlock held exclusive and no prefetch in flight.
+         */
+        void fdcache_iopx::reset_ra_state (struct vec_entry &vec)
+        {
+            mutex_guard_t guard (vec.ra_mtx);
+
+            vec.ra.gen++;
+            vec.ra.next_offset = 0;
+            vec.ra.seq_run = 0;
+            vec.ra.rand_run = 0;
+            vec.ra.window = 0;
+            vec.ra.inflight = 0;
+
+            std::vector <pf_buf>::iterator iter;
+            for (iter = vec.ra.pf.begin (); iter != vec.ra.pf.end (); iter++) {
+                iter->valid = false;
+                iter->in_flight = false;
+                iter->offset = 0;
+                iter->bytes = 0;
+                iter->plbuff.reset ();
+            }
+
+            return;
+        }
+
+        bool fdcache_iopx::observe (file_ptr_t fp, req_ptr_t req)
+        {
+            file_info_t *info = fp->get_file_info (get_layer_id ());
+
+            if (!info || (!ra_max_window && !ra_direct)) {
+                return false;
+            }
+
+            struct vec_entry & vec = fd_queue[info->get_slot_num ()];
+            uint64_t offset = req->get_offset ();
+
+            mutex_guard_t guard (vec.ra_mtx);
+
+            /*
+             * Reads within the block of the previous read or within the
+             * block after it count as sequential.
+             */
+            uint64_t block = ra_bit_mask & vec.ra.next_offset;
+
+            if (offset >= block && 
+                offset < block + 2 * (uint64_t) ra_buff_size) {
+                vec.ra.seq_run++;
+                vec.ra.rand_run = 0;
+
+                if (!vec.ra.window && vec.ra.seq_run >= ra_seq_trigger) {
+                    vec.ra.window = std::min (ra_min_window, ra_max_window);
+                }
+            } else {
+                vec.ra.rand_run++;
+                vec.ra.seq_run = 0;
+                vec.ra.window = 0;
+            }
+
+            vec.ra.next_offset = offset + req->get_len ();
+
+            return (ra_direct && vec.ra.rand_run >= ra_rand_trigger);
+        }
+
+        plbuff_ptr_t fdcache_iopx::takebuff (file_ptr_t fp, req_ptr_t req)
+        {
+            /*
+             * Take the prefetched buffer holding the requested offset and
+             * make it the read-ahead buffer of the slot.
+             */
+            file_info_t *info = fp->get_file_info (get_layer_id ());
+            plbuff_ptr_t plbuff;
+
+            if (!info || !ra_max_window) {
+                return plbuff;
+            }
+
+            uint32_t slot = info->get_slot_num ();
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            struct vec_entry & vec = fd_queue[slot];
+            uint64_t gen;
+
+            {
+                rdlock_guard_t guard (&fdlock);
+
+                if (!vec.valid || vec.fp->get_loc ().get_uuidkey () != uid) {
+                    return plbuff;
+                }
+
+                mutex_guard_t ra_guard (vec.ra_mtx);
+                gen = vec.ra.gen;
+            }
+
+            uint64_t offset = req->get_offset ();
+            uint64_t block = ra_bit_mask & offset;
+
+            {
+                std::unique_lock<std::mutex> lock (*vec.ra_mtx);
+
+                while (true) {
+                    if (vec.ra.gen != gen) {
+                        /*
+                         * The slot has been recycled in the meanwhile.
+                         */
+                        return plbuff;
+                    }
+
+                    std::vector <pf_buf>::iterator iter;
+                    for (iter = vec.ra.pf.begin (); iter != vec.ra.pf.end ();
+                         iter++) {
+                        if ((iter->valid || iter->in_flight) &&
+                            iter->offset == block) {
+                            break;
+                        }
+                    }
+
+                    if (iter == vec.ra.pf.end ()) {
+                        return plbuff;
+                    }
+
+                    if (iter->valid) {
+                        if (offset >= iter->offset + iter->bytes) {
+                            return plbuff;
+                        }
+
+                        plbuff = iter->plbuff;
+                        iter->valid = false;
+                        iter->plbuff.reset ();
+
+                        /*
+                         * The reader caught up with the prefetch, keep
+                         * more buffers ahead of it.
+                         */
+                        if (vec.ra.window) {
+                            vec.ra.window = std::min (2 * vec.ra.window,
+                                                      ra_max_window);
+                        }
+                        break;
+                    }
+
+                    /*
+                     * The block is being prefetched. Synchronous readers
+                     * wait for it rather than reading it a second time.
+                     */
+                    if (req->get_asyncio ()) {
+                        return plbuff;
+                    }
+
+                    vec.ra_cv->wait_for (lock, std::chrono::seconds (1));
+                    if (req->check_deadline () != ok) {
+                        return plbuff;
+                    }
+                }
+            }
+
+            install (vec, uid, plbuff);
+
+            if (log_level >= openarchive::logger::level_debug_2) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
+                               << " took prefetched buffer for "
+                               << fp->get_loc().get_pathstr()
+                               << " @ slot " << slot
+                               << " offset: " << plbuff->get_offset ()
+                               << " len: " << plbuff->get_bytes ();
+            }
+
+            return plbuff;
+        }
+
+        /*
+         * Make a buffer holding a whole block of the file the read-ahead
+         * buffer of the slot, unless a read of the slot is in progress.
+         */
+        void fdcache_iopx::install (struct vec_entry &vec,
+                                    const uuid_key_t &uid,
+                                    plbuff_ptr_t plbuff)
+        {
+            wrlock_guard_t guard (&fdlock);
+
+            if (vec.valid && !vec.rabuff.busy &&
+                vec.fp->get_loc ().get_uuidkey () == uid) {
+                vec.rabuff.offset = plbuff->get_offset ();
+                vec.rabuff.bytes = plbuff->get_bytes ();
+                vec.rabuff.plbuff = plbuff;
+                mark_ra_buf_ready (vec.rabuff);
+                publish (vec);
+            }
+
+            return;
+        }
+
+        plbuff_ptr_t fdcache_iopx::sharedbuff (file_ptr_t fp, req_ptr_t req)
+        {
+            /*
+             * Look for the block in the cache shared by the trees, it may
+             * have been read through another tree or another slot.
+             */
+            file_info_t *info = fp->get_file_info (get_layer_id ());
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            uint64_t offset = req->get_offset ();
+            uint64_t version;
+
+            if (!info || !shared) {
+                return plbuff_ptr_t ();
+            }
+
+            {
+                rdlock_guard_t guard (&fdlock);
+
+                struct vec_entry & vec = fd_queue[info->get_slot_num ()];
+                if (!vec.valid || vec.fp->get_loc ().get_uuidkey () != uid ||
+                    !get_version (vec.fp, version)) {
+                    return plbuff_ptr_t ();
+                }
+            }
+
+            plbuff_ptr_t plbuff = blocks->lookup (uid, version,
+                                                  ra_bit_mask & offset);
+            if (!plbuff || offset >= plbuff->get_offset () + 
+                                     plbuff->get_bytes ()) {
+                return plbuff_ptr_t ();
+            }
+
+            install (fd_queue[info->get_slot_num ()], uid, plbuff);
+
+            return plbuff;
+        }
+
+        /*
+         * Size of a file just opened on the child, for the stores which do
+         * not set it on open (glusterfs), and version under which its
+         * blocks are kept in the block and disk caches, saved in the slot
+         * of this layer in the file. It follows the change time of the file on the
+         * store, which moves with every write. Stores which cannot stat an
+         * open file (Commvault) never rewrite an archived file, archiving
+         * it again gives it a new uuid, and only the store goes into the
+         * version. The blocks of a file whose version cannot be told are
+         * only kept in its read-ahead buffers.
+         */
+        void fdcache_iopx::set_file_version (file_ptr_t cache_fp,
+                                             req_ptr_t req)
+        {
+            struct stat st;
+            uint64_t version = std::hash<std::string> () (
+                                          cache_fp->get_loc ().get_store ()) *
+                               0x9E3779B97F4A7C15ULL;
+
+            init_fstat_req (cache_fp, req, &st);
+
+            std::error_code ec = get_first_child ()->fstat (cache_fp, req);
+            if (ec == ok) {
+                cache_fp->set_file_size (st.st_size);
+                version ^= (uint64_t) st.st_ctim.tv_sec * 1000000000ULL +
+                           st.st_ctim.tv_nsec;
+            } else if (ec.value () != ENOSYS) {
+                return;
+            }
+
+            file_info_t info;
+            info.set_disk_version (version);
+            cache_fp->set_file_info (get_layer_id (), info);
+
+            return;
+        }
+
+        bool fdcache_iopx::get_version (file_ptr_t cache_fp,
+                                        uint64_t &version)
+        {
+            file_info_t *info = cache_fp->get_file_info (get_layer_id ());
+            if (!info) {
+                return false;
+            }
+
+            version = info->get_disk_version ();
+
+            return true;
+        }
+
+        bool fdcache_iopx::get_disk_key (file_ptr_t cache_fp, uint64_t offset,
+                                         disk_key &key)
+        {
+            if (!get_version (cache_fp, key.version)) {
+                return false;
+            }
+
+            key.uid = cache_fp->get_loc ().get_uuidkey ();
+            key.offset = offset;
+
+            return true;
+        }
+
+        bool fdcache_iopx::read_disk (file_ptr_t cache_fp, req_ptr_t req,
+                                      plbuff_ptr_t plbuff)
+        {
+            disk_key key;
+            uint32_t bytes;
+
+            if (!disk || !get_disk_key (cache_fp, req->get_offset (), key) ||
+                !disk->read (key, plbuff, bytes)) {
+                return false;
+            }
+
+            req->set_ret (bytes);
+            return true;
+        }
+
+        /*
+         * Completion of an async read served by the disk cache.
+         */
+        void fdcache_iopx::read_disk_done (file_ptr_t cache_fp, req_ptr_t req)
+        {
+            pread_cbk (cache_fp, req, openarchive::success);
+            put ();
+
+            return;
+        }
+
+        void fdcache_iopx::admit_disk (file_ptr_t cache_fp, req_ptr_t req,
+                                       plbuff_ptr_t plbuff)
+        {
+            disk_key key;
+
+            if (!disk || req->get_ret () <= 0 ||
+                !get_disk_key (cache_fp, req->get_offset (), key)) {
+                return;
+            }
+
+            disk->admit (key, plbuff);
+
+            return;
+        }
+
+        /*
+         * Fill a buffer with a block, from the disk cache if it has it and
+         * from the child otherwise. The request is synchronous. The offset
+         * and bytes of the buffer are set here, before it is published or
+         * cached, and never change afterwards.
+         */
+        std::error_code fdcache_iopx::fetch (file_ptr_t cache_fp,
+                                             req_ptr_t req,
+                                             plbuff_ptr_t plbuff)
+        {
+            bool cached = read_disk (cache_fp, req, plbuff);
+
+            if (!cached) {
+                std::error_code ec = get_first_child ()->pread (cache_fp,
+                                                                req);
+                if (ec != ok) {
+                    return ec;
+                }
+            }
+
+            plbuff->set_offset (req->get_offset ());
+            plbuff->set_bytes (req->get_ret ());
+
+            if (!cached) {
+                admit_disk (cache_fp, req, plbuff);
+            }
+
+            return openarchive::success;
+        }
+
+        void fdcache_iopx::prefetch (file_ptr_t fp, req_ptr_t req)
+        {
+            /*
+             * Issue reads for the blocks of the window ahead of the
+             * reader which are neither read nor being read.
+             */
+            file_info_t *info = fp->get_file_info (get_layer_id ());
+
+            if (!info || !ra_max_window) {
+                return;
+            }
+
+            uint32_t slot = info->get_slot_num ();
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            uint64_t block = ra_bit_mask & req->get_offset ();
+            struct vec_entry & vec = fd_queue[slot];
+            std::vector <std::pair <uint32_t, uint64_t>> reads;
+            file_ptr_t cache_fp;
+
+            {
+                /*
+                 * The shared fdlock keeps the slot from being recycled
+                 * until the reads have been accounted in inflight.
+                 */
+                rdlock_guard_t guard (&fdlock);
+
+                if (!vec.valid || vec.fp->get_loc ().get_uuidkey () != uid) {
+                    return;
+                }
+
+                cache_fp = vec.fp;
+                uint64_t size = cache_fp->get_file_size ();
+                uint64_t version;
+                bool cached = shared && get_version (cache_fp, version);
+
+                mutex_guard_t ra_guard (vec.ra_mtx);
+
+                for (uint32_t ahead = 1; ahead <= vec.ra.window; ahead++) {
+                    uint64_t offset = block + ahead * (uint64_t) ra_buff_size;
+                    int32_t free_idx = -1;
+                    bool found = false;
+
+                    if (offset >= size) {
+                        break;
+                    }
+
+                    if (cached && blocks->contains (uid, version, offset)) {
+                        continue;
+                    }
+
+                    for (uint32_t idx = 0; idx < vec.ra.pf.size (); idx++) {
+                        pf_buf & pf = vec.ra.pf[idx];
+
+                        if ((pf.valid || pf.in_flight) && pf.offset == offset) {
+                            found = true;
+                            break;
+                        }
+
+                        /*
+                         * Buffers behind the reader can be reused.
+                         */
+                        if (free_idx < 0 && !pf.in_flight &&
+                            (!pf.valid || pf.offset < block)) {
+                            free_idx = idx;
+                        }
+                    }
+
+                    if (found) {
+                        continue;
+                    }
+
+                    if (free_idx < 0) {
+                        break;
+                    }
+
+                    pf_buf & pf = vec.ra.pf[free_idx];
+                    pf.valid = false;
+                    pf.in_flight = true;
+                    pf.offset = offset;
+                    pf.bytes = 0;
+                    pf.plbuff.reset ();
+                    vec.ra.inflight++;
+
+                    reads.push_back (std::make_pair (free_idx, offset));
+                }
+            }
+
+            std::vector <std::pair <uint32_t, uint64_t>>::iterator iter;
+            for (iter = reads.begin (); iter != reads.end (); iter++) {
+                get ();
+                get_iosvc ()->post (boost::bind (&fdcache_iopx::prefetch_read,
+                                                 this, cache_fp, slot,
+                                                 iter->first, iter->second));
+            }
+
+            return;
+        }
+
+        void fdcache_iopx::prefetch_read (file_ptr_t cache_fp, uint32_t slot,
+                                          uint32_t idx, uint64_t offset)
+        {
+            plbuff_ptr_t plbuff = blocks->alloc ();
+            req_ptr_t req = req_pool.make_intrusive ();
+            ssize_t ret = -1;
+            uint64_t version;
+
+            if (plbuff && req) {
+                struct iovec iov = { plbuff->get_base (), 
+                                     plbuff->get_size () };
+
+                init_read_req (cache_fp, req, offset, plbuff->get_size (), 0,
+                               &iov);
+                req->set_cancel_flag (get_cancel_flag ());
+
+                std::error_code ec = fetch (cache_fp, req, plbuff);
+                if (ec == ok) {
+                    ret = req->get_ret ();
+                    if (ret > 0 && shared && get_version (cache_fp,
+                                                          version)) {
+                        blocks->insert (cache_fp->get_loc ().get_uuidkey (),
+                                        version, plbuff);
+                    }
+                } else if (log_level >= openarchive::logger::level_error) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " prefetch failed for "
+                                   << cache_fp->get_loc ().get_pathstr ()
+                                   << " offset: " << offset
+                                   << " error code: " << ec.value ();
+                }
+            }
+
+            {
+                struct vec_entry & vec = fd_queue[slot];
+                mutex_guard_t guard (vec.ra_mtx);
+
+                pf_buf & pf = vec.ra.pf[idx];
+                pf.in_flight = false;
+                if (ret > 0) {
+                    pf.valid = true;
+                    pf.bytes = ret;
+                    pf.plbuff = plbuff;
+                }
+
+                vec.ra.inflight--;
+                vec.ra_cv->notify_all ();
+            }
+
+            put ();
+            return;
+        }
+
+        /*
+         * Publish the read-ahead buffer of the slot to the lock free hit
+         * path. Called with the fdlock held exclusive whenever the buffer
+         * or the file of the slot changes.
+         */
+        void fdcache_iopx::publish (struct vec_entry &vec)
+        {
+            ra_snapshot * snap = nullptr;
+
+            if (vec.valid && vec.fp && vec.rabuff.valid &&
+                vec.rabuff.plbuff) {
+                snap = new ra_snapshot;
+                snap->uid = vec.fp->get_loc ().get_uuidkey ();
+                snap->offset = vec.rabuff.offset;
+                snap->bytes = vec.rabuff.bytes;
+                snap->plbuff = vec.rabuff.plbuff;
+            }
+
+            /*
+             * A retired snapshot holds on to a block buffer outside of the
+             * block cache, have it freed as soon as no reader uses it.
+             */
+            openarchive::arch_core::hazard_retire (vec.snap->exchange (snap),
+                                                   true);
+
+            return;
+        }
+
+        bool fdcache_iopx::fastbuff (file_ptr_t fp, req_ptr_t req)
+        {
+            /*
+             * Serve the read from the published snapshot of the read-ahead
+             * buffer without taking the fdlock. Anything else, including
+             * EOF, is left to the locked path.
+             */
+            file_info_t *info = fp->get_file_info (get_layer_id ());
+
+            if (!info) {
+                return false;
+            }
+
+            uint32_t slot = info->get_slot_num ();
+            uint64_t offset = req->get_offset ();
+            uint64_t len = req->get_len ();
+
+            {
+                openarchive::arch_core::hazard_ptr hazard;
+                ra_snapshot * snap = hazard.protect (*fd_queue[slot].snap);
+
+                if (!snap || snap->uid != fp->get_loc ().get_uuidkey () ||
+                    offset < snap->offset ||
+                    offset + len > snap->offset + snap->bytes) {
+                    return false;
+                }
+
+                uint64_t delta_offset = offset - snap->offset;
+
+                if (req->get_zcopy ()) {
+                    req->set_slice (buff_slice_t (snap->plbuff, delta_offset,
+                                                  len));
+                } else {
+                    void *buff = openarchive::iopx_req::get_buff_baseaddr (req);
+
+                    assert (buff != NULL);
+
+                    memcpy (buff, (char *)snap->plbuff->get_base () +
+                            delta_offset, len);
+                }
+            }
+
+            req->set_ret (len);
+            policy->touch (slot);
+
+            if (req->get_asyncio ()) {
+                get_parent()->pread_cbk (req->get_fptr (), req,
+                                         openarchive::success);
+            }
+
+            return true;
+        }
+
         plbuff_ptr_t fdcache_iopx::checkbuff (file_ptr_t fp, req_ptr_t req, 
                                               bool &eof)
         {
-            file_info_t info;
+            file_info_t *info = fp->get_file_info (get_layer_id ());
             plbuff_ptr_t plbuff;
 
             eof = false;
 
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!info) {
                 /*
                  * fd-cache may not be enabled for this file.
                  */
@@ -472,13 +1142,13 @@ namespace openarchive
                 return plbuff;
             } 
 
-            uint32_t slot = info.get_slot_num ();
-            std::string uid = fp->get_loc ().get_uuidstr ();
+            uint32_t slot = info->get_slot_num ();
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
         
             {
                 rdlock_guard_t guard (&fdlock);
 
-                if (fd_queue[slot].fp->get_loc ().get_uuidstr() == uid) {
+                if (fd_queue[slot].fp->get_loc ().get_uuidkey() == uid) {
 
                     /*
                      * The slot still contains the same file
@@ -519,8 +1189,7 @@ namespace openarchive
                          */
                             
                         plbuff = fd_queue[slot].rabuff.plbuff; 
-                        plbuff->set_offset (fd_queue[slot].rabuff.offset);
-                        plbuff->set_bytes (fd_queue[slot].rabuff.bytes);
+                        policy->touch (slot);
                 
                         if (log_level >= openarchive::logger::level_debug_2) {
                             BOOST_LOG_FUNCTION ();
@@ -550,10 +1219,29 @@ namespace openarchive
              */
             plbuff_ptr_t plbuff;
             uint32_t slot; 
-            std::string uid = fp->get_loc ().get_uuidstr ();
-            std::map <std::string, map_entry>::iterator it;
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+            uuid_map_t::iterator it;
             bool reserve = false;
 
+            /*
+             * Most lookups are hits, look for one with the fdlock held
+             * shared and take it exclusive only to reserve the buffer.
+             */
+            {
+                rdlock_guard_t guard (&fdlock);
+
+                it = uuid_map.find (uid);
+
+                if (it != uuid_map.end () && it->second.valid) {
+                    slot = it->second.index;
+                    if (is_validslot (req, slot)) {
+                        plbuff = fd_queue[slot].rabuff.plbuff;
+                        policy->touch (slot);
+                        return plbuff;
+                    }
+                }
+            }
+
             {
 
                 wrlock_guard_t guard (&fdlock);
@@ -572,8 +1260,7 @@ namespace openarchive
                                  */
                                 
                                 plbuff = fd_queue[slot].rabuff.plbuff; 
-                                plbuff->set_offset (fd_queue[slot].rabuff.offset);
-                                plbuff->set_bytes (fd_queue[slot].rabuff.bytes);
+                                policy->touch (slot);
 
                                 if (log_level >= openarchive::logger::level_debug_2) {
                                     BOOST_LOG_FUNCTION ();
@@ -631,10 +1318,19 @@ namespace openarchive
              * the read request. We will fill the buffer with data, to service
              * future read requests.
              */
-            req_ptr_t req = req_pool.make_shared ();
-            std::string uid = fp->get_loc ().get_uuidstr ();
+            req_ptr_t req = req_pool.make_intrusive ();
+            uuid_key_t uid = fp->get_loc ().get_uuidkey ();
             std::error_code ec;
 
+            /*
+             * The read-ahead request is bound by the deadline of the read
+             * which triggered it. It does not take the cancel flag of the
+             * job, since the buffer it fills is shared with other jobs, but
+             * the one of the layer, set when its drain gives up.
+             */
+            req->set_deadline (read_req->get_deadline ());
+            req->set_cancel_flag (get_cancel_flag ());
+
             if (slot < 0) {
                 /*
                  * We will have to allocate a slot here
@@ -680,7 +1376,7 @@ namespace openarchive
  
         }
 
-        std::error_code fdcache_iopx::readdata_sync (std::string &uuid,
+        std::error_code fdcache_iopx::readdata_sync (const uuid_key_t & uuid,
                                                      file_ptr_t fp, 
                                                      req_ptr_t read_req,
                                                      req_ptr_t req,
@@ -703,7 +1399,7 @@ namespace openarchive
                  * Read is still pending. Issue a read request to 
                  * child iopx.
                  */  
-                plbuff = buff_pool.make_shared ();
+                plbuff = blocks->alloc ();
                 if (plbuff) {
                     
                     struct iovec iov = { plbuff->get_base (), 
@@ -714,8 +1410,8 @@ namespace openarchive
                                     plbuff->get_size (), 0, &iov);
 
 
-                    std::error_code ec =  get_first_child () ->pread (fd_queue[slot].fp, 
-                                                                      req);
+                    file_ptr_t cache_fp = fd_queue[slot].fp;
+                    std::error_code ec = fetch (cache_fp, req, plbuff);
                     if (ec != ok) {
 
                         BOOST_LOG_FUNCTION ();
@@ -736,10 +1432,14 @@ namespace openarchive
                         fd_queue[slot].rabuff.bytes = req->get_ret ();
                         fd_queue[slot].rabuff.plbuff = plbuff;
                         mark_ra_buf_ready (fd_queue[slot].rabuff);
+                        publish (fd_queue[slot]);
                     }
 
-                    plbuff->set_offset (req->get_offset ());
-                    plbuff->set_bytes (req->get_ret ());
+                    uint64_t version;
+                    if (shared && req->get_ret () > 0 &&
+                        get_version (cache_fp, version)) {
+                        blocks->insert (uuid, version, plbuff);
+                    }
 
                     if (log_level >= openarchive::logger::level_debug_2) {
                         BOOST_LOG_FUNCTION ();
@@ -758,12 +1458,12 @@ namespace openarchive
             }
 
             {
-                std::string uid = fp->get_loc ().get_uuidstr (); 
-                std::string slot_uid;
+                uuid_key_t uid = fp->get_loc ().get_uuidkey ();
+                uuid_key_t slot_uid;
 
                 rdlock_guard_t guard (&fdlock);
 
-                slot_uid = fd_queue[slot].fp->get_loc ().get_uuidstr ();
+                slot_uid = fd_queue[slot].fp->get_loc ().get_uuidkey ();
 
                 if (uid == slot_uid) {
                     if (is_validslot (read_req, slot)) {
@@ -782,7 +1482,7 @@ namespace openarchive
 
         }
 
-        std::error_code fdcache_iopx::readdata_async (std::string &uuid,
+        std::error_code fdcache_iopx::readdata_async (const uuid_key_t & uuid,
                                                       file_ptr_t fp, 
                                                       req_ptr_t read_req,
                                                       req_ptr_t req,
@@ -807,7 +1507,7 @@ namespace openarchive
                  * Read is still pending and no read request has been 
                  * issused. Issue a read request to child iopx.
                  */  
-                plbuff = buff_pool.make_shared ();
+                plbuff = blocks->alloc ();
                 if (plbuff) {
                         
                     struct iovec iov = { plbuff->get_base (), 
@@ -834,7 +1534,23 @@ namespace openarchive
 
                     fd_queue[slot].rabuff.rd_in_progress = true;
 
-                    ec =  get_first_child()->pread (fd_queue[slot].fp, req);
+                    file_ptr_t cache_fp = fd_queue[slot].fp;
+
+                    /*
+                     * A block found in the disk cache is read inline. The
+                     * completion is posted, like the one of the child: it
+                     * calls back into the parent, which may read the slot
+                     * again while rd_mtx is held here.
+                     */
+                    if (read_disk (cache_fp, req, plbuff)) {
+                        get ();
+                        get_iosvc ()->post (boost::bind (
+                                           &fdcache_iopx::read_disk_done,
+                                           this, cache_fp, req));
+                        return openarchive::success;
+                    }
+
+                    ec =  get_first_child()->pread (cache_fp, req);
                     if (ec != ok) {
 
                         BOOST_LOG_FUNCTION ();
@@ -905,13 +1621,24 @@ namespace openarchive
             uint64_t max_offset = plbuff->get_offset () + plbuff->get_bytes ();
             uint64_t max_bytes = max_offset - req->get_offset ();
             uint64_t bytes = ((len > max_bytes)? max_bytes : len);  
-            void *buff = openarchive::iopx_req::get_buff_baseaddr (req);
             uint64_t delta_offset = offset - (plbuff->get_offset ());
 
-            assert (buff != NULL);
+            if (req->get_zcopy ()) {
+                /*
+                 * The read-ahead buffer is never refilled in place, hand a
+                 * reference to the data to the reader instead of copying.
+                 */
+                req->set_slice (buff_slice_t (plbuff, delta_offset, bytes));
 
-            memcpy (buff, (char *)plbuff->get_base () + delta_offset,
-                    bytes);  
+            } else {
+
+                void *buff = openarchive::iopx_req::get_buff_baseaddr (req);
+
+                assert (buff != NULL);
+
+                memcpy (buff, (char *)plbuff->get_base () + delta_offset,
+                        bytes);
+            }
 
             req->set_ret (bytes); 
 
@@ -935,7 +1662,7 @@ namespace openarchive
             return openarchive::success;
         } 
 
-        std::error_code fdcache_iopx::add_gen_req (std::string & uuid,
+        std::error_code fdcache_iopx::add_gen_req (const uuid_key_t & uuid,
                                                    uint32_t slot, 
                                                    req_ptr_t gen_req, 
                                                    plbuff_ptr_t plbuff,
@@ -955,7 +1682,7 @@ namespace openarchive
              * requests in the map. If an entry already exists then it
              * is an error.
              */   
-            std::map <std::string, rqmap_entry>::iterator iter;
+            request_map_t::iterator iter;
             iter = request_map.find (uuid);
             if (iter != request_map.end ()) {
                 /*
@@ -964,17 +1691,17 @@ namespace openarchive
                 return std::error_code (EALREADY, std::generic_category ()); 
             }
 
-            request_map.insert (std::pair<std::string, rqmap_entry> (uuid, 
+            request_map.insert (std::pair<uuid_key_t, rqmap_entry> (uuid, 
                                                                      rqe));
 
             return openarchive::success;
 
         }
 
-        std::error_code fdcache_iopx::add_parent_req (std::string & uuid, 
+        std::error_code fdcache_iopx::add_parent_req (const uuid_key_t & uuid, 
                                                       req_ptr_t req)
         {
-            std::map <std::string, rqmap_entry>::iterator iter;
+            request_map_t::iterator iter;
        
             openarchive::arch_core::spinlock_handle handle(rqlock);
 
@@ -990,9 +1717,9 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code fdcache_iopx::del_req (std::string & uuid)
+        std::error_code fdcache_iopx::del_req (const uuid_key_t & uuid)
         {
-            std::map <std::string, rqmap_entry>::iterator iter;
+            request_map_t::iterator iter;
 
             openarchive::arch_core::spinlock_handle handle(rqlock);
 
@@ -1008,7 +1735,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code fdcache_iopx::open (file_ptr_t fp, req_ptr_t req)
+        std::error_code fdcache_iopx::open (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             if (req->get_flags() & O_WRONLY || req->get_flags () & O_RDWR) {
 
@@ -1020,6 +1748,9 @@ namespace openarchive
                  * The file is being opened in read-only mode. fd-caching 
                  * can be enabled for this file.
                  */
+                uuid_hash_t hash;
+                file_mrc.access (hash (fp->get_loc ().get_uuidkey ()));
+
                 for(uint32_t attempt = 0; attempt < 3; attempt++) {
 
                     std::error_code ec = get_fd (fp);
@@ -1054,7 +1785,8 @@ namespace openarchive
 
         }
 
-        std::error_code fdcache_iopx::pread (file_ptr_t fp, req_ptr_t req)
+        std::error_code fdcache_iopx::pread (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
 
             /*
@@ -1063,30 +1795,86 @@ namespace openarchive
              */
             bool retry = false;
             bool eof = false; 
+            std::error_code ec;
+
+            block_mrc.access (uuid_hash_t () (fp->get_loc ().get_uuidkey ()) ^
+                              (req->get_offset () >> ra_bit_width) *
+                              0x9E3779B97F4A7C15ULL);
+
+            /*
+             * Hits on the read-ahead buffer are served without locks. They
+             * are not observed, a sequential reader shows its pattern with
+             * the read which moves it on to the next buffer.
+             */
+            if (fastbuff (fp, req)) {
+                return openarchive::success;
+            }
+
+            bool direct = observe (fp, req);
    
             do {
+                ec = req->check_deadline ();
+                if (ec != ok) {
+                    return ec;
+                }
+
                 plbuff_ptr_t plbuff = checkbuff (fp, req, eof);
                 if (eof) {
                     return openarchive::success;
                 }
 
                 if (plbuff) {
-                    return processbuff (plbuff, fp, req);    
+                    ec = processbuff (plbuff, fp, req);    
+                    prefetch (fp, req);
+                    return ec;
+                }
+
+                if (direct && !req->get_asyncio ()) {
+                    /*
+                     * Random reads go to the child as they are instead of
+                     * pulling in a whole read-ahead buffer each.
+                     */
+                    return (get_first_child ()->pread (fp, req));
+                }
+
+                plbuff = takebuff (fp, req);
+                if (plbuff) {
+                    ec = processbuff (plbuff, fp, req);    
+                    prefetch (fp, req);
+                    return ec;
+                }
+
+                plbuff = sharedbuff (fp, req);
+                if (plbuff) {
+                    ec = processbuff (plbuff, fp, req);    
+                    prefetch (fp, req);
+                    return ec;
                 }
             
                 int32_t slot;
                 plbuff = getbuff (fp, req, slot);
                 if (plbuff) {
-                    return processbuff (plbuff, fp, req);    
+                    ec = processbuff (plbuff, fp, req);    
+                    prefetch (fp, req);
+                    return ec;
                 }   
 
-                std::error_code ec = readdata (fp, req, slot, retry);
+                ec = readdata (fp, req, slot, retry);
                 if (ec == ok) {
+                    prefetch (fp, req);
                     return ec;
                 }
 
             } while (retry); 
 
+            if (ec.value () == ENOMEM) {
+                /*
+                 * No read-ahead buffer could be allocated within the memory
+                 * budget. Read just the requested range from the child.
+                 */
+                return (readthrough (fp, req));
+            }
+
             /*
              * The read request cannot be satisfied by the current contents
              * of read buffer. Flag an error.
@@ -1101,7 +1889,34 @@ namespace openarchive
             return std::error_code (ENOENT, std::generic_category ());
         }
 
-        std::error_code fdcache_iopx::pread_cbk (file_ptr_t fp, req_ptr_t req,
+        std::error_code fdcache_iopx::readthrough (file_ptr_t fp, 
+                                                   req_ptr_t req)
+        {
+            /*
+             * The child completes async reads through the read-ahead 
+             * callback of this layer, which only knows about read-ahead
+             * buffers. The read is issued synchronously and an async
+             * caller is called back from here.
+             */
+            bool async_io = req->get_asyncio ();
+
+            req->set_asyncio (false);
+            std::error_code ec = get_first_child ()->pread (fp, req);
+            req->set_asyncio (async_io);
+
+            if (async_io) {
+                if (ec != ok) {
+                    req->set_ret (-1);
+                }
+
+                get_parent()->pread_cbk (req->get_fptr (), req, ec);
+            }
+
+            return ec;
+        }
+
+        std::error_code fdcache_iopx::pread_cbk (const file_ptr_t & fp,
+                                                 const req_ptr_t & req,
                                                  std::error_code ec)
         {
             /*
@@ -1109,8 +1924,8 @@ namespace openarchive
              * Update the read-ahead buffer and call callbacks for any 
              * outstanding read requests from parent iopx.
              */
-            std::map <std::string, rqmap_entry>::iterator iter;
-            std::string uuid = fp->get_loc ().get_uuidstr ();
+            request_map_t::iterator iter;
+            uuid_key_t uuid = fp->get_loc ().get_uuidkey ();
 
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -1138,14 +1953,22 @@ namespace openarchive
             /*
              * The data has been read. Now update the queue slot.
              */
+            iter->second.plbuff->set_offset (req->get_offset());
+            iter->second.plbuff->set_bytes (req->get_ret ());
+
             {
                 wrlock_guard_t guard (&fdlock);
                 fd_queue[slot].rabuff.offset = req->get_offset ();
                 fd_queue[slot].rabuff.bytes = req->get_ret ();
                 fd_queue[slot].rabuff.plbuff = iter->second.plbuff;
                 mark_ra_buf_ready (fd_queue[slot].rabuff);
-                iter->second.plbuff->set_offset (req->get_offset());
-                iter->second.plbuff->set_bytes (req->get_ret ());
+                publish (fd_queue[slot]);
+            }
+
+            uint64_t version;
+            if (shared && req->get_ret () > 0 && get_version (fp, version)) {
+                blocks->insert (uuid, version, iter->second.plbuff);
+                admit_disk (fp, req, iter->second.plbuff);
             }
 
             /*
@@ -1197,13 +2020,53 @@ namespace openarchive
                                << stats;
             }
 
-            buff_pool.getstats (stats);
+            blocks->getstats (stats);
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << stats;
+            }
+
+            if (disk) {
+                disk->getstats (stats);
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << stats;
+            }
+
+            /*
+             * Sizes are in files for the first curve and in 4MB blocks for
+             * the second one.
+             */
+            file_mrc.getstats (stats);
             {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " fd-cache file mrc capacity: " << capacity
                                << stats;
             }
 
+            block_mrc.getstats (stats);
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " fd-cache block mrc" << stats;
+            }
+
+            {
+                /*
+                 * The lists of the policy only change under the exclusive
+                 * fdlock.
+                 */
+                rdlock_guard_t guard (&fdlock);
+                policy->getstats (stats);
+            }
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " fd-cache" << stats;
+            }
+
             get_first_child ()->profile ();
 
             return;
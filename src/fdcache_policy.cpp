@@ -0,0 +1,314 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fdcache_policy.h>
+
+namespace openarchive
+{
+    namespace fdcache_iopx
+    {
+        repl_policy::repl_policy (uint32_t num): capacity (num),
+                                                 ref (new std::atomic<bool>
+                                                          [num]),
+                                                 keys (num),
+                                                 hits (0), misses (0),
+                                                 ghost_hits (0), evictions (0)
+        {
+            for (uint32_t slot = 0; slot < capacity; slot++) {
+                ref[slot].store (false);
+            }
+        }
+
+        void repl_policy::getstats (std::string &stat)
+        {
+            /*
+             * The counters are not read atomically with respect to each
+             * other, they are good enough for trending.
+             */
+            stat = " policy: " + get_name () +
+                   " hits: " +
+                   boost::lexical_cast <std::string> (hits.load ()) +
+                   " misses: " +
+                   boost::lexical_cast <std::string> (misses.load ()) +
+                   " ghost hits: " +
+                   boost::lexical_cast <std::string> (ghost_hits.load ()) +
+                   " evictions: " +
+                   boost::lexical_cast <std::string> (evictions.load ());
+            return;
+        }
+
+        fifo_policy::fifo_policy (uint32_t num): repl_policy (num)
+        {
+        }
+
+        int32_t fifo_policy::victim (evictable_t evictable)
+        {
+            /*
+             * The oldest slot is the only candidate, the caller retries
+             * while it is in use.
+             */
+            if (queue.empty () || !evictable (queue.hand ())) {
+                return -1;
+            }
+
+            uint32_t slot = queue.hand ();
+            queue.pop ();
+            evictions++;
+
+            return slot;
+        }
+
+        void fifo_policy::insert (uint32_t slot, const uuid_key_t &key)
+        {
+            misses++;
+            keys[slot] = key;
+            queue.push (slot);
+
+            return;
+        }
+
+        twoq_policy::twoq_policy (uint32_t num): repl_policy (num),
+                                                 kin (std::max (1U, num / 4)),
+                                                 kout (std::max (1U, num / 2))
+        {
+        }
+
+        int32_t twoq_policy::evict_a1in (evictable_t &evictable)
+        {
+            /*
+             * Plain FIFO, a second use of a file while it is still on
+             * probation does not count.
+             */
+            for (size_t count = a1in.size (); count; count--) {
+                uint32_t slot = a1in.hand ();
+                a1in.pop ();
+
+                if (!evictable (slot)) {
+                    a1in.push (slot);
+                    continue;
+                }
+
+                a1out.push (keys[slot]);
+                if (a1out.size () > kout) {
+                    a1out.pop_oldest ();
+                }
+
+                return slot;
+            }
+
+            return -1;
+        }
+
+        int32_t twoq_policy::evict_am (evictable_t &evictable)
+        {
+            /*
+             * Two turns of the clock clear all the reference bits, slots
+             * still not picked after that are all in use.
+             */
+            for (size_t count = 2 * am.size (); count; count--) {
+                uint32_t slot = am.hand ();
+
+                if (test_and_clear (slot) || !evictable (slot)) {
+                    am.advance ();
+                    continue;
+                }
+
+                am.pop ();
+                return slot;
+            }
+
+            return -1;
+        }
+
+        int32_t twoq_policy::victim (evictable_t evictable)
+        {
+            int32_t slot;
+
+            if (a1in.size () > kin || am.empty ()) {
+                slot = evict_a1in (evictable);
+                if (slot < 0) {
+                    slot = evict_am (evictable);
+                }
+            } else {
+                slot = evict_am (evictable);
+                if (slot < 0) {
+                    slot = evict_a1in (evictable);
+                }
+            }
+
+            if (slot >= 0) {
+                evictions++;
+            }
+
+            return slot;
+        }
+
+        void twoq_policy::insert (uint32_t slot, const uuid_key_t &key)
+        {
+            misses++;
+            keys[slot] = key;
+            test_and_clear (slot);
+
+            if (a1out.remove (key)) {
+                ghost_hits++;
+                am.push (slot);
+            } else {
+                a1in.push (slot);
+            }
+
+            return;
+        }
+
+        arc_policy::arc_policy (uint32_t num): repl_policy (num), p (0)
+        {
+        }
+
+        int32_t arc_policy::victim (evictable_t evictable)
+        {
+            /*
+             * A referenced slot under the t1 hand has been used again and
+             * moves to t2, a referenced slot under the t2 hand gets another
+             * turn. Slots in use are skipped, and a clock whose slots are
+             * all in use is left alone. The sweep ends after two turns of
+             * both clocks at the most.
+             */
+            size_t t1_busy = 0;
+            size_t t2_busy = 0;
+
+            for (size_t count = 2 * (t1.size () + t2.size ()) + 1; count;
+                 count--) {
+
+                bool t2_usable = !t2.empty () && t2_busy < t2.size ();
+
+                if (!t1.empty () && t1_busy < t1.size () &&
+                    (t1.size () >= std::max (1U, p) || !t2_usable)) {
+
+                    uint32_t slot = t1.hand ();
+
+                    if (!evictable (slot)) {
+                        t1.advance ();
+                        t1_busy++;
+                        continue;
+                    }
+
+                    t1.pop ();
+                    if (test_and_clear (slot)) {
+                        t2.push (slot);
+                        continue;
+                    }
+
+                    b1.push (keys[slot]);
+                    evictions++;
+                    return slot;
+
+                } else if (t2_usable) {
+
+                    uint32_t slot = t2.hand ();
+
+                    if (!evictable (slot)) {
+                        t2.advance ();
+                        t2_busy++;
+                        continue;
+                    }
+
+                    if (test_and_clear (slot)) {
+                        t2.advance ();
+                        continue;
+                    }
+
+                    t2.pop ();
+                    b2.push (keys[slot]);
+                    evictions++;
+                    return slot;
+
+                } else {
+                    break;
+                }
+            }
+
+            return -1;
+        }
+
+        void arc_policy::insert (uint32_t slot, const uuid_key_t &key)
+        {
+            size_t nb1 = b1.size ();
+            size_t nb2 = b2.size ();
+
+            misses++;
+            keys[slot] = key;
+            test_and_clear (slot);
+
+            if (b1.remove (key)) {
+                /*
+                 * The file was evicted from t1 too early, grow t1.
+                 */
+                uint32_t delta = std::max ((size_t) 1, nb2 / nb1);
+                p = std::min (p + delta, capacity);
+                ghost_hits++;
+                t2.push (slot);
+
+            } else if (b2.remove (key)) {
+                /*
+                 * The file was evicted from t2 too early, shrink t1.
+                 */
+                uint32_t delta = std::max ((size_t) 1, nb1 / nb2);
+                p = (p > delta? p - delta: 0);
+                ghost_hits++;
+                t2.push (slot);
+
+            } else {
+                t1.push (slot);
+            }
+
+            /*
+             * Keep the history to the size of the cache for t1 and to
+             * twice the size of the cache overall.
+             */
+            while (b1.size () && t1.size () + b1.size () > capacity) {
+                b1.pop_oldest ();
+            }
+
+            while (b2.size () && t1.size () + t2.size () + b1.size () +
+                   b2.size () > 2 * capacity) {
+                b2.pop_oldest ();
+            }
+
+            return;
+        }
+
+        void arc_policy::getstats (std::string &stat)
+        {
+            repl_policy::getstats (stat);
+
+            stat += " t1: " + boost::lexical_cast <std::string> (t1.size ()) +
+                    " t2: " + boost::lexical_cast <std::string> (t2.size ()) +
+                    " b1: " + boost::lexical_cast <std::string> (b1.size ()) +
+                    " b2: " + boost::lexical_cast <std::string> (b2.size ()) +
+                    " p: "  + boost::lexical_cast <std::string> (p);
+            return;
+        }
+
+        repl_policy_ptr_t make_repl_policy (std::string name, uint32_t num)
+        {
+            if (name == "fifo") {
+                return boost::make_shared <fifo_policy> (num);
+            }
+
+            if (name == "2q") {
+                return boost::make_shared <twoq_policy> (num);
+            }
+
+            return boost::make_shared <arc_policy> (num);
+        }
+    }
+}
@@ -129,16 +129,20 @@ namespace openarchive
             }
 
             int ret=-1;
-            for(int count=0; count<3; count++) {
+            std::chrono::milliseconds backoff (100);
+            for(int count=0; count<5; count++) {
                 ret = fptrs.gl_init (glfs);
-                if (!ret) {
+                if (!ret || count == 4) {
                     break;
                 }
 
                 /*
-                 * Wait for sometime and reattempt the initialization.
+                 * Wait for sometime and reattempt the initialization. The
+                 * wait doubles on every attempt, a volume which is just
+                 * coming up is usually ready for the first retries.
                  */
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+                std::this_thread::sleep_for(backoff);
+                backoff *= 2;
             }
 
             if (ret) {
@@ -162,11 +166,14 @@ namespace openarchive
 
         gfapi_iopx::~gfapi_iopx(void)
         {
-            while (get_refcount () > 0 ) {
-                /*
-                 * Wait until there are no more active references
-                 */ 
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+            /*
+             * Wait until there are no more active references
+             */ 
+            if (drain () != ok) {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << " releasing the volume with requests"
+                               << " still in flight";
             }
 
             if (glfs) {
@@ -192,7 +199,8 @@ namespace openarchive
             glfs = NULL;
         } 
  
-        std::error_code gfapi_iopx::open (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::open (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -250,7 +258,7 @@ namespace openarchive
              */ 
             file_info_t info;
             info.set_glfd (glfd); 
-            fp->set_file_info (get_name(), info);
+            fp->set_file_info (get_layer_id (), info);
 
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -262,7 +270,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::close (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::close (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -281,7 +290,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
 
                 if (log_level >= openarchive::logger::level_debug_2) {
                     BOOST_LOG_FUNCTION ();
@@ -317,7 +326,7 @@ namespace openarchive
             /*
              * Drop the fd from map.
              */
-            fp->erase_file_info (get_name());
+            fp->erase_file_info (get_layer_id ());
   
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -348,7 +357,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp.get_file_info (get_name(), info)) {
+            if (!fp.get_file_info (get_layer_id (), info)) {
 
                 if (log_level >= openarchive::logger::level_debug_2) {
                     BOOST_LOG_FUNCTION ();
@@ -384,7 +393,7 @@ namespace openarchive
             /*
              * Drop the fd from map.
              */
-            fp.erase_file_info (get_name());
+            fp.erase_file_info (get_layer_id ());
   
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -396,7 +405,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::pread (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::pread (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -414,8 +424,8 @@ namespace openarchive
                 return (std::error_code (ENOSYS, std::generic_category()));
             }
 
-            file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            file_info_t * info = fp->get_file_info (get_layer_id ());
+            if (!info) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -425,7 +435,7 @@ namespace openarchive
                 return (std::error_code (ENOENT, std::generic_category()));
             }
  
-            glfd = info.get_glfd (); 
+            glfd = info->get_glfd (); 
             if (!glfd) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
@@ -441,6 +451,16 @@ namespace openarchive
 
             assert (buff != NULL);
 
+            /*
+             * The gfapi calls cannot be interrupted once issued, so the 
+             * deadline of the request is checked before issuing them.
+             */
+            std::error_code ec = req->check_deadline ();
+            if (ec != ok) {
+                req->set_ret (-1);
+                return ec;
+            }
+
             /*
              * Now we will perform pread on the extracted gluster fd.
              */
@@ -472,7 +492,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::pwrite (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::pwrite (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -490,8 +511,8 @@ namespace openarchive
                 return (std::error_code (ENOSYS, std::generic_category()));
             }
 
-            file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            file_info_t * info = fp->get_file_info (get_layer_id ());
+            if (!info) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -501,7 +522,7 @@ namespace openarchive
                 return (std::error_code (ENOENT, std::generic_category()));
             }
  
-            glfd = info.get_glfd (); 
+            glfd = info->get_glfd (); 
             if (!glfd) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
@@ -517,6 +538,16 @@ namespace openarchive
 
             assert (buff != NULL);
  
+            /*
+             * The gfapi calls cannot be interrupted once issued, so the 
+             * deadline of the request is checked before issuing them.
+             */
+            std::error_code ec = req->check_deadline ();
+            if (ec != ok) {
+                req->set_ret (-1);
+                return ec;
+            }
+
             /*
              * Now we will perform pwrite on the extracted gluster fd.
              */
@@ -548,7 +579,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::fstat (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::fstat (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -567,7 +599,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -609,7 +641,8 @@ namespace openarchive
             return openarchive::success;
         } 
 
-        std::error_code gfapi_iopx::stat (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::stat (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
           
             if (!ready) {
@@ -648,7 +681,8 @@ namespace openarchive
             return openarchive::success;
         } 
 
-        std::error_code gfapi_iopx::ftruncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::ftruncate (const file_ptr_t & fp,
+                                               const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -667,7 +701,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -706,7 +740,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::truncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::truncate (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
           
             if (!ready) {
@@ -743,7 +778,8 @@ namespace openarchive
             return openarchive::success;
         }
         
-        std::error_code gfapi_iopx::fsetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::fsetxattr (const file_ptr_t & fp,
+                                               const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -762,7 +798,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -788,7 +824,7 @@ namespace openarchive
 
             assert (buff != NULL);
 
-            int ret = fptrs.gl_fsetxattr (glfd, req->get_desc().c_str(),
+            int ret = fptrs.gl_fsetxattr (glfd, req->get_desc(),
                                           buff, req->get_len(),
                                           req->get_flags());
 
@@ -810,7 +846,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::setxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::setxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
           
             if (!ready) {
@@ -834,7 +871,7 @@ namespace openarchive
 
             int ret = fptrs.gl_setxattr (glfs, 
                                          fp->get_loc().get_pathstr().c_str(),
-                                         req->get_desc().c_str(),
+                                         req->get_desc(),
                                          buff, req->get_len(), 
                                          req->get_flags());
 
@@ -853,7 +890,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::fgetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::fgetxattr (const file_ptr_t & fp,
+                                               const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -872,7 +910,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -896,7 +934,7 @@ namespace openarchive
             void *buff = NULL;
             buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
 
-            int ret = fptrs.gl_fgetxattr (glfd, req->get_desc().c_str(),
+            int ret = fptrs.gl_fgetxattr (glfd, req->get_desc(),
                                           buff, req->get_len());
 
             if (ret < 0) {
@@ -916,7 +954,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::getxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::getxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
           
             if (!ready) {
@@ -938,7 +977,7 @@ namespace openarchive
 
             int ret = fptrs.gl_getxattr (glfs, 
                                          fp->get_loc().get_pathstr().c_str(),
-                                         req->get_desc().c_str(),
+                                         req->get_desc(),
                                          buff, req->get_len()); 
 
             if (ret < 0) {
@@ -958,7 +997,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::fremovexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::fremovexattr (const file_ptr_t & fp,
+                                                  const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -977,7 +1017,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -998,7 +1038,7 @@ namespace openarchive
                 return (std::error_code (ENXIO, std::generic_category()));
             }
 
-            int ret = fptrs.gl_fremovexattr (glfd, req->get_desc().c_str());
+            int ret = fptrs.gl_fremovexattr (glfd, req->get_desc());
 
             if (ret < 0) {
                 BOOST_LOG_FUNCTION ();
@@ -1015,7 +1055,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::removexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::removexattr (const file_ptr_t & fp,
+                                                 const req_ptr_t & req)
         {
           
             if (!ready) {
@@ -1034,7 +1075,7 @@ namespace openarchive
 
             int ret = fptrs.gl_removexattr (glfs, 
                                             fp->get_loc().get_pathstr().c_str(),
-                                            req->get_desc().c_str());
+                                            req->get_desc());
 
             if (ret < 0) {
                 BOOST_LOG_FUNCTION ();
@@ -1051,7 +1092,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::lseek (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::lseek (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             glfs_fd_t * glfd = NULL;
           
@@ -1070,7 +1112,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!fp->get_file_info (get_name(), info)) {
+            if (!fp->get_file_info (get_layer_id (), info)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -1111,7 +1153,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::mkdir (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::mkdir (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             if (!ready) {
                 BOOST_LOG_FUNCTION ();
@@ -1203,7 +1246,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code gfapi_iopx::getuuid (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::getuuid (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             if (!ready) {
                 BOOST_LOG_FUNCTION ();
@@ -1245,7 +1289,8 @@ namespace openarchive
 
         }
 
-        std::error_code gfapi_iopx::resolve (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::resolve (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             /*
              * Check whether sharding is enabled on the glusterfs volume. 
@@ -1419,7 +1464,8 @@ namespace openarchive
          
         }
             
-        std::error_code gfapi_iopx::gethosts (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::gethosts (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             /*
              * We will parse the gluster volume information and get the 
@@ -1475,7 +1521,8 @@ namespace openarchive
 
         }
 
-        std::error_code gfapi_iopx::dup (file_ptr_t src_fp, file_ptr_t dest_fp)
+        std::error_code gfapi_iopx::dup (const file_ptr_t & src_fp,
+                                         const file_ptr_t & dest_fp)
         {
             glfs_fd_t *dest_glfd = NULL, *src_glfd = NULL;
 
@@ -1494,7 +1541,7 @@ namespace openarchive
             }
 
             file_info_t info;
-            if (!(src_fp->get_file_info (get_name(), info))) {
+            if (!(src_fp->get_file_info (get_layer_id (), info))) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to find glusterfs fd info "
@@ -1537,7 +1584,7 @@ namespace openarchive
              * Save the fd for future fops.
              */ 
             info.set_glfd (dest_glfd); 
-            dest_fp->set_file_info (get_name(), info);
+            dest_fp->set_file_info (get_layer_id (), info);
 
             if (log_level >= openarchive::logger::level_debug_2) {
                 BOOST_LOG_FUNCTION ();
@@ -1656,7 +1703,8 @@ namespace openarchive
             return openarchive::success;
         } 
 
-        std::error_code gfapi_iopx::scan (file_ptr_t fp, req_ptr_t req)
+        std::error_code gfapi_iopx::scan (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             /*
              * Get the store name. Store name is supposed to be the volume name.
@@ -14,53 +14,86 @@ namespace openarchive
 {
     namespace iopx_req
     {
-        bool iopx_req::set_retcode (std::string name, int64_t value)
+        bool iopx_req::set_childcount (uint32_t layer, uint32_t count)
         {
-            return rcmap.insert (name, value);
-        }
+            if (layer >= max_layers) {
+                return false;
+            }
 
-        bool iopx_req::set_childcount (std::string name, uint64_t count)
-        {
-            return childcount.insert (name, count); 
+            /*
+             * Responses are counted afresh every time the request is
+             * handed out to the children.
+             */
+            layers[layer].respcount.store (0, std::memory_order_relaxed);
+            layers[layer].childcount = count;
+            return true;
         }
 
-        bool iopx_req::set_id (std::string name, uint64_t id)
+        bool iopx_req::set_id (uint32_t layer, uint32_t id)
         {
-            return idmap.insert (name, id); 
+            if (layer >= max_layers || layers[layer].id != no_layer_id) {
+                return false;
+            }
+
+            layers[layer].id = id;
+            return true; 
         }
 
-        bool iopx_req::post_resp (std::string name)
+        bool iopx_req::post_resp (uint32_t layer, uint64_t & count)
         {
-            return respcount.atomic_increment (name, 1);
+            if (layer >= max_layers || !layers[layer].childcount) {
+                return false;
+            }
+
+            /*
+             * Return the updated count so that exactly one of the children
+             * responding concurrently observes the last response.
+             */
+            count = layers[layer].respcount.fetch_add (1) + 1;
+            return true;
         }
 
-        bool iopx_req::erase_id (std::string name)
+        bool iopx_req::erase_id (uint32_t layer)
         {
-            idmap.erase (name);
+            if (layer >= max_layers) {
+                return false;
+            }
+
+            layers[layer].id = no_layer_id;
             return true; 
         }
 
-        bool iopx_req::get_retcode (std::string name, int64_t & ret)
+        bool iopx_req::get_childcount (uint32_t layer, uint64_t & count)
         {
-            return rcmap.extract (name, ret); 
-        }
+            if (layer >= max_layers || !layers[layer].childcount) {
+                return false;
+            }
 
-        bool iopx_req::get_childcount (std::string name, uint64_t & count)
-        {
-            return childcount.extract (name, count); 
+            count = layers[layer].childcount;
+            return true; 
         }
 
-        bool iopx_req::get_id (std::string name, uint64_t & id)
+        bool iopx_req::get_id (uint32_t layer, uint32_t & id)
         {
-            return idmap.extract (name, id); 
+            if (layer >= max_layers || layers[layer].id == no_layer_id) {
+                return false;
+            }
+
+            id = layers[layer].id;
+            return true; 
         }
 
-        bool iopx_req::get_resp (std::string name, uint64_t & count)
+        bool iopx_req::get_resp (uint32_t layer, uint64_t & count)
         {
-            return respcount.extract (name, count); 
+            if (layer >= max_layers || !layers[layer].childcount) {
+                return false;
+            }
+
+            count = layers[layer].respcount.load ();
+            return true; 
         }
   
-        void * get_buff_baseaddr (boost::shared_ptr<iopx_req> req)
+        void * get_buff_baseaddr (boost::intrusive_ptr<iopx_req> req)
         {
             void *buff = NULL;
             openarchive::iopx_req::data_type dtype = req->get_dtype (); 
@@ -83,7 +116,7 @@ namespace openarchive
             return buff;
         }
 
-        void * get_xtattr_baseaddr (boost::shared_ptr<iopx_req> req)
+        void * get_xtattr_baseaddr (boost::intrusive_ptr<iopx_req> req)
         {
             void *buff = NULL;
             openarchive::iopx_req::data_type dtype = req->get_dtype (); 
@@ -102,7 +135,7 @@ namespace openarchive
             return buff;
         }
 
-        struct stat * get_stat_baseaddr (boost::shared_ptr<iopx_req> req)
+        struct stat * get_stat_baseaddr (boost::intrusive_ptr<iopx_req> req)
         {
             struct stat * statp = NULL;
             openarchive::iopx_req::data_type dtype = req->get_dtype (); 
@@ -175,6 +208,7 @@ namespace openarchive
             req->set_offset (offset);
             req->set_len    (count);
             req->set_flags  (flag);
+            req->clear_slice ();
             req->set_poi    (iov);
 
             return;
@@ -188,6 +222,7 @@ namespace openarchive
             req->set_offset (offset);
             req->set_len    (count);
             req->set_flags  (flag);
+            req->clear_slice ();
             req->set_bufp   (buffp);
 
             return;
@@ -201,6 +236,7 @@ namespace openarchive
             req->set_offset (offset);
             req->set_len    (count);
             req->set_flags  (flag);
+            req->clear_slice ();
             req->set_pod    (buffp);
 
             return;
@@ -214,6 +250,7 @@ namespace openarchive
             req->set_offset (offset);
             req->set_len    (count);
             req->set_flags  (flag);
+            req->clear_slice ();
             req->set_poi    (iov);
 
             return;
@@ -227,11 +264,33 @@ namespace openarchive
             req->set_offset (offset);
             req->set_len    (count);
             req->set_flags  (flag);
+            req->clear_slice ();
             req->set_bufp   (buffp);
 
             return;
         }
 
+        void init_write_req (file_ptr_t fp, req_ptr_t req, uint64_t offset, 
+                             uint64_t count, uint64_t flag, 
+                             const buff_slice_t & slice)
+        {
+            req->set_fptr   (fp);
+            req->set_ftype  (openarchive::iopx_req::PWRITE_FOP);
+            req->set_offset (offset);
+            req->set_len    (count);
+            req->set_flags  (flag);
+            req->set_pod    (slice.get_base ());
+
+            /*
+             * The request holds the slice so that the buffer stays around
+             * until the write has completed.
+             */
+            req->clear_slice ();
+            req->set_slice  (slice);
+
+            return;
+        }
+
         void init_setxattr_req (file_ptr_t fp, req_ptr_t req, std::string name,
                                 struct iovec * val, uint64_t flags)
         {
@@ -0,0 +1,288 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cfgparams.h>
+#include <meta_cache.h>
+
+namespace openarchive
+{
+    namespace meta_iopx
+    {
+        meta_cache::meta_cache (uint32_t entries,
+                                std::chrono::milliseconds time):
+                                max_entries (entries),
+                                ttl (time),
+                                shards (new shard [num_meta_shards]),
+                                hits (0), misses (0), expired (0),
+                                inserts (0), stale (0), invalidations (0),
+                                evictions (0)
+        {
+            /*
+             * A ttl of 0 would make every entry expire right away.
+             */
+            if (!ttl.count ()) {
+                max_entries = 0;
+            }
+
+            shard_entries = 0;
+            if (max_entries) {
+                shard_entries = std::max ((uint32_t) 1,
+                                          max_entries / num_meta_shards);
+            }
+
+            for (uint32_t idx = 0; idx < num_meta_shards; idx++) {
+                shards[idx].version = 0;
+            }
+        }
+
+        meta_cache::~meta_cache (void)
+        {
+        }
+
+        void meta_cache::evict (shard &sh, size_t limit)
+        {
+            /*
+             * Two turns of the hand clear all the reference bits, the
+             * entries without a value never get a second chance.
+             */
+            for (size_t count = 2 * sh.ring.size ();
+                 count && sh.index.size () > limit; count--) {
+
+                std::string key = sh.ring.front ();
+                sh.ring.pop_front ();
+
+                index_t::iterator it = sh.index.find (key);
+                if (it == sh.index.end ()) {
+                    continue;
+                }
+
+                if (it->second.valid && it->second.ref) {
+                    it->second.ref = false;
+                    sh.ring.push_back (key);
+                    continue;
+                }
+
+                if (it->second.valid) {
+                    evictions++;
+                }
+
+                sh.index.erase (it);
+            }
+
+            return;
+        }
+
+        bool meta_cache::lookup (const std::string &key, void *buff,
+                                 size_t size, size_t &len)
+        {
+            if (!max_entries) {
+                return false;
+            }
+
+            shard & sh = get_shard (key);
+            bool found = false;
+
+            {
+                std::lock_guard<std::mutex> guard (sh.lock);
+
+                index_t::iterator it = sh.index.find (key);
+                if (it != sh.index.end () && it->second.valid) {
+
+                    entry & ent = it->second;
+
+                    if (ent.expiry <= std::chrono::steady_clock::now ()) {
+                        ent.valid = false;
+                        std::string ().swap (ent.value);
+                        expired++;
+
+                    } else if (!buff || size >= ent.value.size ()) {
+                        if (buff) {
+                            memcpy (buff, ent.value.data (),
+                                    ent.value.size ());
+                        }
+                        len = ent.value.size ();
+                        ent.ref = true;
+                        found = true;
+                    }
+                }
+            }
+
+            if (found) {
+                hits.fetch_add (1, std::memory_order_relaxed);
+            } else {
+                misses.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            return found;
+        }
+
+        uint64_t meta_cache::version (const std::string &key)
+        {
+            if (!max_entries) {
+                return 0;
+            }
+
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+            return sh.version;
+        }
+
+        void meta_cache::drop (shard &sh, const std::string &key)
+        {
+            sh.version++;
+
+            index_t::iterator it = sh.index.find (key);
+            if (it != sh.index.end () && it->second.valid) {
+                it->second.valid = false;
+                std::string ().swap (it->second.value);
+            }
+
+            invalidations++;
+            return;
+        }
+
+        void meta_cache::store (shard &sh, const std::string &key,
+                                const void *buff, size_t len)
+        {
+            meta_time_t expiry = std::chrono::steady_clock::now () + ttl;
+
+            index_t::iterator it = sh.index.find (key);
+            if (it == sh.index.end ()) {
+                evict (sh, shard_entries - 1);
+
+                entry ent = { std::string (), expiry, true, false };
+                it = sh.index.insert (std::make_pair (key, ent)).first;
+                sh.ring.push_back (key);
+            }
+
+            it->second.value.assign ((const char *) buff, len);
+            it->second.expiry = expiry;
+            it->second.valid = true;
+            inserts++;
+
+            return;
+        }
+
+        void meta_cache::insert (const std::string &key, const void *buff,
+                                 size_t len, uint64_t ver)
+        {
+            if (!max_entries || !buff) {
+                return;
+            }
+
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+
+            if (sh.version != ver) {
+                /*
+                 * A key of the shard has been set or removed since the
+                 * value was fetched, it may be stale.
+                 */
+                stale++;
+                return;
+            }
+
+            store (sh, key, buff, len);
+            return;
+        }
+
+        void meta_cache::invalidate (const std::string &key)
+        {
+            if (!max_entries) {
+                return;
+            }
+
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+
+            drop (sh, key);
+            return;
+        }
+
+        void meta_cache::update (const std::string &key, const void *buff,
+                                 size_t len)
+        {
+            if (!max_entries) {
+                return;
+            }
+
+            shard & sh = get_shard (key);
+
+            std::lock_guard<std::mutex> guard (sh.lock);
+
+            /*
+             * Fills which started before the set must not put the old
+             * value back over this one.
+             */
+            drop (sh, key);
+
+            if (buff) {
+                store (sh, key, buff, len);
+            }
+
+            return;
+        }
+
+        void meta_cache::getstats (std::string &stat)
+        {
+            uint64_t entries = 0;
+
+            for (uint32_t idx = 0; idx < num_meta_shards; idx++) {
+                std::lock_guard<std::mutex> guard (shards[idx].lock);
+                entries += shards[idx].index.size ();
+            }
+
+            stat = " meta cache max entries: " +
+                   boost::lexical_cast <std::string> (max_entries) +
+                   " entries: " + boost::lexical_cast <std::string> (entries) +
+                   " ttl ms: " +
+                   boost::lexical_cast <std::string> (ttl.count ()) +
+                   " hits: " +
+                   boost::lexical_cast <std::string> (hits.load ()) +
+                   " misses: " +
+                   boost::lexical_cast <std::string> (misses.load ()) +
+                   " expired: " +
+                   boost::lexical_cast <std::string> (expired.load ()) +
+                   " inserts: " +
+                   boost::lexical_cast <std::string> (inserts.load ()) +
+                   " stale: " +
+                   boost::lexical_cast <std::string> (stale.load ()) +
+                   " invalidations: " +
+                   boost::lexical_cast <std::string> (invalidations.load ()) +
+                   " evictions: " +
+                   boost::lexical_cast <std::string> (evictions.load ());
+            return;
+        }
+
+        static std::mutex meta_cache_lock;
+
+        meta_cache_ptr_t get_meta_cache (void)
+        {
+            std::lock_guard<std::mutex> guard (meta_cache_lock);
+
+            static meta_cache_ptr_t cache_ptr;
+
+            if (!cache_ptr) {
+                cache_ptr = boost::make_shared <meta_cache> (
+                               openarchive::cfgparams::get_meta_l1_entries (),
+                               openarchive::cfgparams::get_meta_l1_ttl ());
+            }
+
+            return cache_ptr;
+        }
+    }
+}
@@ -8,6 +8,7 @@
   cases as published by the Free Software Foundation.
 */
 
+#include <boost/lexical_cast.hpp>
 #include <meta_iopx.h>
 
 namespace openarchive
@@ -17,9 +18,11 @@ namespace openarchive
         meta_iopx::meta_iopx (std::string name, io_service_ptr_t svc,
                               uint32_t time): 
                               openarchive::arch_iopx::arch_iopx (name, svc),
-                              ttl (time)
+                              ttl (time),
+                              mc_hits (0), mc_misses (0)
         {
             log_level = openarchive::cfgparams::get_log_level();
+            l1 = get_meta_cache ();
         } 
 
         meta_iopx::~meta_iopx (void)
@@ -63,8 +66,20 @@ namespace openarchive
 
         std::string meta_iopx::form_key (file_ptr_t fp, req_ptr_t req)
         {
-            std::string key = fp->get_loc ().get_uuidstr () +
-                              std::string (".") + req->get_desc ();  
+            /*
+             * The key is built in place from the binary uuid to avoid the
+             * temporaries of string concatenation.
+             */
+            char uid[37];
+            const char * desc = req->get_desc ();
+            std::string key;
+
+            uuid_unparse_lower (fp->get_loc ().get_uuidkey ().data, uid);
+
+            key.reserve (sizeof (uid) + strlen (desc));
+            key.append (uid);
+            key.push_back ('.');
+            key.append (desc);
 
             return key;
         } 
@@ -82,10 +97,22 @@ namespace openarchive
             kv.ttl = ttl;
  
             std::error_code ec = mcache->set (kv);
+
+            /*
+             * The near-cache only takes the new value if memcached did,
+             * otherwise the next get goes to memcached or the store.
+             */
+            if (ec == ok) {
+                l1->update (kv.key, buff, size);
+            } else {
+                l1->invalidate (kv.key);
+            }
+
             return ec;
         }
     
-        std::error_code meta_iopx::fsetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code meta_iopx::fsetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             /*
              * We will invoke the child iopx. If the call succeeds @ child 
@@ -103,7 +130,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code meta_iopx::setxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code meta_iopx::setxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             /*
              * We will invoke the child iopx. If the call succeeds @ child 
@@ -122,16 +150,36 @@ namespace openarchive
         }
 
         std::error_code meta_iopx::pxgetxreq (file_ptr_t fp, req_ptr_t req, 
-                                              bool & found)
+                                              bool & found, uint64_t & ver)
         {
-            mem_cache_ptr_t mcache = get_mcache (fp);
+            void *buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
             kvpair_t kv; 
             kv.key = form_key (fp, req);
             found = false;
 
+            size_t len = 0;
+            if (l1->lookup (kv.key, buff, req->get_len (), len)) {
+                /*
+                 * Served out of process, no round trip to memcached.
+                 */
+                req->set_ret (len);
+                found = true;
+                return openarchive::success;
+            }
+
+            /*
+             * Taken before the value is fetched, a set or a remove of the
+             * key in the meanwhile keeps the value out of the near-cache.
+             */
+            ver = l1->version (kv.key);
+
+            mem_cache_ptr_t mcache = get_mcache (fp);
             std::error_code ec = mcache->get (kv);
             if (ec == ok) {
 
+                mc_hits++;
+                l1->insert (kv.key, kv.value.iov_base, kv.value.iov_len, ver);
+
                 /*
                  * Found a valid entry in memcached
                  */
@@ -141,7 +189,6 @@ namespace openarchive
                                    << "Cache hit for " << kv.key; 
                 }
 
-                void *buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
                 if (buff && req->get_len() >= kv.value.iov_len) {
                     memcpy (buff, kv.value.iov_base, kv.value.iov_len);
                     req->set_ret (kv.value.iov_len);
@@ -158,6 +205,7 @@ namespace openarchive
 
             } else {
 
+                mc_misses++;
                 if (log_level >= openarchive::logger::level_debug_2) {
                     BOOST_LOG_FUNCTION ();
                     BOOST_LOG_SEV (log, openarchive::logger::level_debug_2)
@@ -168,7 +216,39 @@ namespace openarchive
             return openarchive::success; 
         }
 
-        std::error_code meta_iopx::fgetxattr (file_ptr_t fp, req_ptr_t req)
+        /*
+         * Cache the extended attribute just fetched from the child iopx
+         * in memcached and in the near-cache.
+         */
+        void meta_iopx::pxgetxresp (file_ptr_t fp, req_ptr_t req, uint64_t ver)
+        {
+            void *buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
+            size_t size = req->get_ret ();
+
+            if (!buff) {
+                /*
+                 * In some cases fgetxattr can be invoked with NULL pointer to
+                 * determine the length of extended attrribute.
+                 */ 
+                return;
+            }
+
+            mem_cache_ptr_t mcache = get_mcache (fp);
+
+            kvpair_t kv; 
+            kv.key = form_key (fp, req);
+            kv.value.iov_base = buff;
+            kv.value.iov_len = size;
+            kv.ttl = ttl;
+
+            mcache->set (kv);
+            l1->insert (kv.key, buff, size, ver);
+
+            return;
+        }
+
+        std::error_code meta_iopx::fgetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             /*
              * We will check whether the memcached contains the extended 
@@ -176,7 +256,8 @@ namespace openarchive
              * will invoke the child iopx.
              */ 
             bool found = false;
-            std::error_code ec = pxgetxreq (fp, req, found);
+            uint64_t ver = 0;
+            std::error_code ec = pxgetxreq (fp, req, found, ver);
             if (ec != ok || found) {
                 return ec;
             }
@@ -190,31 +271,13 @@ namespace openarchive
                 return ec;
             }
             
-            mem_cache_ptr_t mcache = get_mcache (fp);
-            void *buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
-            size_t size = req->get_ret ();
-
-            if (buff) {
-
-                /*
-                 * In some cases fgetxattr can be invoked with NULL pointer to
-                 * determine the length of extended attrribute.
-                 */ 
-
-                kvpair_t kv; 
-                kv.key = form_key (fp, req);
-                kv.value.iov_base = buff;
-                kv.value.iov_len = size;
-                kv.ttl = ttl;
-
-                mcache->set (kv);
-
-            }
+            pxgetxresp (fp, req, ver);
 
             return openarchive::success; 
         }
 
-        std::error_code meta_iopx::getxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code meta_iopx::getxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             /*
              * We will check whether the memcached contains the extended 
@@ -222,7 +285,8 @@ namespace openarchive
              * will invoke the child iopx.
              */ 
             bool found = false;
-            std::error_code ec = pxgetxreq (fp, req, found);
+            uint64_t ver = 0;
+            std::error_code ec = pxgetxreq (fp, req, found, ver);
             if (ec != ok || found) {
                 return ec;
             }
@@ -236,25 +300,13 @@ namespace openarchive
                 return ec;
             }
             
-            mem_cache_ptr_t mcache = get_mcache (fp);
-            void *buff = openarchive::iopx_req::get_xtattr_baseaddr (req);
-            size_t size = req->get_ret ();
-
-            if (buff) {
-
-                kvpair_t kv; 
-                kv.key = form_key (fp, req);
-                kv.value.iov_base = buff;
-                kv.value.iov_len = size;
-                kv.ttl = ttl;
-
-                mcache->set (kv);
-            }
+            pxgetxresp (fp, req, ver);
 
             return openarchive::success; 
         }
 
-        std::error_code meta_iopx::fremovexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code meta_iopx::fremovexattr (const file_ptr_t & fp,
+                                                 const req_ptr_t & req)
         {
             /*
              * We will clear the entry from memcached. Then we will invoke
@@ -269,10 +321,19 @@ namespace openarchive
                 return ec;
             }
 
-            return get_first_child ()->fremovexattr (fp, req);
+            ec = get_first_child ()->fremovexattr (fp, req);
+
+            /*
+             * Dropped from the near-cache once the store no longer has
+             * the attribute, a racing lookup cannot cache it again.
+             */
+            l1->invalidate (kv.key);
+
+            return ec;
         }
 
-        std::error_code meta_iopx::removexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code meta_iopx::removexattr (const file_ptr_t & fp,
+                                                const req_ptr_t & req)
         {
             /*
              * We will clear the entry from memcached. Then we will invoke
@@ -287,7 +348,41 @@ namespace openarchive
                 return ec;
             }
 
-            return get_first_child ()->removexattr (fp, req);
+            ec = get_first_child ()->removexattr (fp, req);
+
+            /*
+             * Dropped from the near-cache once the store no longer has
+             * the attribute, a racing lookup cannot cache it again.
+             */
+            l1->invalidate (kv.key);
+
+            return ec;
+        }
+
+        void meta_iopx::profile (void)
+        {
+            std::string stats;
+
+            l1->getstats (stats);
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << stats;
+            }
+
+            stats = " memcached hits: " +
+                    boost::lexical_cast <std::string> (mc_hits.load ()) +
+                    " misses: " +
+                    boost::lexical_cast <std::string> (mc_misses.load ());
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << stats;
+            }
+
+            get_first_child ()->profile ();
+
+            return;
         }
     }
 }
@@ -72,7 +72,8 @@ namespace openarchive
         {
         }
 
-        std::error_code perf_iopx::open (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::open (const file_ptr_t & fp,
+                                         const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -89,7 +90,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::close (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::close (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -123,7 +125,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::pread (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::pread (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -149,9 +152,17 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::pread_async (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::pread_async (const file_ptr_t & fp,
+                                                const req_ptr_t & req)
         {
-            uint64_t num = seq.fetch_add (1);
+            /*
+             * The ids wrap around, the requests of a wrapped id are long
+             * gone by then. The value marking a free slot is skipped.
+             */
+            uint32_t num = seq.fetch_add (1);
+            if (num == openarchive::iopx_req::no_layer_id) {
+                num = seq.fetch_add (1);
+            }
                    
             req_info info;
             info.start = std::chrono::high_resolution_clock::now();
@@ -168,7 +179,7 @@ namespace openarchive
             /*
              * Add an entry for this iopx in the req object
              */
-            if (false == req->set_id (get_name (), num)) {
+            if (false == req->set_id (get_layer_id (), num)) {
                 BOOST_LOG_FUNCTION ();
                 BOOST_LOG_SEV (log, openarchive::logger::level_error)
                                << " failed to insert entry in id map for file "
@@ -181,15 +192,16 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::pread_cbk (file_ptr_t fp, req_ptr_t req,
+        std::error_code perf_iopx::pread_cbk (const file_ptr_t & fp,
+                                              const req_ptr_t & req,
                                               std::error_code ec)
         {
             /*
              * Get the ID for this request from the idmap inside request.
              */
-            uint64_t id;
+            uint32_t id;
 
-            if (req->get_id (get_name (), id)) {
+            if (req->get_id (get_layer_id (), id)) {
 
                 /*
                  * Got id generated by this iopx from the request object
@@ -233,7 +245,7 @@ namespace openarchive
                     request_map.erase (id);
                 } 
 
-                req->erase_id (get_name ());
+                req->erase_id (get_layer_id ());
 
             } else {
 
@@ -249,7 +261,8 @@ namespace openarchive
             return openarchive::success;
         }
 
-        std::error_code perf_iopx::pwrite (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::pwrite (const file_ptr_t & fp,
+                                           const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -271,7 +284,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::fstat (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::fstat (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -288,7 +302,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::stat (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::stat (const file_ptr_t & fp,
+                                         const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -305,7 +320,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::ftruncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::ftruncate (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -322,7 +338,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::truncate (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::truncate (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -339,7 +356,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::fsetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::fsetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -356,7 +374,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::setxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::setxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -373,7 +392,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::fgetxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::fgetxattr (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -390,7 +410,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::getxattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::getxattr (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -407,7 +428,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::fremovexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::fremovexattr (const file_ptr_t & fp,
+                                                 const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -424,7 +446,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::removexattr (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::removexattr (const file_ptr_t & fp,
+                                                const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -441,7 +464,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::lseek (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::lseek (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -458,7 +482,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::getuuid (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::getuuid (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -475,7 +500,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::gethosts (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::gethosts (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -492,7 +518,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::mkdir (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::mkdir (const file_ptr_t & fp,
+                                          const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -509,7 +536,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::resolve (file_ptr_t fp, req_ptr_t req)
+        std::error_code perf_iopx::resolve (const file_ptr_t & fp,
+                                            const req_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -526,7 +554,8 @@ namespace openarchive
             return ec;
         }
 
-        std::error_code perf_iopx::dup (file_ptr_t fp, file_ptr_t req)
+        std::error_code perf_iopx::dup (const file_ptr_t & fp,
+                                        const file_ptr_t & req)
         {
             std::chrono::high_resolution_clock::time_point start, end;
             uint64_t delta;
@@ -646,7 +675,7 @@ namespace openarchive
              */
             file_info_t info;
 
-            if (!fp->get_file_info ("arch_store", info)) {
+            if (!fp->get_file_info (openarchive::arch_file::store_slot, info)) {
                 assert (0);
             }
 
@@ -663,7 +692,7 @@ namespace openarchive
                 /*
                  * Remove the slots
                  */
-                fp->erase_file_info ("arch_store");
+                fp->erase_file_info (openarchive::arch_file::store_slot);
 
                 /*
                  * Now invoke the callback
@@ -0,0 +1,570 @@
+/*
+  Copyright (c) 2006-2011 Commvault systems, Inc. <http://www.commvault.com>.
+  This file is part of OpenArchive.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+#include <algorithm>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include <wbcache_iopx.h>
+
+namespace openarchive
+{
+    namespace wbcache_iopx
+    {
+        wbcache_iopx::wbcache_iopx (std::string name, io_service_ptr_t svc,
+                                    uint64_t limit):
+                                    openarchive::arch_iopx::arch_iopx (name, svc),
+                                    dirty (0),
+                                    stop (false),
+                                    pool ("wbpool"),
+                                    req_pool ("reqpool"),
+                                    writes (0), merges (0), passthru (0),
+                                    full_flushes (0), partial_flushes (0),
+                                    bytes_flushed (0), throttled (0),
+                                    failures (0)
+        {
+            log_level = openarchive::cfgparams::get_log_level ();
+            interval = openarchive::cfgparams::get_wb_flush_interval ();
+
+            /*
+             * The writers wait for the flusher at the limit, it has to
+             * leave room for at least one extent.
+             */
+            dirty_limit = std::max (limit, (uint64_t) wb_extent_size);
+
+            flusher = std::thread (boost::bind (&wbcache_iopx::flush_loop,
+                                                this));
+        }
+
+        wbcache_iopx::~wbcache_iopx (void)
+        {
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                stop = true;
+            }
+
+            flush_cv.notify_all ();
+            space_cv.notify_all ();
+            flusher.join ();
+
+            /*
+             * The dirty files hold a reference to the tree, files are only
+             * left here if the tree is torn down without being released.
+             */
+            std::vector <wb_file_ptr_t> victims;
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                file_map_t::iterator iter;
+                for (iter = files.begin (); iter != files.end (); iter++) {
+                    victims.push_back (iter->second);
+                }
+            }
+
+            std::vector <wb_file_ptr_t>::iterator iter;
+            for (iter = victims.begin (); iter != victims.end (); iter++) {
+                std::lock_guard<std::mutex> guard ((*iter)->op_mtx);
+                flush_file (**iter, false);
+            }
+        }
+
+        wb_file_ptr_t wbcache_iopx::lookup (const file_ptr_t &fp, bool create)
+        {
+            std::lock_guard<std::mutex> guard (lock);
+
+            file_map_t::iterator iter = files.find (fp.get ());
+            if (iter != files.end ()) {
+                return iter->second;
+            }
+
+            wb_file_ptr_t file;
+            if (create) {
+                file = boost::make_shared <wb_file> ();
+                file->fp = fp;
+                file->dead = false;
+                files.insert (std::make_pair (fp.get (), file));
+            }
+
+            return file;
+        }
+
+        std::error_code wbcache_iopx::write_extent (const file_ptr_t &fp,
+                                                    uint64_t base,
+                                                    const wb_extent &ext)
+        {
+            req_ptr_t req = req_pool.make_intrusive ();
+            if (!req) {
+                return std::error_code (ENOMEM, std::generic_category ());
+            }
+
+            char * data = (char *) ext.plbuff->get_base ();
+            uint32_t done = ext.lo;
+
+            while (done < ext.hi) {
+
+                struct iovec iov = { data + done, ext.hi - done };
+                openarchive::iopx_req::init_write_req (fp, req, base + done,
+                                                       ext.hi - done, 0,
+                                                       &iov);
+
+                std::error_code ec = get_first_child ()->pwrite (fp, req);
+                if (ec != ok) {
+                    return ec;
+                }
+
+                if (req->get_ret () <= 0) {
+                    return std::error_code (EIO, std::generic_category ());
+                }
+
+                done += req->get_ret ();
+            }
+
+            bytes_flushed.fetch_add (ext.hi - ext.lo);
+            return openarchive::success;
+        }
+
+        /*
+         * Write back one extent of the file, called with the op_mtx of the
+         * file held. The extent is dropped even if the write fails, the
+         * error is kept for the next write or close of the file.
+         */
+        std::error_code wbcache_iopx::flush_extent (wb_file &file,
+                                                    uint64_t base)
+        {
+            std::map <uint64_t, wb_extent>::iterator it;
+            it = file.extents.find (base);
+            if (it == file.extents.end ()) {
+                return openarchive::success;
+            }
+
+            wb_extent ext = it->second;
+            file.extents.erase (it);
+
+            if (ext.lo == 0 && ext.hi == wb_extent_size) {
+                full_flushes++;
+            } else {
+                partial_flushes++;
+            }
+
+            std::error_code ec = write_extent (file.fp, base, ext);
+
+            ext.plbuff.reset ();
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                dirty -= wb_extent_size;
+            }
+            space_cv.notify_all ();
+
+            if (ec != ok) {
+                failures++;
+                if (!file.error) {
+                    file.error = ec;
+                }
+
+                if (log_level >= openarchive::logger::level_error) {
+                    BOOST_LOG_FUNCTION ();
+                    BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                                   << " write back failed for "
+                                   << file.fp->get_loc ().get_pathstr ()
+                                   << " offset: " << base + ext.lo
+                                   << " bytes: " << ext.hi - ext.lo
+                                   << " error code: " << ec.value ();
+                }
+            }
+
+            return ec;
+        }
+
+        /*
+         * Write back the extents of the file, only those dirty for longer
+         * than the flush interval if aged is set. Called with the op_mtx
+         * of the file held.
+         */
+        void wbcache_iopx::flush_file (wb_file &file, bool aged)
+        {
+            wb_time_t limit = std::chrono::steady_clock::now () - interval;
+            std::vector <uint64_t> bases;
+
+            std::map <uint64_t, wb_extent>::iterator it;
+            for (it = file.extents.begin (); it != file.extents.end (); it++) {
+                if (!aged || it->second.dirtied <= limit) {
+                    bases.push_back (it->first);
+                }
+            }
+
+            std::vector <uint64_t>::iterator iter;
+            for (iter = bases.begin (); iter != bases.end (); iter++) {
+                flush_extent (file, *iter);
+            }
+
+            return;
+        }
+
+        std::error_code wbcache_iopx::take_error (wb_file &file)
+        {
+            std::error_code ec = file.error;
+            file.error = std::error_code ();
+            return ec;
+        }
+
+        /*
+         * Drop the file from the map once it has nothing left to write
+         * back or to report. Called with the op_mtx of the file held.
+         */
+        void wbcache_iopx::release (wb_file &file)
+        {
+            if (!file.extents.empty () || file.error) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard (lock);
+
+            file_map_t::iterator iter = files.find (file.fp.get ());
+            if (iter != files.end () && iter->second.get () == &file) {
+                files.erase (iter);
+            }
+
+            file.dead = true;
+            return;
+        }
+
+        /*
+         * Write back all the extents of the file and return the first
+         * error not reported yet.
+         */
+        std::error_code wbcache_iopx::flush (const file_ptr_t &fp)
+        {
+            wb_file_ptr_t file = lookup (fp, false);
+            if (!file) {
+                return openarchive::success;
+            }
+
+            std::lock_guard<std::mutex> guard (file->op_mtx);
+
+            flush_file (*file, false);
+            std::error_code ec = take_error (*file);
+            release (*file);
+
+            return ec;
+        }
+
+        void wbcache_iopx::throttle (void)
+        {
+            std::unique_lock<std::mutex> guard (lock);
+
+            if (dirty + wb_extent_size <= dirty_limit) {
+                return;
+            }
+
+            throttled++;
+            flush_cv.notify_one ();
+            space_cv.wait (guard, [this] {
+                               return (stop ||
+                                       dirty + wb_extent_size <= dirty_limit);
+                           });
+
+            return;
+        }
+
+        /*
+         * Copy the data of a write into the extents of the file, called
+         * with the op_mtx of the file held. Returns false if a buffer could
+         * not be allocated, the data copied so far stays in the extents.
+         */
+        bool wbcache_iopx::buffer (wb_file &file, uint64_t offset,
+                                   uint64_t len, const char *data)
+        {
+            while (len) {
+
+                uint64_t base = offset & ~((uint64_t) wb_extent_size - 1);
+                uint32_t lo = offset - base;
+                uint32_t hi = std::min ((uint64_t) wb_extent_size, lo + len);
+
+                std::map <uint64_t, wb_extent>::iterator it;
+                it = file.extents.find (base);
+
+                if (it != file.extents.end () &&
+                    (lo > it->second.hi || hi < it->second.lo)) {
+                    /*
+                     * The extent only holds one range, the write would
+                     * leave a hole in it.
+                     */
+                    flush_extent (file, base);
+                    it = file.extents.end ();
+                }
+
+                if (it == file.extents.end ()) {
+
+                    plbuff_ptr_t plbuff = pool.make_shared ();
+                    if (!plbuff) {
+                        return false;
+                    }
+
+                    wb_extent ext = { lo, hi, std::chrono::steady_clock::now (),
+                                      plbuff };
+                    it = file.extents.insert (std::make_pair (base, ext)).first;
+
+                    std::lock_guard<std::mutex> guard (lock);
+                    dirty += wb_extent_size;
+
+                } else {
+
+                    it->second.lo = std::min (it->second.lo, lo);
+                    it->second.hi = std::max (it->second.hi, hi);
+                    merges++;
+                }
+
+                memcpy ((char *) it->second.plbuff->get_base () + lo, data,
+                        hi - lo);
+
+                if (it->second.lo == 0 && it->second.hi == wb_extent_size) {
+                    flush_extent (file, base);
+                }
+
+                data += hi - lo;
+                offset += hi - lo;
+                len -= hi - lo;
+            }
+
+            return true;
+        }
+
+        void wbcache_iopx::flush_loop (void)
+        {
+            std::unique_lock<std::mutex> guard (lock);
+
+            while (!stop) {
+
+                flush_cv.wait_for (guard, interval);
+                if (stop) {
+                    break;
+                }
+
+                /*
+                 * Past half of the limit everything is written back until
+                 * the dirty bytes are under it again, otherwise only the
+                 * extents which have aged.
+                 */
+                bool pressure = (dirty > dirty_limit / 2);
+
+                std::vector <wb_file_ptr_t> victims;
+                file_map_t::iterator iter;
+                for (iter = files.begin (); iter != files.end (); iter++) {
+                    victims.push_back (iter->second);
+                }
+
+                guard.unlock ();
+
+                std::vector <wb_file_ptr_t>::iterator vic;
+                for (vic = victims.begin (); vic != victims.end (); vic++) {
+                    {
+                        std::lock_guard<std::mutex> fguard ((*vic)->op_mtx);
+                        if (!(*vic)->dead) {
+                            flush_file (**vic, !pressure);
+                            release (**vic);
+                        }
+                    }
+
+                    if (pressure) {
+                        std::lock_guard<std::mutex> dguard (lock);
+                        pressure = (dirty > dirty_limit / 2);
+                    }
+                }
+
+                /*
+                 * The last reference of a file may go away here, which
+                 * closes it through the tree.
+                 */
+                victims.clear ();
+                guard.lock ();
+            }
+
+            return;
+        }
+
+        std::error_code wbcache_iopx::pwrite (const file_ptr_t & fp,
+                                              const req_ptr_t & req)
+        {
+            uint64_t offset = req->get_offset ();
+            uint64_t len = req->get_len ();
+            const char * data = (const char *)
+                                openarchive::iopx_req::get_buff_baseaddr (req);
+            std::error_code ec;
+
+            if (req->get_asyncio () || !data ||
+                (!(offset & (wb_extent_size - 1)) && len >= wb_extent_size)) {
+                /*
+                 * Aligned writes of whole extents gain nothing from being
+                 * copied, the dirty data of the file goes first so that
+                 * the writes reach the child in order.
+                 */
+                ec = flush (fp);
+                if (ec != ok) {
+                    req->set_ret (-1);
+                    return ec;
+                }
+
+                passthru++;
+                return fop_default (fp, req);
+            }
+
+            throttle ();
+
+            for (;;) {
+
+                wb_file_ptr_t file = lookup (fp, true);
+                std::lock_guard<std::mutex> guard (file->op_mtx);
+
+                if (file->dead) {
+                    /*
+                     * Written back and dropped by the flusher while this
+                     * writer was waiting for it.
+                     */
+                    continue;
+                }
+
+                if (!buffer (*file, offset, len, data)) {
+                    /*
+                     * Out of buffers, the write goes through once the
+                     * extents of the file have been written back.
+                     */
+                    flush_file (*file, false);
+                    ec = take_error (*file);
+                    if (ec == ok) {
+                        passthru++;
+                        ec = get_first_child ()->pwrite (fp, req);
+                    }
+
+                    release (*file);
+                    return ec;
+                }
+
+                writes++;
+
+                ec = take_error (*file);
+                release (*file);
+                break;
+            }
+
+            req->set_ret (ec == ok? (int64_t) len: -1);
+            return ec;
+        }
+
+        std::error_code wbcache_iopx::close (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
+        {
+            /*
+             * The file is closed even if the write back failed, the error
+             * is returned in place of the result of the close.
+             */
+            std::error_code ec = flush (fp);
+            std::error_code cec = fop_default (fp, req);
+
+            return (ec != ok? ec: cec);
+        }
+
+        std::error_code wbcache_iopx::pread (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
+        {
+            std::error_code ec = flush (fp);
+            if (ec != ok) {
+                req->set_ret (-1);
+                return ec;
+            }
+
+            return fop_default (fp, req);
+        }
+
+        std::error_code wbcache_iopx::fstat (const file_ptr_t & fp,
+                                             const req_ptr_t & req)
+        {
+            std::error_code ec = flush (fp);
+            if (ec != ok) {
+                return ec;
+            }
+
+            return fop_default (fp, req);
+        }
+
+        std::error_code wbcache_iopx::ftruncate (const file_ptr_t & fp,
+                                                 const req_ptr_t & req)
+        {
+            std::error_code ec = flush (fp);
+            if (ec != ok) {
+                return ec;
+            }
+
+            return fop_default (fp, req);
+        }
+
+        std::error_code wbcache_iopx::truncate (const file_ptr_t & fp,
+                                                const req_ptr_t & req)
+        {
+            std::error_code ec = flush (fp);
+            if (ec != ok) {
+                return ec;
+            }
+
+            return fop_default (fp, req);
+        }
+
+        void wbcache_iopx::profile (void)
+        {
+            std::string stats;
+            uint64_t held;
+            size_t nfiles;
+
+            {
+                std::lock_guard<std::mutex> guard (lock);
+                held = dirty;
+                nfiles = files.size ();
+            }
+
+            stats = " write-back cache dirty: " +
+                    boost::lexical_cast <std::string> (held) +
+                    " limit: " +
+                    boost::lexical_cast <std::string> (dirty_limit) +
+                    " files: " + boost::lexical_cast <std::string> (nfiles) +
+                    " writes: " +
+                    boost::lexical_cast <std::string> (writes.load ()) +
+                    " merges: " +
+                    boost::lexical_cast <std::string> (merges.load ()) +
+                    " passthru: " +
+                    boost::lexical_cast <std::string> (passthru.load ()) +
+                    " full flushes: " +
+                    boost::lexical_cast <std::string> (full_flushes.load ()) +
+                    " partial flushes: " +
+                    boost::lexical_cast <std::string> (
+                                                   partial_flushes.load ()) +
+                    " bytes flushed: " +
+                    boost::lexical_cast <std::string> (bytes_flushed.load ()) +
+                    " throttled: " +
+                    boost::lexical_cast <std::string> (throttled.load ()) +
+                    " failures: " +
+                    boost::lexical_cast <std::string> (failures.load ());
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << stats;
+            }
+
+            std::string pool_stats;
+            pool.getstats (pool_stats);
+            {
+                BOOST_LOG_FUNCTION ();
+                BOOST_LOG_SEV (log, openarchive::logger::level_error)
+                               << pool_stats;
+            }
+
+            get_first_child ()->profile ();
+
+            return;
+        }
+    }
+}